@@ -0,0 +1,384 @@
+/**
+ * @file allocator_tests.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Checks the kernel's allocators on the build machine, where a failure is a
+ * message rather than a reboot: the bookkeeping ones (the heap's free list
+ * index, the early allocator and the virtual range allocator) directly, and
+ * the stack the kernel builds at boot over a fake address space, with the
+ * same benchmarks and fuzzing the BOOT_TESTS kernel runs.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "host_mapper.h"
+#include "mm/allocator_bench.h"
+#include "mm/arena.h"
+#include "mm/early_allocator.h"
+#include "mm/frame_allocator.h"
+#include "mm/kheap.h"
+#include "mm/page_allocator.h"
+#include "mm/shrinker.h"
+#include "mm/size_class.h"
+#include "mm/slab.h"
+#include "mm/tlsf.h"
+#include "mm/virtual_range.h"
+
+namespace {
+
+size_t failures = 0;
+
+void Check(bool ok, const char *file, int line, const char *desc) {
+  if (ok)
+    return;
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, desc);
+  ++failures;
+}
+
+#define CHECK(b) Check((b), __FILE__, __LINE__, #b)
+
+/**
+ * A xorshift generator, so every run sees the same requests.
+ */
+inline uint32_t NextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+inline uint32_t AddressOf(const void *ptr) {
+  return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptr));
+}
+
+inline bool Overlaps(uint32_t a, uint32_t a_size, uint32_t b,
+                     uint32_t b_size) {
+  return a < b + b_size && b < a + a_size;
+}
+
+/**
+ * Stands in for physical memory. Frames are handed out in order, and every
+ * free is checked and remembered.
+ */
+class FakeFrameAllocator : public paging::IFrameAllocator {
+public:
+  static const size_t kFrames = 1024;
+
+  FakeFrameAllocator() : next_(0), freed_count_(0) {
+    memset(freed_, 0, sizeof(freed_));
+  }
+
+  virtual optional<paging::Frame> Allocate() {
+    if (next_ == kFrames)
+      return {};
+    return paging::Frame(next_++);
+  }
+
+  virtual void Free(paging::Frame frame) {
+    CHECK(frame.index() < kFrames);
+    if (frame.index() >= kFrames)
+      return;
+    CHECK(!freed_[frame.index()]);
+    freed_[frame.index()] = true;
+    ++freed_count_;
+  }
+
+  inline bool was_freed(size_t index) const { return freed_[index]; }
+  inline size_t freed_count() const { return freed_count_; }
+
+private:
+  size_t next_;
+  size_t freed_count_;
+  bool freed_[kFrames];
+};
+
+/**
+ * Gets the smallest block size that goes on a list.
+ */
+size_t ListMinimum(uint32_t fl, uint32_t sl) {
+  using namespace alloc::tlsf;
+  if (fl == 0)
+    return sl * (kSmallBlockSize / kSecondLevelCount);
+  return static_cast<size_t>(kSecondLevelCount + sl)
+         << (fl + kFirstLevelShift - 1 - kSecondLevelLog2);
+}
+
+void TestTlsfIndex() {
+  using namespace alloc::tlsf;
+
+  // every list starts where MappingInsert says it does
+  for (uint32_t fl = 0; fl < kFirstLevelCount; ++fl) {
+    for (uint32_t sl = 0; sl < kSecondLevelCount; ++sl) {
+      uint32_t got_fl, got_sl;
+      MappingInsert(ListMinimum(fl, sl), got_fl, got_sl);
+      CHECK(got_fl == fl && got_sl == sl);
+    }
+  }
+
+  uint32_t last = 0;
+  for (size_t size = kAlign; size < (1u << kFirstLevelMax);) {
+    uint32_t fl, sl;
+    MappingInsert(size, fl, sl);
+    CHECK(fl < kFirstLevelCount && sl < kSecondLevelCount);
+    CHECK(ListMinimum(fl, sl) <= size);
+    auto list = fl * kSecondLevelCount + sl;
+    CHECK(list >= last);
+    last = list;
+
+    // the search lands on this list if the size starts it, else the next
+    uint32_t search_fl, search_sl;
+    MappingSearch(size, search_fl, search_sl);
+    auto search = search_fl * kSecondLevelCount + search_sl;
+    CHECK(search == (ListMinimum(fl, sl) == size ? list : list + 1));
+    if (search_fl < kFirstLevelCount)
+      CHECK(ListMinimum(search_fl, search_sl) >= size);
+
+    auto step = (size >> 8) & ~(kAlign - 1);
+    size += step > kAlign ? step : kAlign;
+  }
+}
+
+void TestEarlyAllocator() {
+  const uint32_t kStart = 0xC0100123;
+  const uint32_t kLimit = 0xC0400000;
+  const uint32_t kReserved = 0xC0200000;
+  const uint32_t kReservedSize = 0x3000;
+  // few enough that the frees below never run out of regions to split into
+  const size_t kBlocks = 24;
+
+  alloc::EarlyAllocator early(kStart, kLimit);
+  early.Reserve(kReserved, kReservedSize);
+  // only the part inside the allocator's range is recorded
+  early.Reserve(kLimit - 0x1000, 0x2000);
+
+  struct {
+    uint32_t start;
+    uint32_t size;
+    bool live;
+  } blocks[kBlocks];
+  size_t expected_used = kReservedSize + 0x1000;
+  for (size_t i = 0; i < kBlocks; ++i) {
+    uint32_t size = 8 + (i * 40) % 5000;
+    size_t alignment = i % 4 == 0 ? 4096 : i % 4 == 1 ? 64 : 8;
+    auto block = early.AllocateAligned(size, alignment);
+    CHECK(block != nullptr);
+    auto start = AddressOf(block);
+    CHECK(start >= kStart && start + size <= kLimit - 0x1000);
+    CHECK(start % alignment == 0);
+    CHECK(!Overlaps(start, size, kReserved, kReservedSize));
+    for (size_t j = 0; j < i; ++j)
+      CHECK(!Overlaps(start, size, blocks[j].start, blocks[j].size));
+    blocks[i] = {start, size, true};
+    expected_used += size;
+  }
+  CHECK(early.used_bytes() == expected_used);
+
+  for (size_t i = 0; i < kBlocks; i += 3) {
+    early.FreeSized(reinterpret_cast<void *>(blocks[i].start), blocks[i].size);
+    blocks[i].live = false;
+    expected_used -= blocks[i].size;
+  }
+  CHECK(early.used_bytes() == expected_used);
+
+  // every page no live block or reservation touches goes back, and no other
+  FakeFrameAllocator frames;
+  auto released = early.Release(frames);
+  CHECK(released == frames.freed_count());
+  size_t expected_released = 0;
+  for (uint32_t page = (kStart + 0xFFF) & ~0xFFFu; page < kLimit;
+       page += 0x1000) {
+    bool touched = Overlaps(page, 0x1000, kReserved, kReservedSize) ||
+                   page >= kLimit - 0x1000;
+    for (auto &block : blocks)
+      touched |= block.live && Overlaps(page, 0x1000, block.start, block.size);
+    auto frame = (page - 0xC0000000) / 0x1000;
+    CHECK(frames.was_freed(frame) == !touched);
+    if (!touched)
+      ++expected_released;
+  }
+  CHECK(released == expected_released);
+}
+
+void TestVirtualRangeAllocator() {
+  const size_t kPages = 512;
+  const size_t kRuns = 64;
+
+  // too big for the stack
+  static paging::VirtualRangeAllocator ranges(
+      paging::kKernelVirtualRangeStart, kPages);
+  static bool used[kPages];
+  struct {
+    size_t start;
+    size_t pages;
+  } runs[kRuns];
+  size_t run_count = 0;
+  size_t free_pages = kPages;
+
+  auto window_free = [](size_t start, size_t count) {
+    if (start + count > kPages)
+      return false;
+    for (size_t i = start; i < start + count; ++i) {
+      if (used[i])
+        return false;
+    }
+    return true;
+  };
+  auto mark = [&free_pages](size_t start, size_t count, bool value) {
+    for (size_t i = start; i < start + count; ++i)
+      used[i] = value;
+    free_pages = value ? free_pages - count : free_pages + count;
+  };
+  auto page_of = [](size_t index) {
+    return paging::Page::ContainingAddress(paging::kKernelVirtualRangeStart +
+                                           index * paging::kPageSize);
+  };
+
+  uint32_t state = 0x2545F491;
+  for (size_t op = 0; op < 20000; ++op) {
+    auto r = NextRandom(state);
+    if (run_count < kRuns && (run_count == 0 || r % 3 == 0)) {
+      size_t pages = 1 + (r >> 4) % 8;
+      size_t align = 1u << ((r >> 8) % 4);
+      auto first = ranges.Allocate(pages, align);
+      if (!first) {
+        // fails only if there is no aligned gap for the run and its guard
+        for (size_t i = 0; i + pages + 1 <= kPages; i += align)
+          CHECK(!window_free(i, pages + 1));
+        continue;
+      }
+      size_t start = first->index() - page_of(0).index();
+      CHECK(first->index() % align == 0);
+      CHECK(window_free(start, pages + 1));
+      mark(start, pages + 1, true);
+      runs[run_count++] = {start, pages};
+      CHECK(ranges.RunLength(*first) == pages);
+    } else if (r % 3 == 1) {
+      auto &run = runs[(r >> 4) % run_count];
+      size_t new_pages = 1 + (r >> 12) % 10;
+      bool fits = new_pages <= run.pages ||
+                  window_free(run.start + run.pages + 1, new_pages - run.pages);
+      CHECK(ranges.Resize(page_of(run.start), run.pages, new_pages) == fits);
+      if (!fits)
+        continue;
+      if (new_pages > run.pages)
+        mark(run.start + run.pages + 1, new_pages - run.pages, true);
+      else if (new_pages < run.pages)
+        mark(run.start + new_pages + 1, run.pages - new_pages, false);
+      run.pages = new_pages;
+      CHECK(ranges.RunLength(page_of(run.start)) == run.pages);
+    } else {
+      auto &run = runs[(r >> 4) % run_count];
+      ranges.Free(page_of(run.start), run.pages);
+      mark(run.start, run.pages + 1, false);
+      run = runs[--run_count];
+    }
+    CHECK(ranges.free_pages() == free_pages);
+  }
+}
+
+/**
+ * The physical memory behind the fake address space (64MiB).
+ */
+const size_t kPhysicalFrames = 0x4000;
+
+// these are too big for the stack
+host::HostPageMapper mapper;
+paging::VirtualRangeAllocator kernel_ranges(
+    paging::kKernelVirtualRangeStart, paging::kKernelVirtualRangePages);
+alignas(paging::AreaFrameAllocator)
+unsigned char frame_allocator_memory[sizeof(paging::AreaFrameAllocator)];
+alignas(alloc::KHeap) unsigned char heap_memory[sizeof(alloc::KHeap)];
+alignas(alloc::SizeClassAllocator) unsigned char
+    size_class_memory[sizeof(alloc::SizeClassAllocator)];
+
+alloc::KHeap *kernel_heap = nullptr;
+
+/**
+ * The same measure the kernel's benchmarks use: the heap, its large blocks,
+ * and the pages behind the slabs.
+ */
+size_t AllocatorFootprint() {
+  return kernel_heap->mapped_bytes() + kernel_heap->large_bytes() +
+         paging::PageAllocator::instance().used_pages() * paging::kPageSize;
+}
+
+/**
+ * Builds the heap, the page allocator and the size classes the way the
+ * kernel does at boot, runs their boot tests, benchmarks them and fuzzes the
+ * size classes against the heap.
+ */
+void TestAllocatorStack() {
+  if (!mapper.Initialize(kPhysicalFrames)) {
+    fprintf(stderr, "the kernel's address range is taken on this host\n");
+    ++failures;
+    return;
+  }
+
+  // the first megabyte stands in for the kernel image and multiboot data
+  auto &frames = *new (frame_allocator_memory)
+      paging::AreaFrameAllocator(0, 0xFFFFF, 0, 0xFFFFF);
+  frames.RegisterMemoryArea(0, kPhysicalFrames * paging::kPageSize);
+  auto free_frames = frames.free_frames();
+
+  kernel_heap = new (heap_memory) alloc::KHeap(
+      reinterpret_cast<void *>(0xC0400000),
+      reinterpret_cast<void *>(0xC0500000),
+      reinterpret_cast<void *>(0xC8000000),
+      reinterpret_cast<void *>(paging::kKernelVirtualRangeStart), true, false,
+      frames, mapper);
+  alloc::SetActiveAllocator(*kernel_heap);
+  alloc::test_kheap(*kernel_heap);
+
+  paging::PageAllocator::InitSingleton(kernel_ranges, frames, mapper);
+  paging::RegisterShrinker(alloc::SlabCache::shrinker());
+  alloc::test_slab();
+  auto size_classes = new (size_class_memory)
+      alloc::SizeClassAllocator(*kernel_heap);
+  alloc::SetActiveAllocator(*size_classes);
+  alloc::test_size_classes(*size_classes, *kernel_heap);
+  alloc::test_arena();
+
+  const alloc::BenchSubject subjects[] = {{"heap", kernel_heap},
+                                          {"size classes", size_classes}};
+  alloc::benchmark_allocators(subjects, 2, AllocatorFootprint);
+  CHECK(alloc::fuzz_allocators(subjects[0], subjects[1], 0x1234567, 4096) ==
+        0);
+
+  // every frame is either behind a mapped page or page table, or free
+  paging::ShrinkCaches(static_cast<size_t>(-1));
+  CHECK(paging::PageAllocator::instance().used_pages() == 0);
+  CHECK(frames.free_frames() + mapper.mapped_pages() + mapper.table_frames() ==
+        free_frames);
+}
+
+} // namespace
+
+int main() {
+  TestTlsfIndex();
+  TestEarlyAllocator();
+  TestVirtualRangeAllocator();
+  TestAllocatorStack();
+  printf("host allocator tests: %zu failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file host_mapper.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "host_mapper.h"
+
+#include <cstring>
+#include <sys/mman.h>
+
+#include "sys/kernel.h"
+
+namespace host {
+
+bool HostPageMapper::Initialize(size_t frames) {
+  memset(tables_, 0, sizeof(tables_));
+  memset(mapped_, 0, sizeof(mapped_));
+  mapped_pages_ = table_frames_ = 0;
+
+  // without MAP_FIXED the address is only a hint, taken if nothing is there
+  auto window = reinterpret_cast<void *>(kWindowStart);
+  auto got = mmap(window, kWindowEnd - kWindowStart, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (got != window) {
+    if (got != MAP_FAILED)
+      munmap(got, kWindowEnd - kWindowStart);
+    return false;
+  }
+
+  auto physical = mmap(nullptr, frames * paging::kPageSize,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (physical == MAP_FAILED)
+    return false;
+  physical_ = static_cast<uint8_t *>(physical);
+  frame_count_ = frames;
+  return true;
+}
+
+uint8_t *HostPageMapper::frame_memory(paging::Frame frame) const {
+  ASSERT(frame.index() < frame_count_);
+  return physical_ + frame.index() * paging::kPageSize;
+}
+
+bool HostPageMapper::Map(paging::Page page, paging::Frame frame,
+                         paging::Entry::Flags flags,
+                         paging::IFrameAllocator &frames) {
+  auto address = static_cast<uint32_t>(page.start_address());
+  ASSERT(address >= kWindowStart && address < kWindowEnd);
+  auto index = (address - kWindowStart) / paging::kPageSize;
+  ASSERT(mapped_[index] == 0);
+
+  if (!tables_[page.directory_index()]) {
+    auto table = frames.Allocate();
+    if (!table)
+      return false;
+    tables_[page.directory_index()] = true;
+    ++table_frames_;
+  }
+
+  auto memory = reinterpret_cast<void *>(address);
+  auto writable = (static_cast<uint32_t>(flags) &
+                   static_cast<uint32_t>(paging::Entry::Flags::Writable)) != 0;
+  mprotect(memory, paging::kPageSize, PROT_READ | PROT_WRITE);
+  memcpy(memory, frame_memory(frame), paging::kPageSize);
+  if (!writable)
+    mprotect(memory, paging::kPageSize, PROT_READ);
+  mapped_[index] = frame.index() + 1;
+  ++mapped_pages_;
+  return true;
+}
+
+paging::Frame HostPageMapper::Unmap(paging::Page page,
+                                    paging::IFrameAllocator &) {
+  auto address = static_cast<uint32_t>(page.start_address());
+  ASSERT(address >= kWindowStart && address < kWindowEnd);
+  auto index = (address - kWindowStart) / paging::kPageSize;
+  ASSERT(mapped_[index] != 0);
+
+  paging::Frame frame(mapped_[index] - 1);
+  auto memory = reinterpret_cast<void *>(address);
+  memcpy(frame_memory(frame), memory, paging::kPageSize);
+  mprotect(memory, paging::kPageSize, PROT_NONE);
+  mapped_[index] = 0;
+  --mapped_pages_;
+  return frame;
+}
+
+} // namespace host
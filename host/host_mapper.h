@@ -0,0 +1,107 @@
+/**
+ * @file host_mapper.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * A fake address space for running the kernel's allocators on the build
+ * machine.
+ */
+
+#ifndef HOST_HOST_MAPPER_H_
+#define HOST_HOST_MAPPER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/page_mapper.h"
+
+namespace host {
+
+/**
+ * Maps pages of the kernel's own virtual layout inside the host process.
+ *
+ * The window from the heap to the end of the on demand range is reserved at
+ * the same addresses as in the kernel, inaccessible until a page is mapped,
+ * and a host buffer stands in for physical memory. Mapping a page copies its
+ * frame into it and unmapping copies it back out, so contents follow their
+ * frames the way they do on real page tables, and touching a page that
+ * isn't mapped faults.
+ */
+class HostPageMapper : public paging::IPageMapper {
+public:
+  /**
+   * The start of the window, where the kernel heap starts.
+   */
+  static const uint32_t kWindowStart = 0xC0400000;
+
+  /**
+   * The end of the window, where the on demand range ends.
+   */
+  static const uint32_t kWindowEnd = 0xE0000000;
+
+  /**
+   * Reserves the window and the physical memory.
+   * @param frames The number of frames of physical memory.
+   * @return False if the host has something at the window's addresses.
+   */
+  bool Initialize(size_t frames);
+
+  virtual bool Map(paging::Page page, paging::Frame frame,
+                   paging::Entry::Flags flags,
+                   paging::IFrameAllocator &frames);
+  virtual paging::Frame Unmap(paging::Page page,
+                              paging::IFrameAllocator &frames);
+
+  /**
+   * Gets the number of pages currently mapped.
+   */
+  inline size_t mapped_pages() const { return mapped_pages_; }
+
+  /**
+   * Gets the number of frames taken for page tables.
+   */
+  inline size_t table_frames() const { return table_frames_; }
+
+private:
+  static const size_t kWindowPages =
+      (kWindowEnd - kWindowStart) / paging::kPageSize;
+
+  uint8_t *frame_memory(paging::Frame frame) const;
+
+  uint8_t *physical_;
+  size_t frame_count_;
+  size_t mapped_pages_;
+  size_t table_frames_;
+
+  /**
+   * Whether each directory slot has a page table, which takes a frame the
+   * first time, as on the real page directory.
+   */
+  bool tables_[1024];
+
+  /**
+   * The frame mapped at each page of the window, plus one, or zero.
+   */
+  uint32_t mapped_[kWindowPages];
+};
+
+} // namespace host
+
+#endif // HOST_HOST_MAPPER_H_
@@ -0,0 +1,79 @@
+/**
+ * @file io.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Stands in for the kernel's sys/io.h in the host build, which comes first
+ * on the include path. cli and sti fault outside ring 0, so the interrupt
+ * flag is a variable here; the rest is what the allocators use, unchanged.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_IO_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_IO_H_
+
+#include <cstdint>
+
+/**
+ * The interrupt flag the host build pretends to have, in the same bit as
+ * eflags. Defined in kernel_stubs.cc.
+ */
+extern uint32_t host_interrupt_flag;
+
+inline void enable_interrupts() { host_interrupt_flag = 0x200; }
+
+inline void disable_interrupts() { host_interrupt_flag = 0; }
+
+inline bool interrupts_enabled() { return host_interrupt_flag != 0; }
+
+inline uint32_t save_and_disable_interrupts() {
+  auto flags = host_interrupt_flag;
+  host_interrupt_flag = 0;
+  return flags;
+}
+
+inline void restore_interrupts(uint32_t flags) {
+  if (flags & 0x200)
+    host_interrupt_flag = 0x200;
+}
+
+inline uint64_t read_tsc() {
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+inline uint64_t divide64(uint64_t dividend, uint32_t divisor) {
+  uint32_t high, low, remainder;
+  asm("divl %4"
+      : "=a"(high), "=d"(remainder)
+      : "a"(static_cast<uint32_t>(dividend >> 32)), "d"(0), "rm"(divisor));
+  asm("divl %4"
+      : "=a"(low), "=d"(remainder)
+      : "a"(static_cast<uint32_t>(dividend)), "d"(remainder), "rm"(divisor));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+inline void cpuid(uint32_t leaf, uint32_t regs[4]) {
+  asm volatile("cpuid"
+               : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+               : "a"(leaf), "c"(0));
+}
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_IO_H_
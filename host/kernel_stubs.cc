@@ -0,0 +1,71 @@
+/**
+ * @file kernel_stubs.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * The few kernel symbols the host build links against, standing in for the
+ * parts of the kernel that need the real hardware.
+ */
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include "mm/paging.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+uint32_t host_interrupt_flag = 0x200;
+
+void panic(const char *message, const char *file, int line) {
+  fprintf(stderr, "%s:%d: panic: %s\n", file, line, message);
+  abort();
+}
+
+void panic_assert(const char *file, int line, const char *desc) {
+  fprintf(stderr, "%s:%d: assertion failed: %s\n", file, line, desc);
+  abort();
+}
+
+namespace paging {
+
+// the rest of paging.cc walks the live page tables
+Page Page::ContainingAddress(vaddress address) {
+  Page pg;
+  pg.index_ = static_cast<size_t>(address) / kPageSize;
+  return pg;
+}
+
+} // namespace paging
+
+namespace screen {
+
+// the allocators' reports use the same formats printf does
+void WriteLine(const char *str) { printf("%s\n", str); }
+
+void Writef(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+}
+
+} // namespace screen
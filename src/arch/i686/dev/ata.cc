@@ -0,0 +1,195 @@
+/**
+ * @file ata.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "dev/ata.h"
+
+#include "sys/io.h"
+
+namespace ata {
+
+namespace {
+
+// offsets of the task file registers from the bus' I/O base
+const uint16_t kRegData = 0;
+const uint16_t kRegSectorCount = 2;
+const uint16_t kRegLbaLow = 3;
+const uint16_t kRegLbaMid = 4;
+const uint16_t kRegLbaHigh = 5;
+const uint16_t kRegDriveSelect = 6;
+const uint16_t kRegCommand = 7;
+const uint16_t kRegStatus = 7;
+
+// status register bits
+const uint8_t kStatusError = 0x01;
+const uint8_t kStatusDataRequest = 0x08;
+const uint8_t kStatusDriveFault = 0x20;
+const uint8_t kStatusBusy = 0x80;
+
+// commands
+const uint8_t kCmdReadSectors = 0x20;
+const uint8_t kCmdWriteSectors = 0x30;
+const uint8_t kCmdCacheFlush = 0xE7;
+const uint8_t kCmdIdentify = 0xEC;
+
+/**
+ * The number of 16-bit words in a sector.
+ */
+const uint32_t kWordsPerSector = dev::kSectorSize / 2;
+
+/**
+ * How many times to poll the status register before giving up on the drive.
+ */
+const uint32_t kPollLimit = 0x100000;
+
+} // namespace
+
+Drive::Drive(Bus bus, Position position)
+    : io_base_(static_cast<uint16_t>(bus)),
+      control_port_(bus == Bus::kPrimary ? 0x3F6 : 0x376),
+      position_(position), sector_count_(0) {}
+
+bool Drive::Identify() {
+  outb(io_base_ + kRegDriveSelect,
+       0xA0 | (static_cast<uint8_t>(position_) << 4));
+  Delay();
+  outb(io_base_ + kRegSectorCount, 0);
+  outb(io_base_ + kRegLbaLow, 0);
+  outb(io_base_ + kRegLbaMid, 0);
+  outb(io_base_ + kRegLbaHigh, 0);
+  outb(io_base_ + kRegCommand, kCmdIdentify);
+  Delay();
+
+  // a status of zero means there is nothing attached
+  if (inb(io_base_ + kRegStatus) == 0)
+    return false;
+  if (!WaitNotBusy())
+    return false;
+
+  // packet (ATAPI) devices put a signature in the LBA registers, we can't use
+  // those for block storage
+  if (inb(io_base_ + kRegLbaMid) != 0 || inb(io_base_ + kRegLbaHigh) != 0)
+    return false;
+  if (!WaitDataRequest())
+    return false;
+
+  uint16_t identity[kWordsPerSector];
+  insw(io_base_ + kRegData, identity, kWordsPerSector);
+
+  // words 60 and 61 hold the number of LBA28 addressable sectors
+  sector_count_ = identity[60] | (static_cast<uint32_t>(identity[61]) << 16);
+  return sector_count_ != 0;
+}
+
+bool Drive::Read(uint32_t lba, uint32_t count, void *buffer) {
+  auto data = static_cast<uint16_t *>(buffer);
+  while (count > 0) {
+    uint32_t chunk = count > 256 ? 256 : count;
+    if (!WaitNotBusy())
+      return false;
+    Select(lba, static_cast<uint8_t>(chunk));
+    outb(io_base_ + kRegCommand, kCmdReadSectors);
+
+    for (uint32_t i = 0; i < chunk; ++i) {
+      Delay();
+      if (!WaitDataRequest())
+        return false;
+      insw(io_base_ + kRegData, data, kWordsPerSector);
+      data += kWordsPerSector;
+    }
+
+    lba += chunk;
+    count -= chunk;
+  }
+  return true;
+}
+
+bool Drive::Write(uint32_t lba, uint32_t count, const void *buffer) {
+  auto data = static_cast<const uint16_t *>(buffer);
+  while (count > 0) {
+    uint32_t chunk = count > 256 ? 256 : count;
+    if (!WaitNotBusy())
+      return false;
+    Select(lba, static_cast<uint8_t>(chunk));
+    outb(io_base_ + kRegCommand, kCmdWriteSectors);
+
+    for (uint32_t i = 0; i < chunk; ++i) {
+      Delay();
+      if (!WaitDataRequest())
+        return false;
+      outsw(io_base_ + kRegData, data, kWordsPerSector);
+      data += kWordsPerSector;
+    }
+
+    lba += chunk;
+    count -= chunk;
+  }
+
+  // make sure the data has left the drive's write cache before we report
+  // success, the caller is about to throw its copy away
+  outb(io_base_ + kRegCommand, kCmdCacheFlush);
+  Delay();
+  return WaitNotBusy();
+}
+
+void Drive::Select(uint32_t lba, uint8_t count) {
+  outb(io_base_ + kRegDriveSelect, 0xE0 |
+                                       (static_cast<uint8_t>(position_) << 4) |
+                                       ((lba >> 24) & 0x0F));
+  Delay();
+  outb(io_base_ + kRegSectorCount, count);
+  outb(io_base_ + kRegLbaLow, lba & 0xFF);
+  outb(io_base_ + kRegLbaMid, (lba >> 8) & 0xFF);
+  outb(io_base_ + kRegLbaHigh, (lba >> 16) & 0xFF);
+}
+
+bool Drive::WaitNotBusy() {
+  for (uint32_t i = 0; i < kPollLimit; ++i) {
+    uint8_t status = inb(io_base_ + kRegStatus);
+    if (status & kStatusBusy)
+      continue;
+    return !(status & (kStatusError | kStatusDriveFault));
+  }
+  return false;
+}
+
+bool Drive::WaitDataRequest() {
+  for (uint32_t i = 0; i < kPollLimit; ++i) {
+    uint8_t status = inb(io_base_ + kRegStatus);
+    if (status & kStatusBusy)
+      continue;
+    if (status & (kStatusError | kStatusDriveFault))
+      return false;
+    if (status & kStatusDataRequest)
+      return true;
+  }
+  return false;
+}
+
+void Drive::Delay() {
+  // each read of the alternate status register takes ~100ns
+  for (int i = 0; i < 4; ++i)
+    inb(control_port_);
+}
+
+} // namespace ata
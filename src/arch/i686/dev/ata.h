@@ -0,0 +1,118 @@
+/**
+ * @file ata.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Polling (PIO) driver for disks attached to the legacy IDE controller.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_DEV_ATA_H_
+#define SRC_ARCH_I586_INCLUDE_DEV_ATA_H_
+
+#include <cstdint>
+
+#include "dev/block_device.h"
+
+namespace ata {
+
+/**
+ * The I/O base ports of the two legacy IDE buses.
+ */
+enum class Bus : uint16_t { kPrimary = 0x1F0, kSecondary = 0x170 };
+
+/**
+ * Selects one of the two drives attached to an IDE bus.
+ */
+enum class Position : uint8_t { kMaster = 0, kSlave = 1 };
+
+/**
+ * A single ATA disk accessed with 28-bit LBA PIO transfers. Every operation
+ * polls the status register, so the driver works with interrupts disabled
+ * (e.g. from inside the page fault handler).
+ */
+class Drive : public dev::BlockDevice {
+public:
+  /**
+   * Creates a new Drive instance. The drive is not usable until Identify has
+   * succeeded.
+   * @param bus The bus the drive is attached to.
+   * @param position Whether the drive is the master or slave on the bus.
+   */
+  Drive(Bus bus, Position position);
+
+  /**
+   * Probes the drive with the IDENTIFY command.
+   * @return True if a non-packet ATA disk is present.
+   */
+  bool Identify();
+
+  virtual uint32_t sector_count() const { return sector_count_; }
+  virtual bool Read(uint32_t lba, uint32_t count, void *buffer);
+  virtual bool Write(uint32_t lba, uint32_t count, const void *buffer);
+
+private:
+  /**
+   * Selects the drive and programs the address registers for a transfer.
+   * @param lba The first sector of the transfer.
+   * @param count The number of sectors, where 0 means 256.
+   */
+  void Select(uint32_t lba, uint8_t count);
+
+  /**
+   * Busy waits until the drive clears BSY.
+   * @return False if the drive reported an error or never became ready.
+   */
+  bool WaitNotBusy();
+
+  /**
+   * Busy waits until the drive is ready to transfer a sector of data.
+   * @return False if the drive reported an error or never became ready.
+   */
+  bool WaitDataRequest();
+
+  /**
+   * Waits the ~400ns the drive needs before its status register is valid.
+   */
+  void Delay();
+
+  /**
+   * The base of the task file registers for this drive's bus.
+   */
+  uint16_t io_base_;
+
+  /**
+   * The device control / alternate status register for this drive's bus.
+   */
+  uint16_t control_port_;
+
+  /**
+   * Whether this is the master or slave drive.
+   */
+  Position position_;
+
+  /**
+   * The number of LBA28 addressable sectors reported by IDENTIFY.
+   */
+  uint32_t sector_count_;
+};
+
+} // namespace ata
+
+#endif // SRC_ARCH_I586_INCLUDE_DEV_ATA_H_
@@ -0,0 +1,158 @@
+/**
+ * @file serial.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "dev/serial.h"
+
+#include "sys/io.h"
+#include "sys/kernel.h"
+
+namespace serial {
+
+namespace {
+
+// offsets of the UART registers from the port's I/O base
+const uint16_t kRegData = 0;
+const uint16_t kRegInterruptEnable = 1;
+const uint16_t kRegFifoControl = 2;
+const uint16_t kRegLineControl = 3;
+const uint16_t kRegModemControl = 4;
+const uint16_t kRegLineStatus = 5;
+
+// with the divisor latch set, the first two registers hold the divisor
+const uint16_t kRegDivisorLow = 0;
+const uint16_t kRegDivisorHigh = 1;
+
+const uint8_t kLineDivisorLatch = 0x80;
+const uint8_t kLine8N1 = 0x03;
+const uint8_t kFifoEnableAndClear = 0xC7;
+const uint8_t kModemLoopback = 0x1E;
+const uint8_t kModemNormal = 0x0F;
+const uint8_t kLineStatusTransmitEmpty = 0x20;
+
+const uint32_t kBaseBaud = 115200;
+
+/**
+ * How many times to poll for an empty transmitter before dropping a byte.
+ */
+const uint32_t kPollLimit = 0x10000;
+
+} // namespace
+
+Port::Port(Com com) : base_(static_cast<uint16_t>(com)), present_(false) {}
+
+bool Port::Initialize(uint32_t baud) {
+  ASSERT(baud > 0 && kBaseBaud % baud == 0);
+  auto divisor = kBaseBaud / baud;
+
+  outb(base_ + kRegInterruptEnable, 0);
+  outb(base_ + kRegLineControl, kLineDivisorLatch);
+  outb(base_ + kRegDivisorLow, divisor & 0xFF);
+  outb(base_ + kRegDivisorHigh, (divisor >> 8) & 0xFF);
+  outb(base_ + kRegLineControl, kLine8N1);
+  outb(base_ + kRegFifoControl, kFifoEnableAndClear);
+
+  // send a byte to ourselves to see if anything is there
+  outb(base_ + kRegModemControl, kModemLoopback);
+  outb(base_ + kRegData, 0xAE);
+  present_ = inb(base_ + kRegData) == 0xAE;
+
+  outb(base_ + kRegModemControl, kModemNormal);
+  return present_;
+}
+
+void Port::Write(char c) {
+  if (!present_)
+    return;
+  if (c == '\n')
+    Write('\r');
+
+  for (uint32_t i = 0; i < kPollLimit; ++i) {
+    if (inb(base_ + kRegLineStatus) & kLineStatusTransmitEmpty) {
+      outb(base_ + kRegData, c);
+      return;
+    }
+  }
+}
+
+void Port::Write(const char *s) {
+  while (*s)
+    Write(*s++);
+}
+
+void Port::WriteDec(uint32_t n) {
+  char digits[10];
+  int count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (count)
+    Write(digits[--count]);
+}
+
+void Port::WriteHex(uint32_t n) {
+  for (int shift = 28; shift >= 0; shift -= 4)
+    Write("0123456789ABCDEF"[(n >> shift) & 0xF]);
+}
+
+void Port::Writef(const char *fmt, ...) {
+  if (fmt == 0)
+    PANIC("null fmt");
+
+  auto argp = reinterpret_cast<uint32_t *>(&fmt + 1);
+  for (const char *c = fmt; *c != 0; c++) {
+    if (*c != '%') {
+      Write(*c);
+      continue;
+    }
+    if (*(++c) == 0)
+      break;
+    switch (*c) {
+    case 'd':
+      WriteDec(*argp++);
+      break;
+    case 'x':
+    case 'p':
+      WriteHex(*argp++);
+      break;
+    case 's': {
+      auto s = reinterpret_cast<const char *>(*argp++);
+      Write(s ? s : "(null)");
+      break;
+    }
+    case '%':
+      Write('%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      Write('%');
+      Write(*c);
+      break;
+    }
+  }
+}
+
+} // namespace serial
@@ -0,0 +1,85 @@
+/**
+ * @file serial.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * A polled driver for the 16550 UART serial ports.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_DEV_SERIAL_H_
+#define SRC_ARCH_I586_INCLUDE_DEV_SERIAL_H_
+
+#include <cstdint>
+
+namespace serial {
+
+/**
+ * The I/O base ports of the standard PC serial ports.
+ */
+enum class Com : uint16_t { kCom1 = 0x3F8, kCom2 = 0x2F8 };
+
+/**
+ * A serial port used for debug output. Writes busy wait for the transmitter,
+ * so they work with interrupts disabled, and are dropped if the port isn't
+ * there.
+ */
+class Port {
+public:
+  /**
+   * Creates a new Port instance. Nothing is written until Initialize has
+   * succeeded.
+   * @param com The port to drive.
+   */
+  explicit Port(Com com);
+
+  /**
+   * Programs the port for 8N1 at the given speed and checks it is present with
+   * a loopback test.
+   * @param baud The line speed, which must divide 115200.
+   * @return True if the port works.
+   */
+  bool Initialize(uint32_t baud = 115200);
+
+  inline bool is_present() const { return present_; }
+
+  /**
+   * Sends one character, turning \n into \r\n.
+   */
+  void Write(char c);
+  void Write(const char *s);
+
+  void WriteDec(uint32_t n);
+  void WriteHex(uint32_t n);
+
+  /**
+   * Writes formatted text, supporting the same conversions as screen::Writef.
+   */
+  void Writef(const char *fmt, ...);
+
+private:
+  uint16_t base_;
+  bool present_;
+};
+
+} // namespace serial
+
+#endif // SRC_ARCH_I586_INCLUDE_DEV_SERIAL_H_
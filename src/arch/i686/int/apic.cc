@@ -0,0 +1,386 @@
+/**
+ * @file apic.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "int/apic.h"
+
+#include "int/isr.h"
+#include "mm/mmio.h"
+#include "sys/cpu.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "sys/spinlock.h"
+#include "video/text_screen.h"
+
+namespace apic {
+
+namespace {
+
+/**
+ * The MSR holding the local APIC's base address and global enable bit.
+ */
+const uint32_t kApicBaseMsr = 0x1B;
+const uint64_t kApicGlobalEnable = 1 << 11;
+
+/**
+ * Local APIC register offsets.
+ */
+const size_t kLocalId = 0x20;
+const size_t kTaskPriority = 0x80;
+const size_t kEndOfInterrupt = 0xB0;
+const size_t kSpuriousInterrupt = 0xF0;
+const size_t kInterruptCommandLow = 0x300;
+const size_t kInterruptCommandHigh = 0x310;
+const size_t kLvtTimer = 0x320;
+const size_t kTimerInitialCount = 0x380;
+const size_t kTimerCurrentCount = 0x390;
+const size_t kTimerDivide = 0x3E0;
+
+/**
+ * The timer divide configuration for dividing the bus clock by 16.
+ */
+const uint32_t kTimerDivideBy16 = 0x3;
+
+/**
+ * The software enable bit of the spurious interrupt register.
+ */
+const uint32_t kSoftwareEnable = 1 << 8;
+
+/**
+ * Interrupt command bits: still being delivered, and send to self.
+ */
+const uint32_t kDeliveryPending = 1 << 12;
+const uint32_t kToSelf = 1 << 18;
+
+/**
+ * I/O APIC registers: the select and window registers, and the indirect
+ * registers reached through them.
+ */
+const size_t kRegisterSelect = 0x00;
+const size_t kRegisterWindow = 0x10;
+const uint32_t kIoApicVersion = 0x01;
+const uint32_t kRedirectionTable = 0x10;
+
+/**
+ * Redirection entry bits.
+ */
+const uint32_t kActiveLow = 1 << 13;
+const uint32_t kLevelTriggered = 1 << 15;
+const uint32_t kMasked = 1 << 16;
+
+/**
+ * MPS INTI flag values meaning active low and level triggered.
+ */
+const uint16_t kPolarityMask = 0x3;
+const uint16_t kPolarityLow = 0x3;
+const uint16_t kTriggerMask = 0xC;
+const uint16_t kTriggerLevel = 0xC;
+
+/**
+ * The number of ISA IRQs.
+ */
+const uint8_t kIsaIrqs = 16;
+
+struct IoApic {
+  volatile void *registers;
+  uint32_t gsi_base;
+  uint32_t gsi_count;
+};
+
+volatile void *g_local_apic = nullptr;
+IoApic g_io_apics[acpi::kMaxIoApics];
+size_t g_io_apic_count = 0;
+acpi::IrqOverride g_overrides[acpi::kMaxIrqOverrides];
+size_t g_override_count = 0;
+
+/**
+ * The local APIC id of each processor, by cpu::current_id().
+ */
+uint8_t g_apic_ids[cpu::kMaxCpus];
+
+/**
+ * Guards the select/window pairs of the I/O APICs.
+ */
+Spinlock g_io_apic_lock;
+
+uint32_t ReadIoApic(const IoApic &io, uint32_t reg) {
+  paging::mmio_write(io.registers, kRegisterSelect, reg);
+  return paging::mmio_read(io.registers, kRegisterWindow);
+}
+
+void WriteIoApic(const IoApic &io, uint32_t reg, uint32_t value) {
+  paging::mmio_write(io.registers, kRegisterSelect, reg);
+  paging::mmio_write(io.registers, kRegisterWindow, value);
+}
+
+/**
+ * Finds the global system interrupt an ISA IRQ is wired to.
+ * @param flags Receives the override's polarity and trigger flags, or 0.
+ */
+uint32_t IrqToGsi(uint8_t irq, uint16_t &flags) {
+  for (size_t i = 0; i < g_override_count; ++i) {
+    if (g_overrides[i].irq == irq) {
+      flags = g_overrides[i].flags;
+      return g_overrides[i].gsi;
+    }
+  }
+  flags = 0;
+  return irq;
+}
+
+/**
+ * Gets whether an ISA IRQ's identity mapped GSI was taken over by another
+ * IRQ, like the timer on IRQ 0 usually takes GSI 2.
+ */
+bool IsGsiTaken(uint8_t irq) {
+  for (size_t i = 0; i < g_override_count; ++i) {
+    if (g_overrides[i].gsi == irq && g_overrides[i].irq != irq)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Finds the I/O APIC handling a global system interrupt.
+ */
+IoApic *FindIoApic(uint32_t gsi) {
+  for (size_t i = 0; i < g_io_apic_count; ++i) {
+    auto &io = g_io_apics[i];
+    if (gsi >= io.gsi_base && gsi < io.gsi_base + io.gsi_count)
+      return &io;
+  }
+  return nullptr;
+}
+
+/**
+ * Masks every input of both PICs, after they were remapped out of the way
+ * of the exceptions, so the spurious IRQs they may still raise can't be
+ * mistaken for one.
+ */
+void DisablePics() {
+  outb(0xA1, 0xFF);
+  outb(0x21, 0xFF);
+}
+
+bool HasLocalApic() {
+  uint32_t regs[4];
+  cpuid(1, regs);
+  return (regs[3] & (1 << 9)) != 0;
+}
+
+void EnableLocalApic() {
+  write_msr(kApicBaseMsr, read_msr(kApicBaseMsr) | kApicGlobalEnable);
+  paging::mmio_write(g_local_apic, kTaskPriority, 0);
+  paging::mmio_write(g_local_apic, kSpuriousInterrupt,
+                     kSoftwareEnable | kSpuriousVector);
+}
+
+} // namespace
+
+bool Initialize(const acpi::Madt &madt, paging::VirtualRangeAllocator &ranges,
+                paging::IFrameAllocator &allocator) {
+  if (!HasLocalApic() || madt.io_apic_count == 0)
+    return false;
+
+  auto local = paging::MapPhysical(madt.local_apic_address, paging::kPageSize,
+                                   ranges, allocator);
+  if (!local)
+    return false;
+
+  for (size_t i = 0; i < madt.io_apic_count; ++i) {
+    auto &info = madt.io_apics[i];
+    auto registers = paging::MapPhysical(info.address, paging::kPageSize,
+                                         ranges, allocator);
+    if (!registers)
+      continue;
+    auto &io = g_io_apics[g_io_apic_count++];
+    io.registers = registers;
+    io.gsi_base = info.gsi_base;
+    io.gsi_count = ((ReadIoApic(io, kIoApicVersion) >> 16) & 0xFF) + 1;
+
+    // nothing is delivered until it is routed
+    for (uint32_t n = 0; n < io.gsi_count; ++n)
+      WriteIoApic(io, kRedirectionTable + 2 * n, kMasked);
+  }
+  for (size_t i = 0; i < madt.override_count; ++i)
+    g_overrides[g_override_count++] = madt.overrides[i];
+
+  if (madt.has_pics)
+    DisablePics();
+
+  g_local_apic = local;
+  EnableLocalApic();
+  g_apic_ids[cpu::current_id()] = local_id();
+
+  // IRQ 2 is the PIC cascade, which never fires
+  for (uint8_t irq = 0; irq < kIsaIrqs; ++irq) {
+    if (irq != 2 && !IsGsiTaken(irq))
+      RouteIrq(irq, static_cast<uint8_t>(isr::Interrupts::kIRQ0) + irq, 0);
+  }
+  return true;
+}
+
+void InitializeSecondary() {
+  if (!is_enabled())
+    return;
+  EnableLocalApic();
+  g_apic_ids[cpu::current_id()] = local_id();
+}
+
+bool is_enabled() { return g_local_apic != nullptr; }
+
+void EndOfInterrupt() { paging::mmio_write(g_local_apic, kEndOfInterrupt, 0); }
+
+uint8_t local_id() {
+  return static_cast<uint8_t>(paging::mmio_read(g_local_apic, kLocalId) >>
+                              24);
+}
+
+bool RouteIrq(uint8_t irq, uint8_t vector, size_t cpu) {
+  ASSERT(cpu < cpu::online_count());
+  uint16_t flags;
+  auto gsi = IrqToGsi(irq, flags);
+  auto io = FindIoApic(gsi);
+  if (!io)
+    return false;
+
+  // ISA interrupts are edge triggered and active high unless the MADT says
+  // otherwise
+  uint32_t low = vector;
+  if ((flags & kPolarityMask) == kPolarityLow)
+    low |= kActiveLow;
+  if ((flags & kTriggerMask) == kTriggerLevel)
+    low |= kLevelTriggered;
+  uint32_t high = static_cast<uint32_t>(g_apic_ids[cpu]) << 24;
+
+  SpinlockGuard guard(g_io_apic_lock);
+  auto reg = kRedirectionTable + 2 * (gsi - io->gsi_base);
+  WriteIoApic(*io, reg, kMasked);
+  WriteIoApic(*io, reg + 1, high);
+  WriteIoApic(*io, reg, low);
+  return true;
+}
+
+void MaskIrq(uint8_t irq) {
+  uint16_t flags;
+  auto gsi = IrqToGsi(irq, flags);
+  auto io = FindIoApic(gsi);
+  if (!io)
+    return;
+
+  SpinlockGuard guard(g_io_apic_lock);
+  auto reg = kRedirectionTable + 2 * (gsi - io->gsi_base);
+  WriteIoApic(*io, reg, ReadIoApic(*io, reg) | kMasked);
+}
+
+void SetTimerMode(TimerMode mode) {
+  paging::mmio_write(g_local_apic, kTimerInitialCount, 0);
+  paging::mmio_write(g_local_apic, kTimerDivide, kTimerDivideBy16);
+  paging::mmio_write(g_local_apic, kLvtTimer,
+                     static_cast<uint32_t>(mode) | kTimerVector);
+  // the switch to deadline mode has to land before the first write of the
+  // deadline MSR, which isn't ordered against MMIO
+  if (mode == TimerMode::kTscDeadline)
+    asm volatile("mfence" : : : "memory");
+}
+
+void SetTimerCount(uint32_t count) {
+  paging::mmio_write(g_local_apic, kTimerInitialCount, count);
+}
+
+uint32_t timer_count() {
+  return paging::mmio_read(g_local_apic, kTimerCurrentCount);
+}
+
+void SendSelfInterrupt(uint8_t vector) {
+  paging::mmio_write(g_local_apic, kInterruptCommandHigh, 0);
+  paging::mmio_write(g_local_apic, kInterruptCommandLow, kToSelf | vector);
+  while (paging::mmio_read(g_local_apic, kInterruptCommandLow) &
+         kDeliveryPending)
+    continue;
+}
+
+namespace {
+
+/**
+ * Counts the interrupts sent to it and acknowledges them.
+ */
+class SelfTestHandler : public isr::InterruptHandler {
+public:
+  SelfTestHandler()
+      : InterruptHandler(isr::Interrupts::kIRQ15), count_(0) {}
+
+  inline size_t count() const { return count_; }
+
+private:
+  virtual isr::HandlerResult Handle(isr::Registers *regs) {
+    ++count_;
+    EndOfInterrupt(regs);
+    return isr::HandlerResult::kHandled;
+  }
+
+  volatile size_t count_;
+};
+
+} // namespace
+
+void test_apic() {
+  const uint32_t kCount = 100;
+
+  // borrow IRQ 15's vector, with the IRQ itself masked so it can't get in
+  // the way
+  SelfTestHandler handler;
+  MaskIrq(15);
+  handler.RegisterHandler();
+
+  auto flags = save_and_disable_interrupts();
+  auto start = read_tsc();
+  for (uint32_t i = 0; i < kCount; ++i) {
+    SendSelfInterrupt(static_cast<uint8_t>(isr::Interrupts::kIRQ15));
+    // the interrupt is taken straight after the instruction following sti
+    asm volatile("sti; nop; cli" : : : "memory");
+  }
+  auto round_trip = static_cast<uint32_t>(read_tsc() - start) / kCount;
+
+  // neither controller has anything in service, so these are no-ops
+  start = read_tsc();
+  for (uint32_t i = 0; i < kCount; ++i)
+    EndOfInterrupt();
+  auto apic_eoi = static_cast<uint32_t>(read_tsc() - start) / kCount;
+  start = read_tsc();
+  for (uint32_t i = 0; i < kCount; ++i)
+    outb(0x20, 0x20);
+  auto pic_eoi = static_cast<uint32_t>(read_tsc() - start) / kCount;
+  restore_interrupts(flags);
+
+  handler.UnregisterHandler();
+  RouteIrq(15, static_cast<uint8_t>(isr::Interrupts::kIRQ15), 0);
+
+  screen::Writef("apic test: %d of %d self interrupts, %d cycles each\n",
+                 handler.count(), kCount, round_trip);
+  screen::Writef("  eoi: %d cycles, pic eoi %d cycles\n", apic_eoi, pic_eoi);
+}
+
+} // namespace apic
@@ -0,0 +1,150 @@
+/**
+ * @file apic.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * The local APIC of each processor and the I/O APICs that route device
+ * interrupts to them, which replace the 8259 PICs when the MADT lists them.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_INT_APIC_H_
+#define SRC_ARCH_I586_INCLUDE_INT_APIC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+#include "mm/virtual_range.h"
+#include "sys/acpi.h"
+
+namespace apic {
+
+/**
+ * The vector a local APIC raises when an interrupt goes away before it can
+ * be delivered. It doesn't need an EOI, and the dispatcher only counts it.
+ */
+const uint8_t kSpuriousVector = 0xFF;
+
+/**
+ * The vector the local APIC timer raises.
+ */
+const uint8_t kTimerVector = 0xEF;
+
+/**
+ * How the local APIC timer counts.
+ */
+enum class TimerMode : uint32_t {
+  /**
+   * Counts down once from the initial count, at the bus clock divided by 16.
+   */
+  kOneShot = 0,
+
+  /**
+   * Fires when the TSC reaches the value in the TSC deadline MSR.
+   */
+  kTscDeadline = 2 << 17
+};
+
+/**
+ * Maps the local and I/O APICs the MADT lists, masks the PICs and enables
+ * the boot processor's local APIC. The ISA IRQs keep the vectors the PICs
+ * gave them and are routed to the boot processor.
+ * @param madt The interrupt controllers, from acpi::ReadMadt.
+ * @param ranges Where to map the registers.
+ * @param allocator Provides frames for page tables.
+ * @return False if the processor has no APIC, in which case the PICs are
+ * left as they were.
+ */
+bool Initialize(const acpi::Madt &madt, paging::VirtualRangeAllocator &ranges,
+                paging::IFrameAllocator &allocator);
+
+/**
+ * Enables the local APIC of a secondary processor. Must run on that
+ * processor after cpu::InitializeSecondary.
+ */
+void InitializeSecondary();
+
+/**
+ * Gets whether interrupts are being delivered through the APICs.
+ */
+bool is_enabled();
+
+/**
+ * Signals the end of an interrupt to the running processor's local APIC.
+ */
+void EndOfInterrupt();
+
+/**
+ * Gets the local APIC id of the processor this runs on.
+ */
+uint8_t local_id();
+
+/**
+ * Delivers an ISA IRQ to one processor. Any interrupt source override from
+ * the MADT is taken into account.
+ * @param irq The ISA IRQ number.
+ * @param vector The vector to raise.
+ * @param cpu The id of the processor to deliver it to, which must be
+ * online.
+ * @return False if no I/O APIC handles the IRQ.
+ */
+bool RouteIrq(uint8_t irq, uint8_t vector, size_t cpu);
+
+/**
+ * Stops delivering an ISA IRQ.
+ * @param irq The ISA IRQ number.
+ */
+void MaskIrq(uint8_t irq);
+
+/**
+ * Points the running processor's local APIC timer at kTimerVector and stops
+ * it.
+ * @param mode How the timer is armed from now on.
+ */
+void SetTimerMode(TimerMode mode);
+
+/**
+ * Starts the running processor's one-shot timer counting down.
+ * @param count The number of ticks until it fires, or 0 to stop it.
+ */
+void SetTimerCount(uint32_t count);
+
+/**
+ * Gets the number of ticks left on the running processor's one-shot timer.
+ */
+uint32_t timer_count();
+
+/**
+ * Sends an interrupt to the running processor.
+ * @param vector The vector to raise.
+ */
+void SendSelfInterrupt(uint8_t vector);
+
+/**
+ * Checks that an interrupt sent to the running processor arrives and can be
+ * acknowledged, and compares the cost of a local APIC EOI against a PIC one.
+ */
+void test_apic();
+
+} // namespace apic
+
+#endif // SRC_ARCH_I586_INCLUDE_INT_APIC_H_
@@ -0,0 +1,225 @@
+/**
+ * @file deferred.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "int/deferred.h"
+
+#include "int/isr.h"
+#include "sys/cpu.h"
+#include "sys/io.h"
+#include "video/text_screen.h"
+
+namespace isr {
+
+namespace {
+
+/**
+ * A processor's queue. Only that processor touches it, with interrupts
+ * disabled, so it needs no lock.
+ */
+struct WorkList {
+  WorkItem *head;
+  WorkItem *tail;
+
+  /**
+   * Whether the processor is running the queue, so an interrupt taken
+   * while an item runs doesn't start on the queue again.
+   */
+  bool running;
+};
+
+WorkList g_work[cpu::kMaxCpus];
+
+} // namespace
+
+bool WorkItem::Queue() {
+  if (__atomic_exchange_n(&pending_, true, __ATOMIC_ACQ_REL))
+    return false;
+
+  auto flags = save_and_disable_interrupts();
+  auto &list = g_work[cpu::current_id()];
+  next_ = nullptr;
+  if (list.tail)
+    list.tail->next_ = this;
+  else
+    list.head = this;
+  list.tail = this;
+  restore_interrupts(flags);
+  return true;
+}
+
+size_t RunWork(size_t budget) {
+  auto &list = g_work[cpu::current_id()];
+  if (list.running)
+    return 0;
+
+  list.running = true;
+  size_t ran = 0;
+  for (; ran < budget && list.head; ++ran) {
+    auto item = list.head;
+    list.head = item->next_;
+    if (!list.head)
+      list.tail = nullptr;
+    __atomic_store_n(&item->pending_, false, __ATOMIC_RELEASE);
+
+    enable_interrupts();
+    item->Run();
+    disable_interrupts();
+  }
+  list.running = false;
+  return ran;
+}
+
+bool HasPendingWork() { return g_work[cpu::current_id()].head != nullptr; }
+
+void RunPendingWork() {
+  auto flags = save_and_disable_interrupts();
+  // the caller may be holding something an item needs, with interrupts
+  // off to keep it safe, so the work waits for a better moment
+  if (flags & 0x200)
+    RunWork(static_cast<size_t>(-1));
+  restore_interrupts(flags);
+}
+
+namespace {
+
+/**
+ * Stands in for the slow part of a handler, e.g. copying a packet out of a
+ * device buffer.
+ */
+void SlowWork() {
+  const uint64_t kCycles = 50000;
+  auto start = read_tsc();
+  while (read_tsc() - start < kCycles)
+    continue;
+}
+
+/**
+ * The deferred half of TestHandler.
+ */
+class TestWork : public WorkItem {
+public:
+  TestWork() : runs(0), runs_enabled(0) {}
+
+  size_t runs;
+  size_t runs_enabled;
+
+protected:
+  virtual void Run() {
+    ++runs;
+    if (interrupts_enabled())
+      ++runs_enabled;
+    SlowWork();
+  }
+};
+
+/**
+ * Claims IRQ 13's vector only when it was raised by the test, so a real
+ * IRQ 13 still gets its EOI from the dispatcher. A software interrupt has
+ * nothing in service, so the test's own ones don't need one. (IRQs 7 and 15
+ * would look spurious to the dispatcher.)
+ */
+class TestHandler : public InterruptHandler {
+public:
+  TestHandler()
+      : InterruptHandler(Interrupts::kIRQ13), expecting(false),
+        defer(false), disabled_cycles(0) {}
+
+  volatile bool expecting;
+  bool defer;
+  TestWork work;
+
+  /**
+   * The cycles from entering the handler to leaving it.
+   */
+  uint32_t disabled_cycles;
+
+private:
+  virtual HandlerResult Handle(Registers * /*regs*/) {
+    if (!expecting)
+      return HandlerResult::kNotHandled;
+    expecting = false;
+
+    auto start = read_tsc();
+    if (defer)
+      work.Queue();
+    else
+      SlowWork();
+    disabled_cycles = static_cast<uint32_t>(read_tsc() - start);
+    return HandlerResult::kHandled;
+  }
+};
+
+/**
+ * Raises the test interrupt kRounds times.
+ * @return The most cycles the handler kept interrupts disabled.
+ */
+uint32_t WorstDisabledTime(TestHandler &handler) {
+  const int kRounds = 16;
+  uint32_t worst = 0;
+  for (int i = 0; i < kRounds; ++i) {
+    handler.expecting = true;
+    asm volatile("int $45" : : : "memory");
+    if (handler.disabled_cycles > worst)
+      worst = handler.disabled_cycles;
+  }
+  return worst;
+}
+
+} // namespace
+
+void test_deferred_work() {
+  TestHandler handler;
+  handler.RegisterHandler();
+
+  // work only runs on the way out of an interrupt that arrived with
+  // interrupts on, so the rounds are raised that way
+  auto flags = save_and_disable_interrupts();
+  enable_interrupts();
+  auto inline_cycles = WorstDisabledTime(handler);
+  handler.defer = true;
+  auto deferred_cycles = WorstDisabledTime(handler);
+  RunPendingWork();
+
+  // raised with interrupts off, it has to stay queued until they are on
+  disable_interrupts();
+  handler.expecting = true;
+  asm volatile("int $45" : : : "memory");
+  RunPendingWork();
+  auto waited = handler.work.is_pending();
+  enable_interrupts();
+  RunPendingWork();
+  restore_interrupts(flags);
+
+  handler.UnregisterHandler();
+  screen::Writef("deferred work test: %d of %d ran with interrupts on, "
+                 "%s with them off\n",
+                 handler.work.runs_enabled, handler.work.runs,
+                 waited ? "waited" : "ran");
+  screen::Writef("  worst interrupts off: %d cycles inline, %d deferred\n",
+                 inline_cycles, deferred_cycles);
+}
+
+} // namespace isr
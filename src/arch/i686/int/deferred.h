@@ -0,0 +1,118 @@
+/**
+ * @file deferred.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Work that interrupt handlers put off until interrupts are enabled again.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_INT_DEFERRED_H_
+#define SRC_ARCH_I586_INCLUDE_INT_DEFERRED_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isr {
+
+/**
+ * A piece of work queued by an interrupt handler. Handlers do the minimum
+ * with interrupts disabled (acknowledge the device, grab its data, EOI) and
+ * queue the rest on the running processor. The queue is run with interrupts
+ * enabled on the way out of the next IRQ that arrived with interrupts on, a
+ * few items at a time, and whatever is left over is run from the idle loop.
+ * Nothing runs where interrupts were off, since whoever turned them off may
+ * hold something an item needs.
+ */
+class WorkItem {
+public:
+  WorkItem() : next_(nullptr), pending_(false) {}
+  virtual ~WorkItem() {}
+
+  /**
+   * Queues the item on the running processor. Safe from interrupt handlers.
+   * @return False if it was already queued, in which case it still runs
+   * only once.
+   */
+  bool Queue();
+
+  /**
+   * Gets whether the item is queued and hasn't started running yet.
+   */
+  inline bool is_pending() const {
+    return __atomic_load_n(&pending_, __ATOMIC_ACQUIRE);
+  }
+
+protected:
+  /**
+   * Does the work, with interrupts enabled. The item is no longer pending
+   * by then, so it may queue itself again.
+   */
+  virtual void Run() = 0;
+
+private:
+  WorkItem *next_;
+  bool pending_;
+
+  friend size_t RunWork(size_t budget);
+};
+
+/**
+ * The most items run on the way out of an interrupt. The rest wait for the
+ * next interrupt or the idle loop, so a flood of work can't keep the
+ * interrupted code from running.
+ */
+const size_t kIrqExitBudget = 8;
+
+/**
+ * Runs items queued on the running processor, enabling interrupts for each
+ * one. Must be called with interrupts disabled, from a context that had them
+ * enabled, and returns with them disabled. Does nothing if the processor is
+ * already running its queue further up the stack.
+ * @param budget The most items to run.
+ * @return The number of items run.
+ */
+size_t RunWork(size_t budget);
+
+/**
+ * Gets whether anything is queued on the running processor. Call with
+ * interrupts disabled, so nothing can be queued between the check and
+ * halting.
+ */
+bool HasPendingWork();
+
+/**
+ * Runs everything queued on the running processor. For the idle loop, and
+ * anywhere else that isn't an interrupt handler. Called with interrupts
+ * disabled it leaves the queue alone.
+ */
+void RunPendingWork();
+
+/**
+ * Checks that deferred work runs with interrupts enabled, and compares how
+ * long a slow handler keeps interrupts disabled when it does its work
+ * inline against when it defers it.
+ */
+void test_deferred_work();
+
+} // namespace isr
+
+#endif // SRC_ARCH_I586_INCLUDE_INT_DEFERRED_H_
@@ -30,7 +30,7 @@
     cli
     push $0x0
     push $\isr_num
-    jmp isr_common_stub
+    jmp interrupt_common_stub
 .endm
 
 // Creates an ISR that does accept an error code.
@@ -39,7 +39,7 @@
   isr\isr_num:
     cli
     push $\isr_num
-    jmp isr_common_stub
+    jmp interrupt_common_stub
 .endm
 
 // Creates an IRQ.
@@ -49,9 +49,9 @@
   .global irq\irq_num
   irq\irq_num:
     cli
-    pushw $0
-    pushw $\isr_num
-    jmp irq_common_stub
+    push $0x0
+    push $\isr_num
+    jmp interrupt_common_stub
 .endm
 
 // Define all the interrupt service routine stubs.
@@ -88,6 +88,9 @@ ISR_NOERRCODE 29
 ISR_NOERRCODE 30
 ISR_NOERRCODE 31
 
+// The system call interrupt gate.
+ISR_NOERRCODE 128
+
 // Now define all the interrupt request handlers.
 IRQ  0, 32
 IRQ  1, 33
@@ -106,60 +109,57 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
-
-// This is our common ISR stub. It saves the processor state, sets up for kernel
-// mode segments, calls the C-level fault handler, and finally restores the stack
-// frame.
-isr_common_stub:
+// The local APIC timer, which has no IRQ number.
+.global apic_timer_interrupt
+apic_timer_interrupt:
+  cli
+  push $0x0
+  push $0xEF
+  jmp interrupt_common_stub
+
+// The local APIC's spurious interrupt needs neither a handler nor an EOI,
+// but it goes through the dispatcher to be counted.
+.global spurious_interrupt
+spurious_interrupt:
+  cli
+  push $0x0
+  push $0xFF
+  jmp interrupt_common_stub
+
+
+// This is our common stub for exceptions and interrupts alike. It saves the
+// processor state, sets up for kernel mode segments, hands the C++ dispatcher
+// a pointer to the saved frame, and finally restores the stack frame.
+interrupt_common_stub:
   pusha           // Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
   movw %ds, %ax   // Lower 16-bits of eax = ds
-  push %eax      // save the data segment descriptor
+  pushl %eax      // save the data segment descriptor
+  movw %fs, %ax   // and %fs, which ring 3 may have had something else in
+  pushl %eax
 
   movw $0x10, %ax // load the kernel data segment selector
   movw %ax, %ds
   movw %ax, %es
-  movw %ax, %fs
   movw %ax, %gs
 
-  call GlobalISRHandler
-
-  pop %eax       // reload the original data segment descriptor
-  movw %ax, %ds
-  movw %ax, %es
+  str %ax         // this processor's per-CPU segment is kMaxCpus entries
+  subw $per_cpu_selector_offset, %ax // before its TSS, see cpu.cc
   movw %ax, %fs
-  movw %ax, %gs
 
-  popa            // Pops edi,esi,ebp...
-  addl $8, %esp   // Cleans up the pushed error code and pushed ISR number
-  sti
-  iret            // pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+  cld             // the C++ code expects the direction flag clear
+  pushl %esp      // the frame is the argument, so nothing gets copied
+  call DispatchInterrupt
+  addl $4, %esp
 
-
-// This is our common IRQ stub. It saves the processor state, sets up for kernel
-// mode segments, calls the C-level fault handler, and finally restores the
-// stack frame.
-irq_common_stub:
-  pusha           // Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
-
-  movw %ds, %ax   // Lower 16-bits of eax = ds
-  pushl %eax      // save the data segment descriptor
-
-  movw $0x10, %ax // load the kernel data segment selector
+  popl %eax       // reload the original %fs
+  movw %ax, %fs
+  popl %eax       // reload the original data segment descriptor
   movw %ax, %ds
   movw %ax, %es
-  movw %ax, %fs
   movw %ax, %gs
 
-  call GlobalIRQHandler
-
-  popl %ebx       // reload the original data segment descriptor
-  movw %bx, %ds
-  movw %bx, %es
-  movw %bx, %fs
-  movw %bx, %gs
-
   popa            // Pops edi,esi,ebp...
   addl $8, %esp   // Cleans up the pushed error code and pushed ISR number
-  sti
-  iret            // Pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+  iret            // pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+                  // (restoring EFLAGS puts IF back the way it was)
@@ -63,13 +63,22 @@ enum class Interrupts {
   kIRQ12 = 44,
   kIRQ13 = 45,
   kIRQ14 = 46,
-  kIRQ15 = 47
+  kIRQ15 = 47,
+
+  kSyscall = 0x80,
+
+  kLocalTimer = 0xEF
 };
 
 /**
  * Represents the full set of registers on an x86 system.
  */
 struct Registers {
+  /**
+   * The %fs selector of the interrupted code.
+   */
+  uint32_t fs;
+
   /**
    * Data segment selector.
    */
@@ -152,7 +161,25 @@ struct Registers {
 };
 
 /**
- * Abstract base class representing an interrupt handler.
+ * What a handler did with an interrupt.
+ */
+enum class HandlerResult {
+  /**
+   * The interrupt wasn't for this handler, so the next one gets it.
+   */
+  kNotHandled,
+
+  /**
+   * The handler dealt with the interrupt, and the rest of the chain is
+   * skipped.
+   */
+  kHandled
+};
+
+/**
+ * Abstract base class representing an interrupt handler. Handlers for a
+ * vector are chained from that vector's entry in a table, newest first, and
+ * run until one of them claims the interrupt.
  */
 class InterruptHandler {
 public:
@@ -185,28 +212,33 @@ public:
 
 protected:
   /**
-   * Sends an EOI (end of interrupt) signal to the PICs. Should only be called
-   * for interrupts (not exceptions).
+   * Sends an EOI (end of interrupt) signal to the local APIC, or to the PICs
+   * if the APICs aren't in use. Should only be called for interrupts (not
+   * exceptions).
    * @param regs The value of the registers when the interrupt was raised.
    */
-  static void EndOfInterrupt(Registers regs);
+  static void EndOfInterrupt(const Registers *regs);
 
   /**
-   * Called when the interrupt is raised. Perform all handling here.
-   * @param regs The value of the registers when the interrupt was raised.
+   * Called when the interrupt is raised. Perform all handling here. A
+   * handler that claims an IRQ sends the EOI itself.
+   * @param regs The frame the interrupt stub pushed. It is restored when the
+   * handler returns, so changes to it (e.g. to eip) take effect in the
+   * interrupted code.
+   * @return kHandled to stop the chain here.
    */
-  virtual void Handle(Registers regs) = 0;
+  virtual HandlerResult Handle(Registers *regs) = 0;
 
 private:
   /**
-   * Iterates and executes the handler chain for the specified interrupt.
-   * @param regs The value of the registers when the interrupt was raised.
-   * @return True if at least one handler is registered for the interrupt.
+   * Runs the handler chain for the interrupt until a handler claims it.
+   * @param regs The frame the interrupt stub pushed.
+   * @return True if a handler claimed the interrupt.
    */
-  static bool FindAndHandle(Registers regs);
+  static bool Dispatch(Registers *regs);
 
   /**
-   * The table of all registered interrupt handlers.
+   * The head of each vector's handler chain.
    */
   static InterruptHandler *interrupt_handlers_[];
 
@@ -225,10 +257,17 @@ private:
    */
   InterruptHandler *next_;
 
-  friend void GlobalISRHandler_CPP(Registers);
-  friend void GlobalIRQHandler_CPP(Registers);
+  friend void DispatchInterrupt_CPP(Registers *);
 };
 
+/**
+ * Times a software interrupt through the dispatcher with one handler, with
+ * a chain of four whose first handler claims it, and with one where only
+ * the last does, which is what running the whole chain costs. Writes the
+ * cycles per interrupt to the screen.
+ */
+void benchmark_interrupts();
+
 } // namespace isr
 
 #endif // SRC_ARCH_I586_INCLUDE_INT_ISR_H_
@@ -0,0 +1,135 @@
+/**
+ * @file stats.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "int/stats.h"
+
+#include "sys/cpu.h"
+
+namespace isr {
+
+namespace {
+
+/**
+ * One processor's counts. Only that processor writes them, with interrupts
+ * disabled, so they need no atomics.
+ */
+struct CpuCounts {
+  uint32_t hits[kVectorCount];
+  uint32_t unhandled[kVectorCount];
+  uint32_t spurious[kVectorCount];
+};
+
+/**
+ * A vector's handler times, from every processor.
+ */
+struct Latency {
+  uint32_t buckets[kHistogramBuckets];
+  uint32_t worst;
+};
+
+CpuCounts g_counts[cpu::kMaxCpus];
+Latency g_latency[kVectorCount];
+
+inline size_t Bucket(uint32_t cycles) {
+  size_t bucket = 0;
+  for (cycles >>= kFirstBucketShift; cycles && bucket < kHistogramBuckets - 1;
+       cycles >>= 1)
+    ++bucket;
+  return bucket;
+}
+
+void RecordLatency(Latency &latency, uint32_t cycles) {
+  __atomic_fetch_add(&latency.buckets[Bucket(cycles)], 1, __ATOMIC_RELAXED);
+  auto worst = __atomic_load_n(&latency.worst, __ATOMIC_RELAXED);
+  while (cycles > worst &&
+         !__atomic_compare_exchange_n(&latency.worst, &worst, cycles, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    continue;
+}
+
+} // namespace
+
+void RecordInterrupt(uint32_t vector, InterruptOutcome outcome,
+                     uint32_t cycles) {
+  auto &counts = g_counts[cpu::current_id()];
+  ++counts.hits[vector];
+  switch (outcome) {
+  case InterruptOutcome::kSpurious:
+    ++counts.spurious[vector];
+    return;
+  case InterruptOutcome::kUnhandled:
+    ++counts.unhandled[vector];
+    break;
+  case InterruptOutcome::kHandled:
+    break;
+  }
+  RecordLatency(g_latency[vector], cycles);
+}
+
+uint32_t interrupt_count(uint32_t vector) {
+  uint32_t count = 0;
+  for (size_t id = 0; id < cpu::online_count(); ++id)
+    count += g_counts[id].hits[vector];
+  return count;
+}
+
+void DumpInterruptStats(serial::Port &port) {
+  auto cpus = cpu::online_count();
+  port.Writef("interrupt stats, %d cpus:\n", cpus);
+  for (uint32_t vector = 0; vector < kVectorCount; ++vector) {
+    auto hits = interrupt_count(vector);
+    if (!hits)
+      continue;
+
+    uint32_t unhandled = 0, spurious = 0;
+    port.Writef("  vector %d: %d hits (", vector, hits);
+    for (size_t id = 0; id < cpus; ++id) {
+      auto &counts = g_counts[id];
+      unhandled += counts.unhandled[vector];
+      spurious += counts.spurious[vector];
+      port.Writef(id ? ", cpu %d %d" : "cpu %d %d", id, counts.hits[vector]);
+    }
+    port.Writef("), %d unhandled, %d spurious\n", unhandled, spurious);
+
+    auto &latency = g_latency[vector];
+    if (hits == spurious)
+      continue;
+    port.Writef("    cycles, worst %d:", latency.worst);
+    for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+      auto count = __atomic_load_n(&latency.buckets[bucket], __ATOMIC_RELAXED);
+      if (!count)
+        continue;
+      if (bucket == kHistogramBuckets - 1)
+        port.Writef(" >=%d: %d", 1u << (kFirstBucketShift + bucket - 1),
+                    count);
+      else
+        port.Writef(" <%d: %d", 1u << (kFirstBucketShift + bucket), count);
+    }
+    port.Write("\n");
+  }
+}
+
+} // namespace isr
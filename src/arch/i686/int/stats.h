@@ -0,0 +1,98 @@
+/**
+ * @file stats.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Counts of every interrupt taken and how long its handlers took, for
+ * finding interrupt storms and slow handlers.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_INT_STATS_H_
+#define SRC_ARCH_I586_INCLUDE_INT_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dev/serial.h"
+
+namespace isr {
+
+/**
+ * The number of interrupt vectors.
+ */
+const size_t kVectorCount = 256;
+
+/**
+ * The number of buckets in a handler time histogram. Bucket 0 counts
+ * handlers that took under 2^kFirstBucketShift cycles, each bucket after it
+ * twice as long as the one before, and the last one everything longer.
+ */
+const size_t kHistogramBuckets = 16;
+const uint32_t kFirstBucketShift = 7;
+
+/**
+ * What became of an interrupt.
+ */
+enum class InterruptOutcome {
+  /**
+   * A handler claimed it.
+   */
+  kHandled,
+
+  /**
+   * Nobody claimed it.
+   */
+  kUnhandled,
+
+  /**
+   * An interrupt controller raised it without a device asking, so there
+   * was nothing to handle or acknowledge.
+   */
+  kSpurious
+};
+
+/**
+ * Counts an interrupt against the running processor. Called by the
+ * dispatcher with interrupts disabled.
+ * @param vector The vector that was raised.
+ * @param outcome What the handlers made of it.
+ * @param cycles How long the handler chain ran, which goes in the vector's
+ * histogram unless the interrupt was spurious.
+ */
+void RecordInterrupt(uint32_t vector, InterruptOutcome outcome,
+                     uint32_t cycles);
+
+/**
+ * Gets how many times a vector has been raised on all processors together.
+ */
+uint32_t interrupt_count(uint32_t vector);
+
+/**
+ * Writes the counts of every vector that has been raised, per processor,
+ * along with the unhandled and spurious counts and handler time histograms.
+ * @param port Where to write them.
+ */
+void DumpInterruptStats(serial::Port &port);
+
+} // namespace isr
+
+#endif // SRC_ARCH_I586_INCLUDE_INT_STATS_H_
@@ -0,0 +1,499 @@
+/**
+ * @file timer.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "int/timer.h"
+
+#include "int/apic.h"
+#include "int/deferred.h"
+#include "int/isr.h"
+#include "sys/cpu.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace timer {
+
+namespace {
+
+/**
+ * The PIT's input clock, in Hz.
+ */
+const uint32_t kPitFrequency = 1193182;
+
+/**
+ * PIT ports and mode commands: channel 0 or 2, low then high byte, mode 0
+ * (interrupt on terminal count).
+ */
+const uint16_t kPitChannel0 = 0x40;
+const uint16_t kPitChannel2 = 0x42;
+const uint16_t kPitCommand = 0x43;
+const uint8_t kPitChannel0OneShot = 0x30;
+const uint8_t kPitChannel2OneShot = 0xB0;
+
+/**
+ * Port 0x61 bits: the channel 2 gate, the speaker enable, and the channel 2
+ * output.
+ */
+const uint16_t kSystemControl = 0x61;
+const uint8_t kChannel2Gate = 0x01;
+const uint8_t kSpeakerEnable = 0x02;
+const uint8_t kChannel2Output = 0x20;
+
+/**
+ * The clocks are measured over 10ms of the PIT.
+ */
+const uint32_t kCalibrationMicroseconds = 10000;
+const uint16_t kCalibrationTicks = kPitFrequency / 100;
+
+/**
+ * The TSC deadline MSR, and the CPUID leaf 1 ecx bit saying it exists.
+ */
+const uint32_t kTscDeadlineMsr = 0x6E0;
+const uint32_t kHasTscDeadline = 1 << 24;
+
+uint32_t g_tsc_per_us = 0;
+
+/**
+ * Local APIC and PIT ticks per TSC cycle, as 0.32 fixed point fractions.
+ */
+uint32_t g_apic_per_tsc = 0;
+uint32_t g_pit_per_tsc = 0;
+
+/**
+ * Works out num / den as a 0.32 fixed point fraction, with a single divide
+ * so no 64-bit division routine is needed.
+ * @return The fraction, or the largest one if num isn't below den.
+ */
+inline uint32_t Fraction(uint32_t num, uint32_t den) {
+  if (num >= den)
+    return 0xFFFFFFFF;
+  uint32_t quotient, remainder;
+  asm("divl %4"
+      : "=a"(quotient), "=d"(remainder)
+      : "a"(0), "d"(num), "rm"(den));
+  return quotient;
+}
+
+/**
+ * Gets the number of TSC cycles until a deadline, capped at 32 bits.
+ */
+inline uint32_t CyclesUntil(uint64_t deadline) {
+  auto now = read_tsc();
+  if (deadline <= now)
+    return 0;
+  auto delta = deadline - now;
+  return delta > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<uint32_t>(delta);
+}
+
+/**
+ * Converts TSC cycles to another clock's ticks.
+ * @param fraction The other clock's ticks per cycle, from Fraction.
+ */
+inline uint32_t Scale(uint32_t cycles, uint32_t fraction) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(cycles) * fraction) >>
+                               32);
+}
+
+/**
+ * The local APIC timer in TSC deadline mode, which takes the deadline as it
+ * is.
+ */
+class TscDeadlineDevice : public ClockEventDevice {
+public:
+  virtual const char *name() const { return "tsc deadline"; }
+  virtual void Arm(uint64_t deadline) {
+    // 0 would disarm it
+    write_msr(kTscDeadlineMsr, deadline ? deadline : 1);
+  }
+  virtual void Disarm() { write_msr(kTscDeadlineMsr, 0); }
+};
+
+/**
+ * The local APIC timer counting down.
+ */
+class LocalApicDevice : public ClockEventDevice {
+public:
+  virtual const char *name() const { return "local apic"; }
+  virtual void Arm(uint64_t deadline) {
+    auto ticks = Scale(CyclesUntil(deadline), g_apic_per_tsc);
+    apic::SetTimerCount(ticks ? ticks : 1);
+  }
+  virtual void Disarm() { apic::SetTimerCount(0); }
+};
+
+/**
+ * PIT channel 0 counting down once. It can count for at most 55ms, so a
+ * later deadline takes more than one interrupt. There is only one, so it
+ * serves the boot processor only, which is fine as there is nothing else
+ * without an APIC.
+ */
+class PitDevice : public ClockEventDevice {
+public:
+  virtual const char *name() const { return "pit"; }
+  virtual void Arm(uint64_t deadline) {
+    auto ticks = Scale(CyclesUntil(deadline), g_pit_per_tsc);
+    if (ticks == 0)
+      ticks = 1;
+    else if (ticks > 0xFFFF)
+      ticks = 0xFFFF;
+    outb(kPitCommand, kPitChannel0OneShot);
+    outb(kPitChannel0, ticks & 0xFF);
+    outb(kPitChannel0, ticks >> 8);
+  }
+  virtual void Disarm() {
+    // a new mode without a count holds the output low
+    outb(kPitCommand, kPitChannel0OneShot);
+  }
+};
+
+TscDeadlineDevice g_tsc_deadline;
+LocalApicDevice g_local_apic;
+PitDevice g_pit;
+ClockEventDevice *g_device = nullptr;
+
+} // namespace
+
+/**
+ * A processor's timers, sorted by deadline. Only that processor touches it,
+ * with interrupts disabled, so it needs no lock.
+ */
+class TimerQueue {
+public:
+  void Insert(Timer *timer) {
+    auto link = &head_;
+    while (*link && (*link)->deadline_ <= timer->deadline_)
+      link = &(*link)->next_;
+    timer->next_ = *link;
+    *link = timer;
+    Reprogram();
+  }
+
+  void Remove(Timer *timer) {
+    auto link = &head_;
+    while (*link != timer)
+      link = &(*link)->next_;
+    *link = timer->next_;
+    Reprogram();
+  }
+
+  /**
+   * Expires every timer whose deadline has passed. For the device's
+   * interrupt handler.
+   */
+  void RunExpired() {
+    ++interrupts_;
+    armed_ = 0;
+    running_ = true;
+    auto now = read_tsc();
+    while (head_ && head_->deadline_ <= now) {
+      auto timer = head_;
+      head_ = timer->next_;
+      __atomic_store_n(&timer->pending_, false, __ATOMIC_RELEASE);
+      timer->Expire();
+    }
+    running_ = false;
+    Reprogram();
+  }
+
+  inline void set_idle(bool idle) {
+    idle_ = idle;
+    Reprogram();
+  }
+
+  inline uint32_t interrupts() const { return interrupts_; }
+
+private:
+  /**
+   * Arms the device for the first timer that counts, if it isn't already.
+   */
+  void Reprogram() {
+    if (running_)
+      return;
+    auto timer = head_;
+    if (idle_) {
+      while (timer && timer->deferrable_)
+        timer = timer->next_;
+    }
+    if (!timer) {
+      if (armed_) {
+        g_device->Disarm();
+        armed_ = 0;
+      }
+    } else if (timer->deadline_ != armed_) {
+      g_device->Arm(timer->deadline_);
+      armed_ = timer->deadline_;
+    }
+  }
+
+  Timer *head_;
+
+  /**
+   * The deadline the device is armed for, or 0 if it isn't.
+   */
+  uint64_t armed_;
+
+  /**
+   * Whether timers are being expired, which reprograms the device once at
+   * the end instead of for every timer that restarts itself.
+   */
+  bool running_;
+
+  bool idle_;
+  uint32_t interrupts_;
+};
+
+namespace {
+
+TimerQueue g_queues[cpu::kMaxCpus];
+
+/**
+ * Takes the event device's interrupt, on either the local APIC timer vector
+ * or IRQ 0.
+ */
+class TimerInterruptHandler : public isr::InterruptHandler {
+public:
+  explicit TimerInterruptHandler(isr::Interrupts vector)
+      : InterruptHandler(vector) {}
+
+private:
+  virtual isr::HandlerResult Handle(isr::Registers *regs) {
+    EndOfInterrupt(regs);
+    g_queues[cpu::current_id()].RunExpired();
+    return isr::HandlerResult::kHandled;
+  }
+};
+
+TimerInterruptHandler g_apic_handler(isr::Interrupts::kLocalTimer);
+TimerInterruptHandler g_pit_handler(isr::Interrupts::kIRQ0);
+
+/**
+ * Times kCalibrationTicks of PIT channel 2 with the TSC and, if it is in
+ * use, the local APIC timer.
+ * @param[out] apic_ticks The local APIC timer ticks counted.
+ * @return The TSC cycles counted.
+ */
+uint32_t Calibrate(uint32_t &apic_ticks) {
+  auto flags = save_and_disable_interrupts();
+  auto control = inb(kSystemControl);
+  outb(kSystemControl, (control & ~kSpeakerEnable) | kChannel2Gate);
+  outb(kPitCommand, kPitChannel2OneShot);
+  outb(kPitChannel2, kCalibrationTicks & 0xFF);
+  outb(kPitChannel2, kCalibrationTicks >> 8);
+
+  if (apic::is_enabled()) {
+    apic::SetTimerMode(apic::TimerMode::kOneShot);
+    apic::SetTimerCount(0xFFFFFFFF);
+  }
+  auto start = read_tsc();
+  while (!(inb(kSystemControl) & kChannel2Output))
+    continue;
+  auto cycles = static_cast<uint32_t>(read_tsc() - start);
+  apic_ticks = 0;
+  if (apic::is_enabled()) {
+    apic_ticks = 0xFFFFFFFF - apic::timer_count();
+    apic::SetTimerCount(0);
+  }
+
+  outb(kSystemControl, control);
+  restore_interrupts(flags);
+  return cycles;
+}
+
+bool HasTscDeadline() {
+  uint32_t regs[4];
+  cpuid(1, regs);
+  return (regs[2] & kHasTscDeadline) != 0;
+}
+
+} // namespace
+
+void Timer::Start(uint32_t microseconds) {
+  StartAt(read_tsc() + static_cast<uint64_t>(microseconds) * g_tsc_per_us);
+}
+
+void Timer::StartAt(uint64_t deadline) {
+  ASSERT(g_device);
+  auto flags = save_and_disable_interrupts();
+  auto id = cpu::current_id();
+  auto &queue = g_queues[id];
+  if (pending_) {
+    ASSERT(cpu_ == id);
+    queue.Remove(this);
+  }
+  deadline_ = deadline;
+  cpu_ = id;
+  __atomic_store_n(&pending_, true, __ATOMIC_RELEASE);
+  queue.Insert(this);
+  restore_interrupts(flags);
+}
+
+bool Timer::Cancel() {
+  auto flags = save_and_disable_interrupts();
+  auto was_pending = pending_;
+  if (was_pending) {
+    ASSERT(cpu_ == cpu::current_id());
+    g_queues[cpu_].Remove(this);
+    __atomic_store_n(&pending_, false, __ATOMIC_RELEASE);
+  }
+  restore_interrupts(flags);
+  return was_pending;
+}
+
+void Initialize() {
+  // whatever the firmware left the PIT doing, it isn't ticking from now on
+  outb(kPitCommand, kPitChannel0OneShot);
+
+  uint32_t apic_ticks;
+  auto cycles = Calibrate(apic_ticks);
+  g_tsc_per_us = cycles / kCalibrationMicroseconds;
+  g_pit_per_tsc = Fraction(kCalibrationTicks, cycles);
+
+  if (apic::is_enabled() && HasTscDeadline()) {
+    g_device = &g_tsc_deadline;
+  } else if (apic::is_enabled() && apic_ticks) {
+    g_apic_per_tsc = Fraction(apic_ticks, cycles);
+    g_device = &g_local_apic;
+  } else {
+    g_device = &g_pit;
+    g_pit_handler.RegisterHandler();
+    return;
+  }
+  g_apic_handler.RegisterHandler();
+  InitializeSecondary();
+}
+
+void InitializeSecondary() {
+  if (g_device == &g_tsc_deadline)
+    apic::SetTimerMode(apic::TimerMode::kTscDeadline);
+  else if (g_device == &g_local_apic)
+    apic::SetTimerMode(apic::TimerMode::kOneShot);
+}
+
+const ClockEventDevice *device() { return g_device; }
+
+uint32_t tsc_per_microsecond() { return g_tsc_per_us; }
+
+uint32_t interrupt_count() {
+  return g_queues[cpu::current_id()].interrupts();
+}
+
+void Idle() {
+  auto flags = save_and_disable_interrupts();
+  if (isr::HasPendingWork()) {
+    restore_interrupts(flags);
+    return;
+  }
+
+  auto &queue = g_queues[cpu::current_id()];
+  if (g_device)
+    queue.set_idle(true);
+  // sti only takes effect after the next instruction, so an interrupt
+  // can't slip in between and leave us halted with it already handled
+  asm volatile("sti; hlt" : : : "memory");
+  disable_interrupts();
+  if (g_device)
+    queue.set_idle(false);
+  restore_interrupts(flags);
+}
+
+namespace {
+
+/**
+ * Notes when, and in which order, it expired.
+ */
+class TestTimer : public Timer {
+public:
+  explicit TestTimer(bool deferrable = false)
+      : Timer(deferrable), expired_at(0), order(0) {}
+
+  static size_t expired;
+  uint64_t expired_at;
+  size_t order;
+
+protected:
+  virtual void Expire() {
+    expired_at = read_tsc();
+    order = ++expired;
+  }
+};
+
+size_t TestTimer::expired = 0;
+
+} // namespace
+
+void test_timers() {
+  size_t bad = 0;
+
+  // started out of order, they still expire in deadline order, each with
+  // an interrupt of its own
+  TestTimer timers[3];
+  timers[2].Start(3000);
+  timers[0].Start(1000);
+  timers[1].Start(2000);
+  auto interrupts = interrupt_count();
+  while (timers[2].is_pending())
+    Idle();
+  interrupts = interrupt_count() - interrupts;
+  uint32_t late = 0;
+  for (size_t i = 0; i < 3; ++i) {
+    if (timers[i].order != TestTimer::expired - 2 + i ||
+        timers[i].expired_at < timers[i].deadline())
+      ++bad;
+    late += static_cast<uint32_t>(timers[i].expired_at - timers[i].deadline());
+  }
+
+  // a deferrable timer doesn't wake the processor, and expires along with
+  // the ordinary one that does
+  TestTimer lazy(true), wake;
+  lazy.Start(1000);
+  wake.Start(5000);
+  auto idle_interrupts = interrupt_count();
+  while (wake.is_pending())
+    Idle();
+  idle_interrupts = interrupt_count() - idle_interrupts;
+  if (lazy.is_pending() || lazy.expired_at < wake.deadline())
+    ++bad;
+
+  // a cancelled timer never expires
+  TestTimer cancelled;
+  cancelled.Start(500);
+  if (!cancelled.Cancel() || cancelled.Cancel())
+    ++bad;
+  wake.Start(1000);
+  while (wake.is_pending())
+    Idle();
+  if (cancelled.order)
+    ++bad;
+
+  screen::Writef("timer test (%s, %d cycles/us): %d problems\n",
+                 g_device->name(), g_tsc_per_us, bad);
+  screen::Writef("  3 timers: %d interrupts, %d cycles late on average\n",
+                 interrupts, late / 3);
+  screen::Writef("  5ms idle with a deferrable timer: %d interrupts\n",
+                 idle_interrupts);
+}
+
+} // namespace timer
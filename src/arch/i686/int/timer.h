@@ -0,0 +1,175 @@
+/**
+ * @file timer.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * One-shot kernel timers. There is no periodic tick: each processor's event
+ * device is armed for its earliest timer only, and not at all when it has
+ * none.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_INT_TIMER_H_
+#define SRC_ARCH_I586_INCLUDE_INT_TIMER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace timer {
+
+/**
+ * Something that can raise an interrupt on the running processor at a given
+ * time. Times are TSC values throughout.
+ */
+class ClockEventDevice {
+public:
+  virtual ~ClockEventDevice() {}
+
+  /**
+   * Gets the name to report the device by.
+   */
+  virtual const char *name() const = 0;
+
+  /**
+   * Arranges for one interrupt once the TSC reaches deadline, replacing any
+   * earlier request. A deadline further out than the device can count may
+   * fire early, and one that has passed fires right away.
+   */
+  virtual void Arm(uint64_t deadline) = 0;
+
+  /**
+   * Cancels the pending interrupt, if there is one.
+   */
+  virtual void Disarm() = 0;
+};
+
+class TimerQueue;
+
+/**
+ * A one-shot timer. It is kept on the queue of the processor that started
+ * it, and expires in that processor's timer interrupt.
+ */
+class Timer {
+public:
+  /**
+   * Creates a new Timer instance.
+   * @param deferrable If true, the timer never wakes an idle processor. It
+   * expires with whatever interrupt wakes the processor next, which suits
+   * housekeeping that has nothing to do while nothing runs.
+   */
+  explicit Timer(bool deferrable = false)
+      : next_(nullptr), deadline_(0), cpu_(0), pending_(false),
+        deferrable_(deferrable) {}
+  virtual ~Timer() { Cancel(); }
+
+  /**
+   * Starts the timer on the running processor, or moves it if it is already
+   * pending. Must be called on the processor it is pending on.
+   * @param microseconds How long from now it should expire.
+   */
+  void Start(uint32_t microseconds);
+
+  /**
+   * Starts the timer for a TSC value, like Start.
+   */
+  void StartAt(uint64_t deadline);
+
+  /**
+   * Stops the timer. Must be called on the processor that started it.
+   * @return False if it wasn't pending.
+   */
+  bool Cancel();
+
+  /**
+   * Gets whether the timer is started and hasn't expired yet.
+   */
+  inline bool is_pending() const {
+    return __atomic_load_n(&pending_, __ATOMIC_ACQUIRE);
+  }
+
+  /**
+   * Gets the TSC value the timer was last started for.
+   */
+  inline uint64_t deadline() const { return deadline_; }
+
+protected:
+  /**
+   * Called from the timer interrupt, with interrupts disabled, once the
+   * deadline has passed. The timer is no longer pending by then, so it may
+   * start itself again. Anything slow belongs in an isr::WorkItem.
+   */
+  virtual void Expire() = 0;
+
+private:
+  Timer *next_;
+  uint64_t deadline_;
+  size_t cpu_;
+  bool pending_;
+  bool deferrable_;
+
+  friend class TimerQueue;
+};
+
+/**
+ * Measures the TSC and local APIC timer against the PIT, stops the PIT's
+ * periodic tick, and picks the event device: the TSC deadline timer if the
+ * processor has one, else the local APIC timer, else the PIT. Must run after
+ * the interrupt controllers are set up.
+ */
+void Initialize();
+
+/**
+ * Sets up the event device on a secondary processor.
+ */
+void InitializeSecondary();
+
+/**
+ * Gets the event device Initialize picked.
+ */
+const ClockEventDevice *device();
+
+/**
+ * Gets the number of TSC cycles in a microsecond.
+ */
+uint32_t tsc_per_microsecond();
+
+/**
+ * Gets the number of timer interrupts the running processor has taken.
+ */
+uint32_t interrupt_count();
+
+/**
+ * Halts the running processor until the next interrupt, unless there is
+ * deferred work to do. Deferrable timers don't count while it is halted.
+ * Interrupts are enabled for the halt only. For the idle loop.
+ */
+void Idle();
+
+/**
+ * Checks that timers expire in order and on time, that a processor sleeping
+ * on a timer takes a single interrupt, and that deferrable timers wait for
+ * the processor to wake up.
+ */
+void test_timers();
+
+} // namespace timer
+
+#endif // SRC_ARCH_I586_INCLUDE_INT_TIMER_H_
@@ -0,0 +1,49 @@
+/**
+ * @file background_scan.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/background_scan.h"
+
+namespace paging {
+
+void BackgroundScanner::Start() {
+  stopped_ = false;
+  Timer::Start(kBackgroundScanPeriod);
+}
+
+void BackgroundScanner::Stop() {
+  stopped_ = true;
+  Cancel();
+}
+
+void BackgroundScanner::Run() {
+  working_set_.Step(kWorkingSetBudget);
+  promoter_.Step(kPromoterBudget);
+  ++steps_;
+  if (!stopped_)
+    Timer::Start(kBackgroundScanPeriod);
+}
+
+} // namespace paging
@@ -0,0 +1,97 @@
+/**
+ * @file background_scan.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Runs the incremental page table scans a little at a time from a timer.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_BACKGROUND_SCAN_H_
+#define SRC_ARCH_I586_INCLUDE_MM_BACKGROUND_SCAN_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "int/deferred.h"
+#include "int/timer.h"
+#include "mm/huge_page.h"
+#include "mm/working_set.h"
+
+namespace paging {
+
+/**
+ * The time between steps of the background scan, in microseconds.
+ */
+const uint32_t kBackgroundScanPeriod = 10000;
+
+/**
+ * Steps a WorkingSetEstimator and a HugePagePromoter from a deferrable
+ * timer. The timer only queues the step, which runs as deferred work with
+ * interrupts enabled. Being deferrable, it never wakes an idle processor;
+ * while nothing runs there is nothing new to sample.
+ */
+class BackgroundScanner : private timer::Timer, private isr::WorkItem {
+public:
+  /**
+   * The page table entries sampled per step.
+   */
+  static const size_t kWorkingSetBudget = 1024;
+
+  /**
+   * The page directory entries examined for promotion per step.
+   */
+  static const size_t kPromoterBudget = 8;
+
+  BackgroundScanner(WorkingSetEstimator &working_set,
+                    HugePagePromoter &promoter)
+      : Timer(true), working_set_(working_set), promoter_(promoter),
+        steps_(0), stopped_(true) {}
+
+  /**
+   * Starts stepping on the running processor.
+   */
+  void Start();
+
+  /**
+   * Stops stepping. A step that is already queued still runs, but doesn't
+   * start the timer again.
+   */
+  void Stop();
+
+  /**
+   * Gets the number of steps that have run.
+   */
+  inline size_t steps() const { return steps_; }
+
+private:
+  virtual void Expire() { Queue(); }
+  virtual void Run();
+
+  WorkingSetEstimator &working_set_;
+  HugePagePromoter &promoter_;
+  size_t steps_;
+  bool stopped_;
+};
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_BACKGROUND_SCAN_H_
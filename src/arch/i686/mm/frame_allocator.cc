@@ -24,6 +24,9 @@
 
 #include "mm/frame_allocator.h"
 
+#include <cstring>
+
+#include "mm/shrinker.h"
 #include "sys/kernel.h"
 // #include "video/text_screen.h"
 
@@ -31,8 +34,29 @@ extern uint32_t __kernel_start, __kernel_end;
 
 namespace paging {
 
+/**
+ * How many frames to ask the shrinkers for at once when we run out. Asking for
+ * a batch lets swap write out a whole cluster of pages in one go.
+ */
+const size_t kReclaimBatch = 32;
+
+/**
+ * The default watermarks, in frames (256KiB and 512KiB).
+ */
+const size_t kDefaultLowWatermark = 64;
+const size_t kDefaultHighWatermark = 128;
+
+/**
+ * The default number of frames only kAtomic allocations may take.
+ */
+const size_t kDefaultReserveFrames = 32;
+
 AreaFrameAllocator::AreaFrameAllocator(paddress kernelStart, paddress kernelEnd, paddress multibootStart, paddress multibootEnd)
-    : next_free_frame_(0), kernel_start_(0), kernel_end_(0), multiboot_start_(0), multiboot_end_(0), current_area_(), areas_count_(0) {
+    : next_free_frame_(0), kernel_start_(0), kernel_end_(0), multiboot_start_(0), multiboot_end_(0), current_area_(), areas_count_(0),
+      freed_count_(0), freed_hint_(0), area_frames_(0),
+      low_watermark_(kDefaultLowWatermark), high_watermark_(kDefaultHighWatermark),
+      reserve_frames_(kDefaultReserveFrames) {
+    memset(freed_, 0, sizeof(freed_));
     kernel_start_ = Frame::ContainingAddress(kernelStart);
     kernel_end_ = Frame::ContainingAddress(kernelEnd);
     multiboot_start_ = Frame::ContainingAddress(multibootStart);
@@ -40,6 +64,7 @@ AreaFrameAllocator::AreaFrameAllocator(paddress kernelStart, paddress kernelEnd,
 }
 
 void AreaFrameAllocator::RegisterMemoryArea(paddress start, size_t size) {
+  SpinlockGuard guard(lock_);
   if (++areas_count_ >= 32) {
     PANIC("Exceeded maximum available memory areas");
   }
@@ -49,9 +74,69 @@ void AreaFrameAllocator::RegisterMemoryArea(paddress start, size_t size) {
 
   if (areas_count_ == 1)
     ChooseNextArea();
+  area_frames_ = CountAreaFrames();
 }
 
 optional<Frame> AreaFrameAllocator::Allocate() {
+  return Allocate(alloc::AllocFlags::kNone);
+}
+
+optional<Frame> AreaFrameAllocator::Allocate(alloc::AllocFlags flags) {
+  auto no_wait = alloc::has_flag(flags, alloc::AllocFlags::kNoWait);
+  auto atomic = alloc::has_flag(flags, alloc::AllocFlags::kAtomic);
+  if (!no_wait)
+    CheckWatermark();
+
+  for (;;) {
+    {
+      SpinlockGuard guard(lock_);
+      if (atomic || free_frames() > reserve_frames_) {
+        auto frame = AllocateLocked();
+        if (frame)
+          return frame;
+      }
+    }
+
+    // we're out of memory, see if someone can give us some back before
+    // failing
+    if (no_wait || ShrinkCaches(kReclaimBatch) == 0)
+      return {};
+  }
+}
+
+optional<Frame> AreaFrameAllocator::AllocateLocked() {
+  auto frame = AllocateFreed();
+  if (!frame)
+    frame = AllocateFromArea();
+  return frame;
+}
+
+void AreaFrameAllocator::CheckWatermark() {
+  auto free = free_frames();
+  if (free < low_watermark_)
+    ShrinkCaches(high_watermark_ - free);
+}
+
+optional<Frame> AreaFrameAllocator::AllocateFreed() {
+  if (freed_count_ == 0)
+    return {};
+
+  const size_t words = kMaxTrackedFrames / 32;
+  for (size_t i = freed_hint_; i < words; ++i) {
+    if (freed_[i] == 0)
+      continue;
+    auto bit = __builtin_ctz(freed_[i]);
+    freed_[i] &= ~(1u << bit);
+    --freed_count_;
+    freed_hint_ = i;
+    return Frame(i * 32 + bit);
+  }
+
+  PANIC("AreaFrameAllocator freed frame count is out of sync");
+  return {};
+}
+
+optional<Frame> AreaFrameAllocator::AllocateFromArea() {
   // screen::WriteLine("-- Allocate()...");
   // screen::Writef("      current_area_.is_set() = %d, areas_count_ = %d, next_free_frame_ = %d\n",
   //   current_area_.is_set() ? 1 : 0, areas_count_, next_free_frame_.index());
@@ -83,16 +168,108 @@ optional<Frame> AreaFrameAllocator::Allocate() {
       // frame is unused, increment next_free_frame_ and return it
       // screen::WriteLine("      frame is available");
       ++next_free_frame_;
+      --area_frames_;
       return frame;
     }
     // frame was not valid, try again with the updated next_free_frame_
     // screen::WriteLine("      frame was not valid, retrying");
-    return Allocate();
+    return AllocateFromArea();
   } else {
     return {};
   }
 }
 
+optional<Frame> AreaFrameAllocator::AllocateContiguous(size_t count,
+                                                      size_t align) {
+  ASSERT(count > 0 && align > 0);
+  CheckWatermark();
+  SpinlockGuard guard(lock_);
+  if (free_frames() < reserve_frames_ + count)
+    return {};
+  auto frame = AllocateContiguousFreed(count, align);
+  if (!frame)
+    frame = AllocateContiguousFromArea(count, align);
+  return frame;
+}
+
+optional<Frame> AreaFrameAllocator::AllocateContiguousFreed(size_t count,
+                                                           size_t align) {
+  if (freed_count_ < count)
+    return {};
+
+  auto is_freed = [this](size_t i) {
+    return (freed_[i / 32] & (1u << (i % 32))) != 0;
+  };
+
+  size_t start = freed_hint_ * 32;
+  start += (align - start % align) % align;
+  while (start + count <= kMaxTrackedFrames) {
+    // look for the last frame of the run that is still in use, whole words at
+    // a time where we can
+    size_t end = start + count, used = end;
+    for (size_t i = end; i > start;) {
+      if (i % 32 == 0 && i - start >= 32 && freed_[i / 32 - 1] == ~0u) {
+        i -= 32;
+        continue;
+      }
+      --i;
+      if (!is_freed(i)) {
+        used = i;
+        break;
+      }
+    }
+
+    if (used == end) {
+      for (size_t i = start; i < end; ++i)
+        freed_[i / 32] &= ~(1u << (i % 32));
+      freed_count_ -= count;
+      return Frame(start);
+    }
+
+    // no run can include the used frame, skip past it
+    start = used + 1;
+    start += (align - start % align) % align;
+  }
+  return {};
+}
+
+optional<Frame> AreaFrameAllocator::AllocateContiguousFromArea(size_t count,
+                                                              size_t align) {
+  if (!current_area_)
+    return {};
+
+  auto last = Frame::ContainingAddress(current_area_->address +
+                                       current_area_->size - 1);
+  auto align_up = [align](size_t index) {
+    return Frame(index + (align - index % align) % align);
+  };
+
+  // the run has to stay clear of the kernel and the multiboot information
+  auto start = align_up(next_free_frame_.index());
+  for (;;) {
+    auto end = start + (count - 1);
+    if (end > last)
+      return {};
+    if (start <= kernel_end_ && end >= kernel_start_)
+      start = align_up(kernel_end_.index() + 1);
+    else if (start <= multiboot_end_ && end >= multiboot_start_)
+      start = align_up(multiboot_end_.index() + 1);
+    else
+      break;
+  }
+
+  // hand the frames we're skipping over to the freed list, AllocateFromArea
+  // already knows to step around the reserved ranges
+  while (next_free_frame_ < start) {
+    auto skipped = AllocateFromArea();
+    ASSERT(skipped && *skipped < start);
+    FreeLocked(*skipped);
+  }
+  next_free_frame_ = start + count;
+  area_frames_ -= count;
+  return start;
+}
+
 void AreaFrameAllocator::ChooseNextArea() {
   current_area_ = {};
   // screen::WriteLine("-- ChooseNextArea()...");
@@ -126,8 +303,58 @@ void AreaFrameAllocator::ChooseNextArea() {
   }
 }
 
+size_t AreaFrameAllocator::CountAreaFrames() const {
+  // the number of frames in both [first, last] and [start, end]
+  auto overlap = [](size_t first, size_t last, size_t start, size_t end) {
+    if (start < first)
+      start = first;
+    if (end > last)
+      end = last;
+    return start <= end ? end - start + 1 : 0;
+  };
+
+  size_t count = 0;
+  for (int i = 0; i < areas_count_; ++i) {
+    auto first = Frame::ContainingAddress(areas_[i].address).index();
+    auto last = Frame::ContainingAddress(areas_[i].address + areas_[i].size - 1)
+                    .index();
+    if (first < next_free_frame_.index())
+      first = next_free_frame_.index();
+    if (first > last)
+      continue;
+
+    // the multiboot information may lie inside the kernel's range, so frames
+    // in both are only taken away once
+    auto kernel = overlap(first, last, kernel_start_.index(),
+                          kernel_end_.index());
+    auto multiboot = overlap(first, last, multiboot_start_.index(),
+                             multiboot_end_.index());
+    auto both = overlap(
+        first > kernel_start_.index() ? first : kernel_start_.index(),
+        last < kernel_end_.index() ? last : kernel_end_.index(),
+        multiboot_start_.index(), multiboot_end_.index());
+    count += last - first + 1 - kernel - multiboot + both;
+  }
+  return count;
+}
+
 void AreaFrameAllocator::Free(Frame f) {
-  PANIC("AreaFrameAllocator::Free not implemented!");
+  SpinlockGuard guard(lock_);
+  FreeLocked(f);
+}
+
+void AreaFrameAllocator::FreeLocked(Frame f) {
+  // frames we can't track are simply never handed out again
+  if (f.index() >= kMaxTrackedFrames)
+    return;
+
+  size_t word = f.index() / 32;
+  uint32_t mask = 1u << (f.index() % 32);
+  ASSERT((freed_[word] & mask) == 0);
+  freed_[word] |= mask;
+  ++freed_count_;
+  if (word < freed_hint_)
+    freed_hint_ = word;
 }
 
 }
@@ -24,9 +24,12 @@
 #define SRC_ARCH_I586_INCLUDE_MM_FRAME_ALLOCATOR_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <experimental/optional>
 
+#include "mm/alloc_flags.h"
 #include "sys/addressing.h"
+#include "sys/spinlock.h"
 
 using namespace addressing;
 using std::experimental::optional;
@@ -80,8 +83,39 @@ class IFrameAllocator {
 public:
   virtual optional<Frame> Allocate() = 0;
   virtual void Free(Frame f) = 0;
+
+  /**
+   * Allocates a frame, doing only what the flags allow to find one.
+   * Allocators that don't look at the flags keep this default, which fails
+   * anything other than kNone.
+   */
+  virtual optional<Frame> Allocate(alloc::AllocFlags flags) {
+    if (flags != alloc::AllocFlags::kNone)
+      return {};
+    return Allocate();
+  }
+
+  /**
+   * Allocates a run of physically contiguous frames. Allocators that can't
+   * guarantee contiguity keep this default, which always fails.
+   * @param count The number of frames in the run.
+   * @param align The index of the first frame will be a multiple of this.
+   * @return The first frame of the run, or None. Each frame in the run is
+   * released on its own with Free.
+   */
+  virtual optional<Frame> AllocateContiguous(size_t /*count*/,
+                                             size_t /*align*/) {
+    return {};
+  }
 };
 
+/**
+ * The number of frames whose release AreaFrameAllocator can track, enough to
+ * cover the first 1GiB of physical memory. Frames above this are handed out
+ * but are never recycled once freed.
+ */
+const size_t kMaxTrackedFrames = 0x40000000 / kPageSize;
+
 class AreaFrameAllocator : public IFrameAllocator {
 public:
   AreaFrameAllocator(paddress kernelStart, paddress kernelEnd, paddress multibootStart, paddress multibootEnd);
@@ -90,8 +124,38 @@ public:
 
   optional<Frame> Allocate();
 
+  /**
+   * Allocates a frame. kNoWait skips the shrinkers, and only kAtomic may take
+   * the last reserved frames. The allocator's state is guarded by a spinlock,
+   * so it is safe to call from interrupt handlers.
+   */
+  optional<Frame> Allocate(alloc::AllocFlags flags);
+
   void Free(Frame f);
 
+  optional<Frame> AllocateContiguous(size_t count, size_t align);
+
+  /**
+   * Sets the number of frames kept back for kAtomic allocations. Everything
+   * else treats memory as exhausted once only these are left, so the
+   * shrinkers keep them topped up.
+   */
+  inline void set_reserve(size_t frames) { reserve_frames_ = frames; }
+
+  /**
+   * Sets when the registered shrinkers are asked for memory back: whenever
+   * fewer than low frames are free, until there are high.
+   */
+  inline void set_watermarks(size_t low, size_t high) {
+    low_watermark_ = low;
+    high_watermark_ = high;
+  }
+
+  /**
+   * Gets the number of frames that can still be handed out.
+   */
+  inline size_t free_frames() const { return freed_count_ + area_frames_; }
+
 private:
   struct MemoryArea {
     paddress address;
@@ -99,8 +163,50 @@ private:
     MemoryArea() : address(0), size(0) {}
   };
 
+  /**
+   * Hands out the next never-used frame from the registered memory areas.
+   */
+  optional<Frame> AllocateFromArea();
+
+  /**
+   * Hands out a frame that was previously released with Free.
+   */
+  optional<Frame> AllocateFreed();
+
+  /**
+   * Finds an aligned run of frames that were all released with Free.
+   */
+  optional<Frame> AllocateContiguousFreed(size_t count, size_t align);
+
+  /**
+   * Carves an aligned run of frames off the current memory area. Frames
+   * skipped to reach the alignment are released with Free so they aren't lost.
+   */
+  optional<Frame> AllocateContiguousFromArea(size_t count, size_t align);
+
   void ChooseNextArea();
 
+  /**
+   * Takes a frame from the freed ones or the areas, with lock_ held.
+   */
+  optional<Frame> AllocateLocked();
+
+  /**
+   * Releases a frame with lock_ held.
+   */
+  void FreeLocked(Frame f);
+
+  /**
+   * Counts the frames left in the memory areas from next_free_frame_ on.
+   */
+  size_t CountAreaFrames() const;
+
+  /**
+   * Asks the shrinkers for memory if free frames are below the low
+   * watermark.
+   */
+  void CheckWatermark();
+
   Frame next_free_frame_;
   Frame kernel_start_;
   Frame kernel_end_;
@@ -109,6 +215,35 @@ private:
   optional<MemoryArea> current_area_;
   int areas_count_;
   MemoryArea areas_[32];
+
+  /**
+   * One bit per frame, set when the frame has been released with Free.
+   */
+  uint32_t freed_[kMaxTrackedFrames / 32];
+
+  /**
+   * The number of bits currently set in freed_.
+   */
+  size_t freed_count_;
+
+  /**
+   * Index of the lowest word of freed_ that may contain a set bit.
+   */
+  size_t freed_hint_;
+
+  /**
+   * The number of frames the memory areas have yet to hand out.
+   */
+  size_t area_frames_;
+
+  size_t low_watermark_;
+  size_t high_watermark_;
+  size_t reserve_frames_;
+
+  /**
+   * Guards everything above. Shrinkers run without it.
+   */
+  Spinlock lock_;
 };
 
 }
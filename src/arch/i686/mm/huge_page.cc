@@ -0,0 +1,311 @@
+/**
+ * @file huge_page.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/huge_page.h"
+
+#include <cstring>
+
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace paging {
+
+namespace {
+
+/**
+ * The attributes that must match across a table for it to be promoted. They
+ * all carry over to the 4MiB entry.
+ */
+const Entry::Flags kPromotedFlags =
+    Entry::Flags::Writable | Entry::Flags::UserAccessible |
+    Entry::Flags::WriteThrough | Entry::Flags::CacheDisabled |
+    Entry::Flags::Global;
+
+const size_t kHugePageSize = kFramesPerHugePage * kPageSize;
+
+/**
+ * Gets the first page mapped by a page directory entry.
+ */
+inline Page first_page(size_t table) {
+  return Page::ContainingAddress(table * kHugePageSize);
+}
+
+/**
+ * Gets the page the recursive mapping uses to reach a page table.
+ */
+inline Page table_page(size_t table) {
+  return Page::ContainingAddress(0xFFC00000 + table * kPageSize);
+}
+
+/**
+ * The page directory index of the table being copied, or kNoTable.
+ */
+const size_t kNoTable = 1024;
+size_t promoting_table = kNoTable;
+
+} // namespace
+
+bool IsPromoting(Page page) {
+  return page.directory_index() ==
+         __atomic_load_n(&promoting_table, __ATOMIC_ACQUIRE);
+}
+
+HugePagePromoter::HugePagePromoter(size_t first_table, size_t end_table,
+                                   IFrameAllocator &allocator)
+    : allocator_(allocator), first_table_(first_table), end_table_(end_table),
+      cursor_(first_table), promoted_(0), failed_(0) {
+  ASSERT(first_table < end_table && end_table <= kHugePageScratchTable);
+  memset(candidates_, 0, sizeof(candidates_));
+}
+
+bool HugePagePromoter::Step(size_t budget) {
+  for (; budget > 0; --budget) {
+    if (cursor_ >= end_table_) {
+      cursor_ = first_table_;
+      return true;
+    }
+
+    auto table = cursor_++;
+    uint32_t mask = 1u << (table % 32);
+    Entry::Flags flags;
+    if (!IsPromotable(table, flags)) {
+      candidates_[table / 32] &= ~mask;
+      continue;
+    }
+
+    if (!(candidates_[table / 32] & mask)) {
+      // give it another pass to prove it's going to stick around
+      candidates_[table / 32] |= mask;
+      continue;
+    }
+
+    candidates_[table / 32] &= ~mask;
+    Promote(table, flags);
+  }
+  return false;
+}
+
+void HugePagePromoter::Run() {
+  while (!Step(end_table_ - first_table_))
+    continue;
+}
+
+bool HugePagePromoter::IsPromotable(size_t table, Entry::Flags &flags) const {
+  auto pt = Directory.page_table(table);
+  if (!pt)
+    return false;
+
+  flags = (*pt)[0].flags() & kPromotedFlags;
+  // device memory is mapped a page at a time for a reason
+  if ((flags & Entry::Flags::CacheDisabled) != Entry::Flags::None)
+    return false;
+
+  for (size_t i = 0; i < kFramesPerHugePage; ++i) {
+    auto &entry = (*pt)[i];
+    if (!entry.is(Entry::Flags::Present) ||
+        (entry.flags() & kPromotedFlags) != flags)
+      return false;
+  }
+  return true;
+}
+
+bool HugePagePromoter::Promote(size_t table, Entry::Flags flags) {
+  auto pt = Directory.page_table(table);
+  auto start = first_page(table);
+
+  // the frames may already be where a 4MiB page needs them
+  auto base = (*pt)[0].pointed_frame()->index();
+  bool in_place = base % kFramesPerHugePage == 0;
+  for (size_t i = 1; in_place && i < kFramesPerHugePage; ++i)
+    in_place = (*pt)[i].pointed_frame()->index() == base + i;
+
+  optional<Frame> block;
+  if (in_place) {
+    block = Frame(base);
+  } else {
+    block = allocator_.AllocateContiguous(kFramesPerHugePage,
+                                          kFramesPerHugePage);
+    if (!block) {
+      ++failed_;
+      return false;
+    }
+  }
+
+  auto page_address = [start](size_t i) {
+    return static_cast<void *>(start.start_address() + i * kPageSize);
+  };
+  auto &scratch = Directory[kHugePageScratchTable];
+  auto window = first_page(kHugePageScratchTable);
+  auto window_address = [window](size_t i) {
+    return static_cast<void *>(window.start_address() + i * kPageSize);
+  };
+
+  // which pages were dirty before the copy, so an abandoned promotion can
+  // put the bits back for swap
+  uint32_t was_dirty[kFramesPerHugePage / 32];
+  if (!in_place) {
+    // copy with interrupts on; anything written meanwhile sets Dirty again
+    // and is copied once more below. Swap has to keep away until the Dirty
+    // bits mean what it expects again.
+    __atomic_store_n(&promoting_table, table, __ATOMIC_RELEASE);
+    memset(was_dirty, 0, sizeof(was_dirty));
+    for (size_t i = 0; i < kFramesPerHugePage; ++i) {
+      auto &entry = (*pt)[i];
+      if (entry.is(Entry::Flags::Dirty)) {
+        was_dirty[i / 32] |= 1u << (i % 32);
+        entry.clear(Entry::Flags::Dirty);
+      }
+      ActivePageDirectory::flush(Page::ContainingAddress(
+          start.start_address() + i * kPageSize));
+    }
+
+    ASSERT(scratch.is_unused());
+    scratch.set(*block, Entry::Flags::Present | Entry::Flags::Writable |
+                            Entry::Flags::Size);
+    ActivePageDirectory::flush(window);
+    memcpy(window_address(0), page_address(0), kHugePageSize);
+  }
+
+  // nothing else may touch the pages between the last copy and the switch
+  bool interrupts = interrupts_enabled();
+  disable_interrupts();
+
+  if (!in_place) {
+    Entry::Flags now;
+    if (!IsPromotable(table, now) || now != flags) {
+      // part of the table was remapped while we copied
+      pt = Directory.page_table(table);
+      for (size_t i = 0; pt && i < kFramesPerHugePage; ++i) {
+        if ((was_dirty[i / 32] & (1u << (i % 32))) &&
+            (*pt)[i].is(Entry::Flags::Present))
+          (*pt)[i].mark(Entry::Flags::Dirty);
+      }
+      __atomic_store_n(&promoting_table, kNoTable, __ATOMIC_RELEASE);
+      scratch.set_unused();
+      ActivePageDirectory::flush(window);
+      if (interrupts)
+        enable_interrupts();
+      for (size_t i = 0; i < kFramesPerHugePage; ++i)
+        allocator_.Free(*block + i);
+      return false;
+    }
+
+    for (size_t i = 0; i < kFramesPerHugePage; ++i) {
+      if ((*pt)[i].is(Entry::Flags::Dirty))
+        memcpy(window_address(i), page_address(i), kPageSize);
+    }
+    scratch.set_unused();
+    ActivePageDirectory::flush(window);
+  }
+
+  // give back everything the table was using before it disappears from the
+  // recursive mapping
+  auto table_frame = *Directory[table].pointed_frame();
+  if (!in_place) {
+    for (size_t i = 0; i < kFramesPerHugePage; ++i)
+      allocator_.Free(*(*pt)[i].pointed_frame());
+  }
+
+  Directory[table].set(*block, flags | Entry::Flags::Present |
+                                   Entry::Flags::Size);
+  // invlpg, unlike reloading CR3, also drops Global translations
+  for (size_t i = 0; i < kFramesPerHugePage; ++i)
+    ActivePageDirectory::flush(Page::ContainingAddress(
+        start.start_address() + i * kPageSize));
+  ActivePageDirectory::flush(table_page(table));
+  __atomic_store_n(&promoting_table, kNoTable, __ATOMIC_RELEASE);
+
+  if (interrupts)
+    enable_interrupts();
+  allocator_.Free(table_frame);
+  ++promoted_;
+  return true;
+}
+
+void test_huge_pages(IFrameAllocator &allocator) {
+  ActivePageDirectory page_dir;
+  const uint32_t base = 0x20000000;
+  const size_t table = base / kHugePageSize;
+
+  screen::Writef("huge page test: filling %d pages\n", kFramesPerHugePage);
+  size_t mapped = 0;
+  for (; mapped < kFramesPerHugePage; ++mapped) {
+    auto addr = base + mapped * kPageSize;
+    if (!page_dir.map(Page::ContainingAddress(addr), Entry::Flags::Writable,
+                      allocator))
+      break;
+    auto p = reinterpret_cast<uint32_t *>(addr);
+    p[0] = mapped ^ 0x5A5A5A5A;
+    p[kPageSize / sizeof(uint32_t) - 1] = mapped;
+  }
+
+  if (mapped < kFramesPerHugePage) {
+    screen::Writef("  out of memory after %d pages\n", mapped);
+  } else {
+    // the first pass only nominates the table
+    HugePagePromoter promoter(table, table + 1, allocator);
+    promoter.Run();
+    promoter.Run();
+    screen::Writef("  promoted %d, failed %d, 4MiB entry: %s\n",
+                   promoter.promoted(), promoter.failed(),
+                   Directory[table].is(Entry::Flags::Size) ? "yes" : "no");
+
+    size_t bad = 0;
+    for (size_t i = 0; i < kFramesPerHugePage; ++i) {
+      auto p = reinterpret_cast<uint32_t *>(base + i * kPageSize);
+      if (p[0] != (i ^ 0x5A5A5A5A) || p[kPageSize / sizeof(uint32_t) - 1] != i)
+        ++bad;
+    }
+    screen::Writef("  %d pages corrupt\n", bad);
+  }
+
+  // give everything back, as a block of frames if the table was promoted or
+  // else a page at a time followed by the table itself
+  auto &directory_entry = Directory[table];
+  if (directory_entry.is_unused())
+    return;
+  if (directory_entry.is(Entry::Flags::Size)) {
+    auto block = directory_entry.pointed_frame()->index();
+    directory_entry.set_unused();
+    for (size_t i = 0; i < kFramesPerHugePage; ++i) {
+      ActivePageDirectory::flush(
+          Page::ContainingAddress(base + i * kPageSize));
+      allocator.Free(Frame(block + i));
+    }
+  } else {
+    for (size_t i = 0; i < mapped; ++i) {
+      auto page = Page::ContainingAddress(base + i * kPageSize);
+      auto frame = *page_dir.entry(page)->pointed_frame();
+      page_dir.unmap(page, allocator);
+      allocator.Free(frame);
+    }
+    auto table_frame = *directory_entry.pointed_frame();
+    directory_entry.set_unused();
+    ActivePageDirectory::flush(table_page(table));
+    allocator.Free(table_frame);
+  }
+}
+
+} // namespace paging
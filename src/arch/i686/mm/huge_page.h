@@ -0,0 +1,140 @@
+/**
+ * @file huge_page.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Transparently replaces fully populated page tables with 4MiB pages.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_HUGE_PAGE_H_
+#define SRC_ARCH_I586_INCLUDE_MM_HUGE_PAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+#include "mm/paging.h"
+
+namespace paging {
+
+/**
+ * The number of frames in a 4MiB page.
+ */
+const size_t kFramesPerHugePage = 1024;
+
+/**
+ * The page directory entry borrowed while copying into a new 4MiB frame
+ * block. It maps 0xFF800000, just below the recursive mapping.
+ */
+const size_t kHugePageScratchTable = 1022;
+
+/**
+ * Scans a range of the page directory for page tables whose 1024 entries are
+ * all present with the same attributes, and collapses each one into a single
+ * 4MiB (Size) directory entry. If the frames behind a table aren't already an
+ * aligned contiguous block, the pages are copied into one first, with
+ * interrupts on; only the pages dirtied during that copy are copied again
+ * with interrupts off, right before the switch. The old frames and the page
+ * table itself are then given back to the allocator.
+ *
+ * A table has to be seen fully populated on two passes in a row before it is
+ * promoted, so that short-lived mappings aren't worth the copy. 4MiB pages are
+ * never swapped and must not be unmapped a page at a time.
+ */
+class HugePagePromoter {
+public:
+  /**
+   * Creates a new HugePagePromoter instance.
+   * @param first_table The first page directory index to consider.
+   * @param end_table One past the last page directory index to consider.
+   * @param allocator The allocator to get frame blocks from and to give the
+   * replaced frames back to.
+   */
+  HugePagePromoter(size_t first_table, size_t end_table,
+                   IFrameAllocator &allocator);
+
+  /**
+   * Examines up to budget page directory entries, continuing where the
+   * previous call stopped.
+   * @return True if this call finished a pass over the range.
+   */
+  bool Step(size_t budget);
+
+  /**
+   * Runs a complete pass over the range.
+   */
+  void Run();
+
+  /**
+   * Gets the number of page tables that have been promoted.
+   */
+  inline size_t promoted() const { return promoted_; }
+
+  /**
+   * Gets the number of promotions that were abandoned because there was no
+   * contiguous 4MiB block of frames.
+   */
+  inline size_t failed() const { return failed_; }
+
+private:
+  /**
+   * Checks whether every entry of a page table is present with the same
+   * attributes.
+   * @param table The page directory index of the table.
+   * @param[out] flags The attributes shared by all of the entries.
+   */
+  bool IsPromotable(size_t table, Entry::Flags &flags) const;
+
+  /**
+   * Replaces a page table with a 4MiB page.
+   * @return True if the table was promoted.
+   */
+  bool Promote(size_t table, Entry::Flags flags);
+
+  IFrameAllocator &allocator_;
+  size_t first_table_;
+  size_t end_table_;
+  size_t cursor_;
+  size_t promoted_;
+  size_t failed_;
+
+  /**
+   * One bit per page directory entry, set when the table was found promotable
+   * on the previous pass.
+   */
+  uint32_t candidates_[1024 / 32];
+};
+
+/**
+ * Checks whether a page's table is being copied into a 4MiB page. Its Dirty
+ * bits are borrowed for the copy, so swap must not evict it until then.
+ */
+bool IsPromoting(Page page);
+
+/**
+ * Fills a 4MiB-aligned run of 4KiB pages, promotes it, and checks that the
+ * contents survived the move. Everything is unmapped and freed at the end.
+ * @param allocator The frame allocator backing the pages.
+ */
+void test_huge_pages(IFrameAllocator &allocator);
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_HUGE_PAGE_H_
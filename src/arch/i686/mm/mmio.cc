@@ -0,0 +1,89 @@
+/**
+ * @file mmio.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/mmio.h"
+
+namespace paging {
+
+namespace {
+
+/**
+ * Gets the number of pages a physical range touches.
+ */
+inline size_t PageCount(paddress start, size_t size) {
+  auto offset = static_cast<uint32_t>(start % kPageSize);
+  return (offset + size + kPageSize - 1) / kPageSize;
+}
+
+} // namespace
+
+void *MapPhysical(paddress start, size_t size, VirtualRangeAllocator &ranges,
+                  IFrameAllocator &allocator) {
+  auto pages = PageCount(start, size);
+  auto first = ranges.Allocate(pages);
+  if (!first)
+    return nullptr;
+
+  ActivePageDirectory page_dir;
+  auto frame = Frame::ContainingAddress(start);
+  auto flags = Entry::Flags::Writable | Entry::Flags::CacheDisabled |
+               Entry::Flags::WriteThrough;
+  for (size_t i = 0; i < pages; ++i) {
+    auto page =
+        Page::ContainingAddress(first->start_address() + i * kPageSize);
+    if (!page_dir.map_to(page, frame + i, flags, allocator)) {
+      // undo the pages we already mapped
+      for (size_t j = 0; j < i; ++j) {
+        page_dir.unmap(Page::ContainingAddress(first->start_address() +
+                                               j * kPageSize),
+                       allocator);
+      }
+      ranges.Free(*first, pages);
+      return nullptr;
+    }
+  }
+
+  auto offset = static_cast<uint32_t>(start % kPageSize);
+  return static_cast<void *>(first->start_address() + offset);
+}
+
+void UnmapPhysical(void *address, size_t size, VirtualRangeAllocator &ranges,
+                   IFrameAllocator &allocator) {
+  auto first = Page::ContainingAddress(address);
+  auto pages = PageCount(
+      static_cast<uint32_t>(reinterpret_cast<uint32_t>(address) % kPageSize),
+      size);
+
+  ActivePageDirectory page_dir;
+  for (size_t i = 0; i < pages; ++i) {
+    page_dir.unmap(
+        Page::ContainingAddress(first.start_address() + i * kPageSize),
+        allocator);
+  }
+  ranges.Free(first, pages);
+}
+
+} // namespace paging
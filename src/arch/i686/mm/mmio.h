@@ -0,0 +1,88 @@
+/**
+ * @file mmio.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Mapping device registers and firmware tables that live outside the memory
+ * the kernel owns.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_MMIO_H_
+#define SRC_ARCH_I586_INCLUDE_MM_MMIO_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+#include "mm/paging.h"
+#include "mm/virtual_range.h"
+
+namespace paging {
+
+/**
+ * Maps a range of physical memory into the kernel's address space with
+ * caching disabled. The frames aren't taken from the frame allocator; they
+ * belong to a device or the firmware.
+ * @param start The physical address of the first byte.
+ * @param size The number of bytes to map.
+ * @param ranges Where to find the virtual addresses.
+ * @param allocator Provides frames for any page tables that are needed.
+ * @return The virtual address of start, or nullptr if it couldn't be
+ * mapped.
+ */
+void *MapPhysical(paddress start, size_t size, VirtualRangeAllocator &ranges,
+                  IFrameAllocator &allocator);
+
+/**
+ * Removes a mapping made by MapPhysical.
+ * @param address The address MapPhysical returned.
+ * @param size The size it was given.
+ * @param ranges The allocator the addresses came from.
+ * @param allocator The allocator given to MapPhysical.
+ */
+void UnmapPhysical(void *address, size_t size, VirtualRangeAllocator &ranges,
+                   IFrameAllocator &allocator);
+
+/**
+ * Reads a 32-bit device register.
+ * @param base The mapped base of the device's registers.
+ * @param offset The register's offset in bytes.
+ */
+inline uint32_t mmio_read(volatile void *base, size_t offset) {
+  return *reinterpret_cast<volatile uint32_t *>(
+      static_cast<volatile uint8_t *>(base) + offset);
+}
+
+/**
+ * Writes a 32-bit device register.
+ * @param base The mapped base of the device's registers.
+ * @param offset The register's offset in bytes.
+ * @param value The value to write.
+ */
+inline void mmio_write(volatile void *base, size_t offset, uint32_t value) {
+  *reinterpret_cast<volatile uint32_t *>(static_cast<volatile uint8_t *>(base) +
+                                         offset) = value;
+}
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_MMIO_H_
@@ -1,83 +1,90 @@
-// /**
-//  * @file page_allocator.cc
-//  *
-//  * @section LICENSE
-//  *
-//  * Copyright (C) 2013  Ryan Bunker
-//  *
-//  * This program is free software: you can redistribute it and/or modify
-//  * it under the terms of the GNU General Public License as published by
-//  * the Free Software Foundation, either version 3 of the License, or
-//  * (at your option) any later version.
-//  *
-//  * This program is distributed in the hope that it will be useful,
-//  * but WITHOUT ANY WARRANTY; without even the implied warranty of
-//  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-//  * GNU General Public License for more details.
-//  *
-//  * You should have received a copy of the GNU General Public License
-//  * along with this program.  If not, see [http://www.gnu.org/licenses/].
-//  *
-//  * @section DESCRIPTION
-//  *
-//  */
-
-// #include "mm/page_allocator.h"
-
-// #include <cstring>
-
-// namespace paging {
-
-// PageAllocator *PageAllocator::instance_ = nullptr;
-
-// PageAllocator::PageAllocator(size_t memory_available)
-//     : free_pages_(0), last_freed_index_(0) {
-//   page_count_ = memory_available / kPageSize;
-//   pages_ = new Page[page_count_];
-//   memset(pages_, 0, sizeof(Page) * page_count_);
-//   for (uint32_t i = 0; i < page_count_; i++)
-//     pages_[i].index = i;
-// }
-
-// PageAllocator::~PageAllocator() { delete[] pages_; }
-
-// Page *PageAllocator::AllocatePages(int count) {
-//   Page *free_page = nullptr;
-//   uint32_t i = last_freed_index_;
-//   do {
-//     if (pages_[i].available) {
-//       // we found a free page so begin looping to see if there are 'count' free
-//       // pages here
-//       uint32_t j = i + 1;
-//       for (; j < i + count; j++)
-//         if (!pages_[j].available)
-//           break;
-//       if (j == i + count)
-//         // count pages are free so return them
-//         free_page = pages_ + i;
-//       else
-//         // count pages not free..start looking again
-//         i = j;
-//     }
-
-//     if (++i >= page_count_)
-//       i = 0;
-//   } while (!free_page && i != last_freed_index_);
-
-//   if (free_page) {
-//     // we found a set of free pages, so mark them all used
-//     for (int i = 0; i < count; ++i)
-//       free_page[i].available = false;
-//   }
-
-//   return free_page;
-// }
-
-// void PageAllocator::FreePage(Page &page) {
-//   page.available = true;
-//   page.virtual_address = nullptr;
-//   last_freed_index_ = page.index;
-//   ++free_pages_;
-// }
-
-// } // namespace paging
+/**
+ * @file page_allocator.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/page_allocator.h"
+
+#include <new>
+
+#include "mm/paging.h"
+#include "sys/kernel.h"
+
+namespace paging {
+
+namespace {
+
+// the instance lives here since there is no heap when it is created
+alignas(PageAllocator) unsigned char instance_memory[sizeof(PageAllocator)];
+
+} // namespace
+
+PageAllocator *PageAllocator::instance_ = nullptr;
+
+void PageAllocator::InitSingleton(VirtualRangeAllocator &ranges,
+                                  IFrameAllocator &frames,
+                                  IPageMapper &mapper) {
+  ASSERT(!instance_);
+  instance_ = new (instance_memory) PageAllocator(ranges, frames, mapper);
+}
+
+PageAllocator::PageAllocator(VirtualRangeAllocator &ranges,
+                             IFrameAllocator &frames, IPageMapper &mapper)
+    : ranges_(ranges), frames_(frames), mapper_(mapper), used_pages_(0) {}
+
+void *PageAllocator::AllocatePages(size_t count, size_t align) {
+  auto first = ranges_.Allocate(count, align);
+  if (!first)
+    return nullptr;
+
+  for (size_t i = 0; i < count; ++i) {
+    auto frame = frames_.Allocate();
+    auto page =
+        Page::ContainingAddress(first->start_address() + i * kPageSize);
+    if (!frame || !mapper_.Map(page, *frame, Entry::Flags::Writable, frames_)) {
+      if (frame)
+        frames_.Free(*frame);
+      Unmap(*first, i);
+      ranges_.Free(*first, count);
+      return nullptr;
+    }
+  }
+
+  used_pages_ += count;
+  return static_cast<void *>(first->start_address());
+}
+
+void PageAllocator::FreePages(void *address, size_t count) {
+  auto first = Page::ContainingAddress(address);
+  Unmap(first, count);
+  ranges_.Free(first, count);
+  used_pages_ -= count;
+}
+
+void PageAllocator::Unmap(Page first, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    auto page = Page::ContainingAddress(first.start_address() + i * kPageSize);
+    frames_.Free(mapper_.Unmap(page, frames_));
+  }
+}
+
+} // namespace paging
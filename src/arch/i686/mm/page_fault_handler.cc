@@ -26,22 +26,39 @@
 
 #include <cstdint>
 
+#include "mm/swap.h"
+#include "mm/user_copy.h"
 #include "sys/kernel.h"
 #include "video/text_screen.h"
 
-void paging::PageFaultHandler::Handle(isr::Registers regs) {
+isr::HandlerResult paging::PageFaultHandler::Handle(isr::Registers *regs) {
   // A page fault has occurred.
   // The faulting address is stored in the CR2 register.
   uint32_t faulting_address;
   asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
 
   // The error code gives us details of what happened.
-  int present = !(regs.err_code & 0x1); // Page not present.
-  int rw = regs.err_code & 0x2;         // Write operation?
-  int us = regs.err_code & 0x4;         // Processor was in user-mode?
+  int present = !(regs->err_code & 0x1); // Page not present.
+  int rw = regs->err_code & 0x2;         // Write operation?
+  int us = regs->err_code & 0x4;         // Processor was in user-mode?
   // Overwritten CPU-reserved bits of page entry?
-  int rsrvd = regs.err_code & 0x8;
-  int id = regs.err_code & 0x10; // Caused by instruction fetch?
+  int rsrvd = regs->err_code & 0x8;
+  int id = regs->err_code & 0x10; // Caused by instruction fetch?
+
+  // The page may just have been written out to swap, in which case we bring
+  // it back in and let the instruction retry.
+  if (present && swap_ && swap_->SwapIn(faulting_address))
+    return isr::HandlerResult::kHandled;
+
+  // Otherwise, if the kernel was copying to or from user space, the copy
+  // routine has a fixup that reports the failure to its caller.
+  if (!us) {
+    auto fixup = SearchExceptionTable(regs->eip);
+    if (fixup) {
+      regs->eip = fixup;
+      return isr::HandlerResult::kHandled;
+    }
+  }
 
   // Output an error message
   screen::Write("Page fault! (");
@@ -60,8 +77,9 @@ void paging::PageFaultHandler::Handle(isr::Registers regs) {
   screen::WriteLine("");
 
   screen::Write("eip = ");
-  screen::WriteHex(regs.eip);
+  screen::WriteHex(regs->eip);
   screen::WriteLine("");
 
   PANIC("Page fault");
+  return isr::HandlerResult::kHandled;
 }
@@ -29,15 +29,26 @@
 
 namespace paging {
 
+class SwapSpace;
+
 /**
  * Kernel page fault interrupt handler.
  */
 class PageFaultHandler : public isr::InterruptHandler {
 public:
-  PageFaultHandler() : InterruptHandler(isr::Interrupts::kPageFault) {}
+  PageFaultHandler()
+      : InterruptHandler(isr::Interrupts::kPageFault), swap_(nullptr) {}
+
+  /**
+   * Sets the swap space that not-present faults are resolved from.
+   * @param swap The swap space, or nullptr if swapping is disabled.
+   */
+  inline void set_swap_space(SwapSpace *swap) { swap_ = swap; }
 
 private:
-  virtual void Handle(isr::Registers regs);
+  virtual isr::HandlerResult Handle(isr::Registers *regs);
+
+  SwapSpace *swap_;
 };
 
 } // namespace paging
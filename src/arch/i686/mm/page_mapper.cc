@@ -0,0 +1,52 @@
+/**
+ * @file page_mapper.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/page_mapper.h"
+
+namespace paging {
+
+namespace {
+
+ActivePageMapper active_mapper;
+
+} // namespace
+
+ActivePageMapper &ActivePageMapper::instance() { return active_mapper; }
+
+bool ActivePageMapper::Map(Page page, Frame frame, Entry::Flags flags,
+                           IFrameAllocator &frames) {
+  ActivePageDirectory page_dir;
+  return page_dir.map_to(page, frame, flags, frames);
+}
+
+Frame ActivePageMapper::Unmap(Page page, IFrameAllocator &frames) {
+  ActivePageDirectory page_dir;
+  auto frame = *page_dir.entry(page)->pointed_frame();
+  page_dir.unmap(page, frames);
+  return frame;
+}
+
+} // namespace paging
@@ -0,0 +1,76 @@
+/**
+ * @file page_mapper.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * The page mapping the allocators that manage their own virtual memory
+ * depend on, kept behind an interface so they can run against a fake
+ * address space on the build machine.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_PAGE_MAPPER_H_
+#define SRC_ARCH_I586_INCLUDE_MM_PAGE_MAPPER_H_
+
+#include "mm/frame_allocator.h"
+#include "mm/paging.h"
+
+namespace paging {
+
+/**
+ * Maps and unmaps single pages for KHeap and PageAllocator.
+ */
+class IPageMapper {
+public:
+  /**
+   * Maps an unused page to a frame.
+   * @param frames Where to get a frame for the page table, if it needs one.
+   * @return False if there was no frame for the page table.
+   */
+  virtual bool Map(Page page, Frame frame, Entry::Flags flags,
+                   IFrameAllocator &frames) = 0;
+
+  /**
+   * Unmaps a mapped page.
+   * @return The frame it was mapped to, which is now the caller's to free.
+   */
+  virtual Frame Unmap(Page page, IFrameAllocator &frames) = 0;
+};
+
+/**
+ * Maps pages in the active page directory.
+ */
+class ActivePageMapper : public IPageMapper {
+public:
+  /**
+   * Gets the mapper for the active page directory. It holds no state, so one
+   * instance serves everyone.
+   */
+  static ActivePageMapper &instance();
+
+  virtual bool Map(Page page, Frame frame, Entry::Flags flags,
+                   IFrameAllocator &frames);
+  virtual Frame Unmap(Page page, IFrameAllocator &frames);
+};
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_PAGE_MAPPER_H_
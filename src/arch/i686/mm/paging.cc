@@ -32,6 +32,7 @@
 #include "boot/multiboot.h"
 #include "mm/frame_allocator.h"
 #include "mm/page_fault_handler.h"
+#include "mm/user_copy.h"
 #include "sys/kernel.h"
 #include "video/text_screen.h"
 
@@ -74,6 +75,12 @@ void Entry::set(Frame frame, Flags flags) {
   entry_ = static_cast<uint32_t>(frame.start_address()) | static_cast<uint32_t>(flags);
 }
 
+void Entry::set_swapped(uint32_t slot, Flags flags) {
+  ASSERT(slot < (1u << 20));
+  auto kept = flags & (Flags::Writable | Flags::UserAccessible);
+  entry_ = (slot << 12) | static_cast<uint32_t>(kept | Flags::Swapped);
+}
+
 void Table::zero() {
   for (int i=0; i<1024; ++i)
     entries_[i].set_unused();
@@ -109,9 +116,18 @@ PageTable* const PageDirectory::page_table_create(unsigned int index, IFrameAllo
     // screen::Writef("   page table %d already exists\n", index);
     return nxtTab;
   }
-  auto frame = *allocator.Allocate();
-  // screen::Writef("   using frame %d as page table\n", frame.index());
-  entries_[index].set(frame, Entry::Flags::Present | Entry::Flags::Writable);
+  // a 4MiB page would be silently thrown away
+  ASSERT(!entries_[index].is(Entry::Flags::Present | Entry::Flags::Size));
+  auto frame = allocator.Allocate();
+  if (!frame)
+    return nullptr;
+  // screen::Writef("   using frame %d as page table\n", frame->index());
+  // tables below the kernel may hold user pages; the pages themselves
+  // decide, since the processor wants the bit set at both levels
+  auto flags = Entry::Flags::Present | Entry::Flags::Writable;
+  if (index < (kUserSpaceEnd >> 22))
+    flags = flags | Entry::Flags::UserAccessible;
+  entries_[index].set(*frame, flags);
   auto table = page_table(index);
   table->zero();
   return table;
@@ -153,16 +169,25 @@ optional<paddress> ActivePageDirectory::translate(vaddress virtual_address) cons
   return {};
 }
 
-void ActivePageDirectory::map_to(Page page, Frame frame, Entry::Flags flags, IFrameAllocator& allocator) {
+bool ActivePageDirectory::map_to(Page page, Frame frame, Entry::Flags flags, IFrameAllocator& allocator) {
   auto pt = directory_->page_table_create(page.directory_index(), allocator);
+  if (!pt)
+    return false;
   ASSERT((*pt)[page.table_index()].is_unused());
   // screen::Writef("   pt: %p, index: %d\n", pt, page.table_index());
   (*pt)[page.table_index()].set(frame, flags | Entry::Flags::Present);
+  return true;
 }
 
-void ActivePageDirectory::map(Page page, Entry::Flags flags, IFrameAllocator& allocator) {
-  auto frame = *allocator.Allocate();
-  map_to(page, frame, flags, allocator);
+bool ActivePageDirectory::map(Page page, Entry::Flags flags, IFrameAllocator& allocator) {
+  auto frame = allocator.Allocate();
+  if (!frame)
+    return false;
+  if (!map_to(page, *frame, flags, allocator)) {
+    allocator.Free(*frame);
+    return false;
+  }
+  return true;
 }
 
 void ActivePageDirectory::identity_map(Frame frame, Entry::Flags flags, IFrameAllocator& allocator) {
@@ -181,11 +206,17 @@ void ActivePageDirectory::unmap(Page page, IFrameAllocator& allocator) {
   // screen::Writef("   mapped frame %d (starts at 0x%x)\n", frame->index(), frame->start_address());
   // screen::Writef("   pt: %p\n", pt);
   (*pt)[page.table_index()].set_unused();
-  void *m = static_cast<void*>(page.start_address());
-  __asm__ volatile ( "invlpg (%0)" : : "b"(m) : "memory" );
+  flush(page);
   //allocator.Free(*frame);
 }
 
+Entry* ActivePageDirectory::entry(Page page) const {
+  auto pt = directory_->page_table(page.directory_index());
+  if (!pt)
+    return nullptr;
+  return &(*pt)[page.table_index()];
+}
+
 void test_paging(IFrameAllocator& allocator) {
   ActivePageDirectory page_dir;
 
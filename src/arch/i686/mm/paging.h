@@ -30,7 +30,6 @@
 #include <cstddef>
 #include <cstdint>
 #include <experimental/optional>
-#include <memory>
 
 #include "mm/frame_allocator.h"
 #include "sys/addressing.h"
@@ -79,6 +78,16 @@ public:
     Dirty = 1 << 6,
     Size = 1 << 7,
     Global = 1 << 8,
+    // Bits 9-11 are ignored by the MMU and are ours to use. Accessed has two
+    // readers, the swap clock and the working set estimator. Whichever of
+    // them clears it hands the use on to the other, and each only ever
+    // clears its own state.
+    // Swapped    - (not present) the page lives in swap slot entry >> 12
+    // Referenced - (present) the estimator cleared Accessed since the swap
+    //              clock last passed
+    // bits 10-11 - (present) working set state, see idle_age()
+    Swapped = 1 << 9,
+    Referenced = 1 << 9,
   };
 
   inline bool is_unused() const { return entry_ == 0; }
@@ -89,16 +98,88 @@ public:
 
   inline bool is(Flags testFlags) const;
 
+  /**
+   * Clears the specified flags, leaving the rest of the entry untouched.
+   */
+  inline void clear(Flags flags) { entry_ &= ~static_cast<uint32_t>(flags); }
+
+  /**
+   * Sets the specified flags, leaving the rest of the entry untouched.
+   */
+  inline void mark(Flags flags) { entry_ |= static_cast<uint32_t>(flags); }
+
   optional<Frame> pointed_frame();
 
   void set(Frame frame, Flags flags);
 
+  /**
+   * Gets the number of consecutive working set samples that found the page
+   * unused, saturating at kMaxIdleAge. A page used since the last sample
+   * reads as 0. Only meaningful for present entries.
+   */
+  inline uint32_t idle_age() const {
+    auto state = sample_state();
+    return state ? state - 1 : 0;
+  }
+
+  /**
+   * Records the age the working set estimator found, which also forgets any
+   * use noted by mark_used.
+   */
+  inline void set_idle_age(uint32_t age) { set_sample_state(age + 1); }
+
+  /**
+   * Gets whether the page was used since the working set estimator last
+   * sampled it, without the estimator seeing the Accessed bit: it was mapped
+   * since, or the swap clock cleared Accessed. Only meaningful for present
+   * entries.
+   */
+  inline bool is_used_since_sample() const { return sample_state() == 0; }
+
+  /**
+   * Notes a use for the working set estimator, when clearing Accessed.
+   */
+  inline void mark_used() { set_sample_state(0); }
+
+  /**
+   * Gets whether the page was written out to swap.
+   */
+  inline bool is_swapped() const;
+
+  /**
+   * Gets the swap slot holding the page's contents. Only valid if
+   * is_swapped() is true.
+   */
+  inline uint32_t swap_slot() const { return entry_ >> 12; }
+
+  /**
+   * Marks the entry as not present with the page's contents in swap.
+   * @param slot The swap slot the page was written to.
+   * @param flags The Writable and UserAccessible flags of the mapping, which
+   * are restored when the page is brought back in.
+   */
+  void set_swapped(uint32_t slot, Flags flags);
+
 private:
+  /**
+   * Bits 10-11: 0 if the page was used since the last sample, else the idle
+   * age plus one. A new mapping starts out as used.
+   */
+  inline uint32_t sample_state() const { return (entry_ >> 10) & 0x3; }
+  inline void set_sample_state(uint32_t state) {
+    entry_ = (entry_ & ~(0x3u << 10)) | ((state & 0x3) << 10);
+  }
+
   uint32_t entry_;
 
   //addressing::paddress const PhysicalAddr();
 };
 
+/**
+ * The largest idle age that fits in an entry, next to the used state.
+ */
+const uint32_t kMaxIdleAge = 2;
+
 inline constexpr Entry::Flags operator|(Entry::Flags lhs, Entry::Flags rhs) {
   return (Entry::Flags)(static_cast<uint32_t>(lhs) |
                                  static_cast<uint32_t>(rhs));
@@ -112,6 +193,10 @@ inline bool Entry::is(Flags testFlags) const {
   return (flags() & testFlags) == testFlags;
 }
 
+inline bool Entry::is_swapped() const {
+  return !is(Flags::Present) && is(Flags::Swapped);
+}
+
 class Table {
 public:
   Entry& operator[](const unsigned int index) { return entries_[index]; }
@@ -130,6 +215,10 @@ class PageDirectory : public Table {
 public:
   PageTable* const page_table(unsigned int index) const;
 
+  /**
+   * Gets a page table, making a new one if it doesn't exist yet.
+   * @return The page table, or nullptr if there was no frame for it.
+   */
   PageTable* const page_table_create(unsigned int index, IFrameAllocator& allocator);
 
 private:
@@ -142,20 +231,46 @@ public:
 
   optional<paddress> translate(vaddress virtual_address) const;
 
-  void map_to(Page page, Frame frame, Entry::Flags flags, IFrameAllocator& allocator);
+  /**
+   * Maps a page to a frame, creating its page table if needed.
+   * @return False if there was no frame for the page table.
+   */
+  bool map_to(Page page, Frame frame, Entry::Flags flags, IFrameAllocator& allocator);
 
-  void map(Page page, Entry::Flags flags, IFrameAllocator& allocator);
+  /**
+   * Maps a page to a newly allocated frame.
+   * @return False if there were no frames.
+   */
+  bool map(Page page, Entry::Flags flags, IFrameAllocator& allocator);
 
   void identity_map(Frame frame, Entry::Flags flags, IFrameAllocator& allocator);
 
   void unmap(Page page, IFrameAllocator& allocator);
 
+  /**
+   * Gets the page table entry that maps a page.
+   * @return The entry, or nullptr if there is no page table for the page.
+   */
+  Entry* entry(Page page) const;
+
+  /**
+   * Removes any stale translation for a page from the TLB. Must be called
+   * after an entry for a mapped page is modified.
+   */
+  static inline void flush(Page page) {
+    void *m = static_cast<void*>(page.start_address());
+    __asm__ volatile ( "invlpg (%0)" : : "b"(m) : "memory" );
+  }
+
 private:
   inline PageDirectory& directory() const { return *directory_; }
 
   optional<Frame> translate_page(Page page) const;
 
-  std::unique_ptr<PageDirectory> directory_;
+  /**
+   * The recursively mapped directory. It isn't ours to free.
+   */
+  PageDirectory *directory_;
 };
 
 extern PageDirectory& Directory;
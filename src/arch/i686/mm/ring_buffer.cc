@@ -0,0 +1,166 @@
+/**
+ * @file ring_buffer.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/ring_buffer.h"
+
+#include <cstring>
+
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace paging {
+
+RingBuffer::RingBuffer() : base_(nullptr), capacity_(0), head_(0), tail_(0) {}
+
+bool RingBuffer::Create(size_t pages, VirtualRangeAllocator &ranges,
+                        IFrameAllocator &allocator) {
+  ASSERT(!base_);
+  ASSERT(pages > 0 && (pages & (pages - 1)) == 0);
+
+  auto first = ranges.Allocate(2 * pages);
+  if (!first)
+    return false;
+
+  ActivePageDirectory page_dir;
+  auto page = [first](size_t i) {
+    return Page::ContainingAddress(first->start_address() + i * kPageSize);
+  };
+
+  // undoes the first count pages of both halves
+  auto unwind = [&](size_t count) {
+    for (size_t j = 0; j < count; ++j) {
+      allocator.Free(*page_dir.entry(page(j))->pointed_frame());
+      page_dir.unmap(page(j), allocator);
+      page_dir.unmap(page(pages + j), allocator);
+    }
+    ranges.Free(*first, 2 * pages);
+  };
+
+  for (size_t i = 0; i < pages; ++i) {
+    auto frame = allocator.Allocate();
+    if (!frame) {
+      unwind(i);
+      return false;
+    }
+    if (!page_dir.map_to(page(i), *frame, Entry::Flags::Writable,
+                         allocator)) {
+      allocator.Free(*frame);
+      unwind(i);
+      return false;
+    }
+    if (!page_dir.map_to(page(pages + i), *frame, Entry::Flags::Writable,
+                         allocator)) {
+      page_dir.unmap(page(i), allocator);
+      allocator.Free(*frame);
+      unwind(i);
+      return false;
+    }
+  }
+
+  base_ = static_cast<uint8_t *>(static_cast<void *>(first->start_address()));
+  capacity_ = pages * kPageSize;
+  head_ = tail_ = 0;
+  return true;
+}
+
+void RingBuffer::Destroy(VirtualRangeAllocator &ranges,
+                         IFrameAllocator &allocator) {
+  ASSERT(base_);
+  ActivePageDirectory page_dir;
+  auto first = Page::ContainingAddress(base_);
+  auto pages = capacity_ / kPageSize;
+  for (size_t i = 0; i < pages; ++i) {
+    auto page = Page::ContainingAddress(first.start_address() + i * kPageSize);
+    auto mirror = Page::ContainingAddress(page.start_address() + capacity_);
+    allocator.Free(*page_dir.entry(page)->pointed_frame());
+    page_dir.unmap(page, allocator);
+    page_dir.unmap(mirror, allocator);
+  }
+  ranges.Free(first, 2 * pages);
+  base_ = nullptr;
+  capacity_ = 0;
+}
+
+void RingBuffer::Commit(size_t count) {
+  ASSERT(count <= space());
+  __atomic_store_n(&head_, head_ + count, __ATOMIC_RELEASE);
+}
+
+void RingBuffer::Consume(size_t count) {
+  ASSERT(count <= size());
+  __atomic_store_n(&tail_, tail_ + count, __ATOMIC_RELEASE);
+}
+
+size_t RingBuffer::Write(const void *data, size_t count) {
+  if (count > space())
+    count = space();
+  memcpy(write_pointer(), data, count);
+  Commit(count);
+  return count;
+}
+
+size_t RingBuffer::Read(void *data, size_t count) {
+  if (count > size())
+    count = size();
+  memcpy(data, read_pointer(), count);
+  Consume(count);
+  return count;
+}
+
+void test_ring_buffer(VirtualRangeAllocator &ranges,
+                      IFrameAllocator &allocator) {
+  RingBuffer ring;
+  if (!ring.Create(1, ranges, allocator)) {
+    screen::WriteLine("ring buffer test: out of memory");
+    return;
+  }
+  screen::Writef("ring buffer test: %d bytes at 0x%p\n", ring.capacity(),
+                 ring.read_pointer());
+
+  // the chunks don't divide the buffer evenly, so some of them straddle the
+  // wrap point
+  uint8_t chunk[1000];
+  size_t bad = 0;
+  for (int round = 0; round < 10; ++round) {
+    for (size_t i = 0; i < sizeof(chunk); ++i)
+      chunk[i] = static_cast<uint8_t>(round * 7 + i);
+    ring.Write(chunk, sizeof(chunk));
+
+    uint8_t back[sizeof(chunk)];
+    if (ring.Read(back, sizeof(back)) != sizeof(back) ||
+        memcmp(chunk, back, sizeof(chunk)) != 0)
+      ++bad;
+  }
+
+  // the same byte seen through both mappings
+  auto p = ring.write_pointer();
+  *p = 0x42;
+  if (p[ring.capacity()] != 0x42)
+    ++bad;
+
+  screen::Writef("  %d bad rounds\n", bad);
+  ring.Destroy(ranges, allocator);
+}
+
+} // namespace paging
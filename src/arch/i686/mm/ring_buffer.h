@@ -0,0 +1,148 @@
+/**
+ * @file ring_buffer.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * A byte ring buffer whose memory is mapped twice in a row, so that reads
+ * and writes never have to deal with wrapping around.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_RING_BUFFER_H_
+#define SRC_ARCH_I586_INCLUDE_MM_RING_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+#include "mm/paging.h"
+#include "mm/virtual_range.h"
+
+namespace paging {
+
+/**
+ * A single producer, single consumer byte queue. The frames backing the
+ * buffer are mapped at [base, base + capacity) and again right after it at
+ * [base + capacity, base + 2 * capacity). Starting from any offset, the next
+ * capacity bytes are contiguous in virtual memory, so the free space and the
+ * unread data can always be handed out as a single span.
+ */
+class RingBuffer {
+public:
+  /**
+   * Creates a new RingBuffer instance with no memory. Call Create before
+   * using it.
+   */
+  RingBuffer();
+
+  /**
+   * Allocates and double maps the buffer's memory.
+   * @param pages The size of the buffer in pages. Must be a power of two.
+   * @param ranges Where to reserve the virtual addresses.
+   * @param allocator Where to get the frames.
+   * @return True if the buffer is ready to use.
+   */
+  bool Create(size_t pages, VirtualRangeAllocator &ranges,
+              IFrameAllocator &allocator);
+
+  /**
+   * Unmaps the buffer and releases its memory.
+   */
+  void Destroy(VirtualRangeAllocator &ranges, IFrameAllocator &allocator);
+
+  /**
+   * Gets the size of the buffer in bytes.
+   */
+  inline size_t capacity() const { return capacity_; }
+
+  /**
+   * Gets the number of bytes waiting to be read.
+   */
+  inline size_t size() const {
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+  }
+
+  /**
+   * Gets the number of bytes that can be written.
+   */
+  inline size_t space() const { return capacity_ - size(); }
+
+  /**
+   * Gets where the next write goes. space() bytes may be written there
+   * before calling Commit.
+   */
+  inline uint8_t *write_pointer() const {
+    return base_ + (head_ & (capacity_ - 1));
+  }
+
+  /**
+   * Publishes bytes written at write_pointer().
+   */
+  void Commit(size_t count);
+
+  /**
+   * Gets where the next read comes from. size() bytes may be read there
+   * before calling Consume.
+   */
+  inline const uint8_t *read_pointer() const {
+    return base_ + (tail_ & (capacity_ - 1));
+  }
+
+  /**
+   * Releases bytes read from read_pointer().
+   */
+  void Consume(size_t count);
+
+  /**
+   * Copies as much of data as fits into the buffer.
+   * @return The number of bytes written.
+   */
+  size_t Write(const void *data, size_t count);
+
+  /**
+   * Copies up to count bytes out of the buffer.
+   * @return The number of bytes read.
+   */
+  size_t Read(void *data, size_t count);
+
+private:
+  uint8_t *base_;
+  size_t capacity_;
+
+  /**
+   * Total bytes ever written and read. Only their difference and their
+   * values modulo capacity_ matter, so they are free to overflow. Each is
+   * stored with release by its own side and loaded with acquire by the
+   * other, so the bytes it covers are visible before it is.
+   */
+  size_t head_;
+  size_t tail_;
+};
+
+/**
+ * Fills a small ring buffer across its wrap point and checks that a write
+ * through one mapping can be read back through the other.
+ */
+void test_ring_buffer(VirtualRangeAllocator &ranges,
+                      IFrameAllocator &allocator);
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_RING_BUFFER_H_
@@ -0,0 +1,95 @@
+/**
+ * @file shrinker.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/shrinker.h"
+
+namespace paging {
+
+namespace {
+
+/**
+ * The registered shrinkers, cheapest first.
+ */
+Shrinker *shrinkers = nullptr;
+
+/**
+ * Held while the list is changed or walked. It is not a Spinlock because
+ * shrinkers may write to disk and shouldn't run with interrupts off, and
+ * because a shrink that frees or allocates memory mustn't start another one.
+ */
+uint32_t shrinkers_busy = 0;
+
+inline bool TryAcquire() {
+  return !__atomic_exchange_n(&shrinkers_busy, 1, __ATOMIC_ACQUIRE);
+}
+
+inline void Acquire() {
+  while (!TryAcquire())
+    asm volatile("pause");
+}
+
+inline void Release() {
+  __atomic_store_n(&shrinkers_busy, 0, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+void RegisterShrinker(Shrinker &shrinker) {
+  Acquire();
+  auto link = &shrinkers;
+  while (*link && (*link)->cost_ <= shrinker.cost_)
+    link = &(*link)->next_;
+  shrinker.next_ = *link;
+  *link = &shrinker;
+  Release();
+}
+
+void UnregisterShrinker(Shrinker &shrinker) {
+  Acquire();
+  for (auto link = &shrinkers; *link; link = &(*link)->next_) {
+    if (*link == &shrinker) {
+      *link = shrinker.next_;
+      shrinker.next_ = nullptr;
+      break;
+    }
+  }
+  Release();
+}
+
+size_t ShrinkCaches(size_t count) {
+  if (!TryAcquire())
+    return 0;
+
+  size_t released = 0;
+  for (auto shrinker = shrinkers; shrinker && released < count;
+       shrinker = shrinker->next_) {
+    if (shrinker->Count() > 0)
+      released += shrinker->Scan(count - released);
+  }
+
+  Release();
+  return released;
+}
+
+} // namespace paging
@@ -0,0 +1,96 @@
+/**
+ * @file shrinker.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Lets anything holding on to memory it doesn't strictly need give it back
+ * when physical memory runs low.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_SHRINKER_H_
+#define SRC_ARCH_I586_INCLUDE_MM_SHRINKER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace paging {
+
+/**
+ * Something that can give frames back to the frame allocator, e.g. a cache
+ * dropping free objects or swap writing pages out to disk. Shrinkers are
+ * called from inside frame allocation, so they may run in the middle of
+ * whatever allocation ran out.
+ */
+class Shrinker {
+public:
+  /**
+   * Creates a new Shrinker instance.
+   * @param cost How expensive giving frames back is. Cheaper shrinkers are
+   * asked first, and the more expensive ones only if that wasn't enough.
+   */
+  explicit Shrinker(unsigned cost) : cost_(cost), next_(nullptr) {}
+  virtual ~Shrinker() {}
+
+  /**
+   * Estimates how many frames Scan could give back right now. Must be quick
+   * and must not allocate.
+   */
+  virtual size_t Count() = 0;
+
+  /**
+   * Gives frames back to the frame allocator.
+   * @param count The number of frames wanted.
+   * @return The number of frames that were actually released.
+   */
+  virtual size_t Scan(size_t count) = 0;
+
+  inline unsigned cost() const { return cost_; }
+
+private:
+  unsigned cost_;
+  Shrinker *next_;
+
+  friend void RegisterShrinker(Shrinker &shrinker);
+  friend void UnregisterShrinker(Shrinker &shrinker);
+  friend size_t ShrinkCaches(size_t count);
+};
+
+/**
+ * Adds a shrinker to the ones asked for memory when frames run low.
+ */
+void RegisterShrinker(Shrinker &shrinker);
+
+/**
+ * Removes a shrinker, which must be done before it is destroyed.
+ */
+void UnregisterShrinker(Shrinker &shrinker);
+
+/**
+ * Asks the registered shrinkers, cheapest first, for frames until count have
+ * been released or they have nothing left. Only one shrink runs at a time;
+ * calls made while one is running, including from inside a shrinker, get
+ * nothing.
+ * @return The number of frames released.
+ */
+size_t ShrinkCaches(size_t count);
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_SHRINKER_H_
@@ -0,0 +1,315 @@
+/**
+ * @file swap.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/swap.h"
+
+#include <cstring>
+
+#include "mm/huge_page.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace paging {
+
+/**
+ * Pages in the first 768 page directory entries (everything below the kernel
+ * at 0xC0000000) are candidates for swapping. Kernel memory never is.
+ */
+const size_t kSwappablePages = 768 * 1024;
+
+/**
+ * The number of sectors that make up one swap slot.
+ */
+const uint32_t kSectorsPerSlot = kPageSize / dev::kSectorSize;
+
+bool SwapSpace::Probe(dev::BlockDevice &device, uint32_t first_sector) {
+  uint32_t sectors = device.sector_count();
+  if (first_sector >= sectors ||
+      (sectors - first_sector) / kSectorsPerSlot < 1 + kSwapClusterSize)
+    return false;
+
+  uint8_t header[dev::kSectorSize];
+  return device.Read(first_sector, 1, header) &&
+         memcmp(header, kSwapSignature, sizeof(kSwapSignature)) == 0;
+}
+
+SwapSpace::SwapSpace(dev::BlockDevice &device, uint32_t first_sector,
+                     IFrameAllocator &allocator)
+    : Shrinker(kSwapShrinkCost), device_(device),
+      first_sector_(first_sector + kSectorsPerSlot), allocator_(allocator),
+      directory_(), slot_count_(0), used_slots_(0), next_slot_(0),
+      cluster_end_(0), clock_hand_(0) {
+  // the first page holds the signature
+  ASSERT(device.sector_count() > first_sector_);
+  slot_count_ = (device.sector_count() - first_sector_) / kSectorsPerSlot;
+  if (slot_count_ > kMaxSwapSlots)
+    slot_count_ = kMaxSwapSlots;
+  // only hand out whole clusters, it keeps the bookkeeping simple
+  slot_count_ -= slot_count_ % kSwapClusterSize;
+
+  memset(slots_, 0, sizeof(slots_));
+  for (uint32_t i = 0; i < slot_count_ / kSwapClusterSize; ++i)
+    cluster_free_[i] = kSwapClusterSize;
+  for (uint32_t i = 0; i < kSwapCacheSize; ++i)
+    cache_[i].valid = false;
+}
+
+size_t SwapSpace::Count() { return slot_count_ - used_slots_; }
+
+size_t SwapSpace::Scan(size_t count) {
+  size_t reclaimed = 0;
+  while (reclaimed < count) {
+    Page page;
+    auto entry = FindVictim(page);
+    if (!entry || !Evict(page, *entry))
+      break;
+    ++reclaimed;
+  }
+  return reclaimed;
+}
+
+bool SwapSpace::SwapIn(vaddress address) {
+  auto page = Page::ContainingAddress(address);
+  auto entry = directory_.entry(page);
+  if (!entry || !entry->is_swapped())
+    return false;
+
+  auto slot = entry->swap_slot();
+  auto kept = entry->flags() & (Entry::Flags::Writable |
+                                Entry::Flags::UserAccessible);
+  auto frame = allocator_.Allocate();
+  if (!frame)
+    return false;
+
+  // the page has to be writable while we fill it, even if the mapping isn't
+  entry->set(*frame, Entry::Flags::Present | Entry::Flags::Writable);
+  ActivePageDirectory::flush(page);
+  if (!device_.Read(slot_sector(slot), kSectorsPerSlot,
+                    static_cast<void *>(page.start_address()))) {
+    entry->set_swapped(slot, kept);
+    ActivePageDirectory::flush(page);
+    allocator_.Free(*frame);
+    return false;
+  }
+
+  // re-map with the real flags, which also leaves Dirty clear so we can tell
+  // if the copy on disk goes stale
+  entry->set(*frame, Entry::Flags::Present | kept);
+  ActivePageDirectory::flush(page);
+
+  // keep the slot so the page can be dropped for free if it stays clean
+  auto &cached = cache_[frame->index() % kSwapCacheSize];
+  if (cached.valid)
+    FreeSlot(cached.slot);
+  cached.frame = frame->index();
+  cached.page = page.index();
+  cached.slot = slot;
+  cached.valid = true;
+  return true;
+}
+
+void SwapSpace::Release(Page page) {
+  auto entry = directory_.entry(page);
+  if (!entry || entry->is_unused())
+    return;
+
+  if (entry->is_swapped()) {
+    FreeSlot(entry->swap_slot());
+  } else if (entry->is(Entry::Flags::Present)) {
+    auto frame = *entry->pointed_frame();
+    auto &cached = cache_[frame.index() % kSwapCacheSize];
+    if (cached.valid && cached.frame == frame.index() &&
+        cached.page == page.index()) {
+      FreeSlot(cached.slot);
+      cached.valid = false;
+    }
+    allocator_.Free(frame);
+  }
+  entry->set_unused();
+  ActivePageDirectory::flush(page);
+}
+
+Entry *SwapSpace::FindVictim(Page &page) {
+  // two full turns of the clock is enough to find a page that hasn't been
+  // accessed, if there is one at all
+  for (size_t scanned = 0; scanned < 2 * kSwappablePages;) {
+    if (clock_hand_ >= kSwappablePages)
+      clock_hand_ = 0;
+
+    page = Page::ContainingAddress(clock_hand_ * kPageSize);
+    auto entry = directory_.entry(page);
+    if (!entry) {
+      // no page table here, skip the whole 4MiB
+      auto skip = 1024 - page.table_index();
+      clock_hand_ += skip;
+      scanned += skip;
+      continue;
+    }
+
+    ++clock_hand_;
+    ++scanned;
+
+    // device memory must stay where it is, and a table being promoted
+    // stays until its Dirty bits can be trusted again
+    if (!entry->is(Entry::Flags::Present) ||
+        entry->is(Entry::Flags::CacheDisabled) || IsPromoting(page))
+      continue;
+
+    // the working set estimator may have harvested the Accessed bit, in
+    // which case it left Referenced behind for us
+    if (entry->is(Entry::Flags::Accessed)) {
+      // second chance, handing the use on to the working set estimator
+      entry->clear(Entry::Flags::Accessed | Entry::Flags::Referenced);
+      entry->mark_used();
+      ActivePageDirectory::flush(page);
+      continue;
+    }
+    if (entry->is(Entry::Flags::Referenced)) {
+      entry->clear(Entry::Flags::Referenced);
+      continue;
+    }
+
+    return entry;
+  }
+  return nullptr;
+}
+
+bool SwapSpace::Evict(Page page, Entry &entry) {
+  auto frame = *entry.pointed_frame();
+  auto flags = entry.flags();
+
+  auto &cached = cache_[frame.index() % kSwapCacheSize];
+  bool have_copy = cached.valid && cached.frame == frame.index() &&
+                   cached.page == page.index();
+  uint32_t slot;
+  if (have_copy && !entry.is(Entry::Flags::Dirty)) {
+    // the copy in swap is still good, no need to write it again
+    slot = cached.slot;
+    cached.valid = false;
+  } else {
+    if (have_copy) {
+      FreeSlot(cached.slot);
+      cached.valid = false;
+    }
+
+    auto new_slot = AllocateSlot();
+    if (!new_slot)
+      return false;
+    slot = *new_slot;
+    if (!device_.Write(slot_sector(slot), kSectorsPerSlot,
+                       static_cast<void *>(page.start_address()))) {
+      FreeSlot(slot);
+      return false;
+    }
+  }
+
+  entry.set_swapped(slot, flags);
+  ActivePageDirectory::flush(page);
+  allocator_.Free(frame);
+  return true;
+}
+
+optional<uint32_t> SwapSpace::AllocateSlot() {
+  if (used_slots_ == slot_count_)
+    return {};
+
+  // keep going in the current cluster while it has room
+  for (; next_slot_ < cluster_end_; ++next_slot_) {
+    if (slots_[next_slot_ / 32] & (1u << (next_slot_ % 32)))
+      continue;
+    auto slot = next_slot_++;
+    slots_[slot / 32] |= 1u << (slot % 32);
+    --cluster_free_[slot / kSwapClusterSize];
+    ++used_slots_;
+    return slot;
+  }
+
+  // start on the next completely empty cluster after the current one
+  uint32_t clusters = slot_count_ / kSwapClusterSize;
+  uint32_t start = cluster_end_ / kSwapClusterSize;
+  for (uint32_t i = 0; i < clusters; ++i) {
+    uint32_t c = (start + i) % clusters;
+    if (cluster_free_[c] != kSwapClusterSize)
+      continue;
+    next_slot_ = c * kSwapClusterSize;
+    cluster_end_ = next_slot_ + kSwapClusterSize;
+    return AllocateSlot();
+  }
+
+  // swap is too fragmented for clusters, settle for any free slot
+  for (uint32_t c = 0; c < clusters; ++c) {
+    if (cluster_free_[c] == 0)
+      continue;
+    next_slot_ = c * kSwapClusterSize;
+    cluster_end_ = next_slot_ + kSwapClusterSize;
+    return AllocateSlot();
+  }
+
+  PANIC("SwapSpace used slot count is out of sync");
+  return {};
+}
+
+void SwapSpace::FreeSlot(uint32_t slot) {
+  ASSERT(slot < slot_count_);
+  ASSERT(slots_[slot / 32] & (1u << (slot % 32)));
+  slots_[slot / 32] &= ~(1u << (slot % 32));
+  ++cluster_free_[slot / kSwapClusterSize];
+  --used_slots_;
+}
+
+void test_swap(SwapSpace &swap, IFrameAllocator &allocator, size_t pages) {
+  ActivePageDirectory page_dir;
+  const uint32_t base = 0x10000000;
+
+  screen::Writef("swap test: filling %d pages\n", pages);
+  for (size_t i = 0; i < pages; ++i) {
+    auto addr = base + i * kPageSize;
+    if (!page_dir.map(Page::ContainingAddress(addr), Entry::Flags::Writable,
+                      allocator)) {
+      screen::Writef("  out of memory after %d pages\n", i);
+      pages = i;
+      break;
+    }
+    auto p = reinterpret_cast<uint32_t *>(addr);
+    p[0] = i ^ 0xA5A5A5A5;
+    p[kPageSize / sizeof(uint32_t) - 1] = i;
+  }
+  screen::Writef("  %d of %d slots in use\n", swap.used_slots(),
+                 swap.slot_count());
+
+  size_t bad = 0;
+  for (size_t i = 0; i < pages; ++i) {
+    auto p = reinterpret_cast<uint32_t *>(base + i * kPageSize);
+    if (p[0] != (i ^ 0xA5A5A5A5) || p[kPageSize / sizeof(uint32_t) - 1] != i)
+      ++bad;
+  }
+  screen::Writef("  %d pages corrupt, %d slots in use\n", bad,
+                 swap.used_slots());
+
+  for (size_t i = 0; i < pages; ++i)
+    swap.Release(Page::ContainingAddress(base + i * kPageSize));
+  screen::Writef("  released, %d slots in use\n", swap.used_slots());
+}
+
+} // namespace paging
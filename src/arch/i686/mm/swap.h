@@ -0,0 +1,221 @@
+/**
+ * @file swap.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Moves pages out to a block device when physical memory runs out, and brings
+ * them back in when they are touched again.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_SWAP_H_
+#define SRC_ARCH_I586_INCLUDE_MM_SWAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <experimental/optional>
+
+#include "dev/block_device.h"
+#include "mm/frame_allocator.h"
+#include "mm/paging.h"
+#include "mm/shrinker.h"
+
+namespace paging {
+
+/**
+ * The number of consecutive swap slots handed out together. Pages evicted in
+ * the same reclaim pass land next to each other on disk, so the writes are
+ * sequential.
+ */
+const uint32_t kSwapClusterSize = 32;
+
+/**
+ * The largest swap area that is supported, in slots (128MiB).
+ */
+const uint32_t kMaxSwapSlots = 32768;
+
+/**
+ * The number of clean swapped-in pages whose copy on disk is remembered.
+ */
+const uint32_t kSwapCacheSize = 256;
+
+/**
+ * Writing pages to disk is the most expensive way of getting memory back, so
+ * swap is asked after everything else.
+ */
+const unsigned kSwapShrinkCost = 100;
+
+/**
+ * Marks a device (or the part of it starting at some sector) as swap space.
+ * Anything else is never written to. The first page of the area holds the
+ * signature and is not used for slots.
+ */
+const char kSwapSignature[8] = {'D', 'L', 'S', 'S', 'W', 'A', 'P', '1'};
+
+/**
+ * Swaps anonymous pages below the kernel to a block device. Victims are chosen
+ * with the clock (second chance) algorithm driven by the Accessed bit, which
+ * it shares with the working set estimator through Entry::Flags::Referenced,
+ * and pages whose Dirty bit is clear and still have a valid copy on disk are
+ * dropped without being written again.
+ */
+class SwapSpace : public Shrinker {
+public:
+  /**
+   * Checks that a device has been set aside for swap.
+   * @param device The device to check.
+   * @param first_sector The sector that should start with kSwapSignature.
+   * @return True if the signature is there and there is room for at least one
+   * cluster of slots after it.
+   */
+  static bool Probe(dev::BlockDevice &device, uint32_t first_sector);
+
+  /**
+   * Creates a new SwapSpace instance. The device must have passed Probe.
+   * @param device The device to hold swapped out pages.
+   * @param first_sector The sector holding the swap signature. All sectors
+   * after its page are used.
+   * @param allocator The allocator frames are returned to and taken from.
+   */
+  SwapSpace(dev::BlockDevice &device, uint32_t first_sector,
+            IFrameAllocator &allocator);
+
+  /**
+   * Gets the number of free slots, which bounds how many pages can be written
+   * out.
+   */
+  virtual size_t Count();
+
+  /**
+   * Writes out up to count of the least recently used pages and frees their
+   * frames.
+   */
+  virtual size_t Scan(size_t count);
+
+  /**
+   * Brings a page back in from swap. Called from the page fault handler.
+   * @param address The faulting address.
+   * @return True if the page was swapped out and is now present again.
+   */
+  bool SwapIn(vaddress address);
+
+  /**
+   * Unmaps a page below the kernel and frees whatever backs it: its frame if
+   * it is present, its slot if it is swapped out, and the slot still holding
+   * a clean copy of it, if any.
+   * @param page The page to unmap. Nothing happens if it isn't mapped.
+   */
+  void Release(Page page);
+
+  /**
+   * Gets the total number of slots in the swap area.
+   */
+  inline uint32_t slot_count() const { return slot_count_; }
+
+  /**
+   * Gets the number of slots currently holding a page.
+   */
+  inline uint32_t used_slots() const { return used_slots_; }
+
+private:
+  /**
+   * Remembers the slot still holding an up to date copy of a swapped-in page.
+   */
+  struct CachedSlot {
+    uint32_t frame;
+    uint32_t page;
+    uint32_t slot;
+    bool valid;
+  };
+
+  /**
+   * Advances the clock hand to the next page that has not been accessed since
+   * the hand last passed it, clearing Accessed bits along the way.
+   * @param[out] page The page that was chosen.
+   * @return The entry mapping the page, or nullptr if there is nothing that
+   * can be swapped out.
+   */
+  Entry *FindVictim(Page &page);
+
+  /**
+   * Writes a page out (if needed) and releases its frame.
+   * @return True if the page was evicted.
+   */
+  bool Evict(Page page, Entry &entry);
+
+  optional<uint32_t> AllocateSlot();
+  void FreeSlot(uint32_t slot);
+
+  inline uint32_t slot_sector(uint32_t slot) const {
+    return first_sector_ + slot * (kPageSize / dev::kSectorSize);
+  }
+
+  dev::BlockDevice &device_;
+  uint32_t first_sector_;
+  IFrameAllocator &allocator_;
+  ActivePageDirectory directory_;
+
+  uint32_t slot_count_;
+  uint32_t used_slots_;
+
+  /**
+   * One bit per slot, set when the slot is in use.
+   */
+  uint32_t slots_[kMaxSwapSlots / 32];
+
+  /**
+   * The number of free slots in each cluster.
+   */
+  uint16_t cluster_free_[kMaxSwapSlots / kSwapClusterSize];
+
+  /**
+   * The next slot to hand out from the current cluster, and the end of it.
+   */
+  uint32_t next_slot_;
+  uint32_t cluster_end_;
+
+  /**
+   * The index of the page the clock hand is pointing at.
+   */
+  size_t clock_hand_;
+
+  /**
+   * Direct mapped (by frame) cache of clean pages that still have a copy in
+   * swap.
+   */
+  CachedSlot cache_[kSwapCacheSize];
+};
+
+/**
+ * Maps and fills more pages than there is physical memory, checks that every
+ * page reads back intact, then releases them all again. Run under QEMU with a
+ * small -m and a scratch disk image carrying the swap signature attached as
+ * the primary master, e.g.
+ *   qemu-img create -f raw swap.img 64M
+ *   printf DLSSWAP1 | dd of=swap.img conv=notrunc
+ *   qemu-system-i386 -m 8 -cdrom dallas.iso -hda swap.img
+ * @param swap The swap space to exercise.
+ * @param allocator The frame allocator backing the pages.
+ * @param pages The number of pages to touch.
+ */
+void test_swap(SwapSpace &swap, IFrameAllocator &allocator, size_t pages);
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_SWAP_H_
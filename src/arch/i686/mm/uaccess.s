@@ -0,0 +1,70 @@
+/** @file uaccess.s
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Copy loops for moving data to and from user space. Every instruction that
+ * touches a user address has an entry in the exception table, so a fault
+ * lands in a fixup instead of the page fault panic.
+ */
+.code32
+
+// Records that a fault at \insn should resume at \fixup.
+.macro EXTABLE insn, fixup
+  .pushsection .ex_table, "a"
+  .align 4
+  .long \insn, \fixup
+  .popsection
+.endm
+
+.section .text
+
+// size_t user_copy(void *to, const void *from, size_t count)
+// Copies count bytes, a dword at a time and then the leftover bytes. Returns
+// the number of bytes that could not be copied.
+.global user_copy
+user_copy:
+  pushl %esi
+  pushl %edi
+  movl 12(%esp), %edi   // to
+  movl 16(%esp), %esi   // from
+  movl 20(%esp), %ecx   // count
+  cld
+  movl %ecx, %edx
+  andl $3, %edx         // edx = leftover bytes
+  shrl $2, %ecx         // ecx = dwords
+1:
+  rep movsl
+  movl %edx, %ecx
+2:
+  rep movsb
+3:
+  movl %ecx, %eax       // whatever is left in ecx was not copied
+  popl %edi
+  popl %esi
+  ret
+
+// A fault in the dword loop leaves ecx holding the dwords still to go, the
+// leftover bytes weren't started.
+4:
+  leal (%edx,%ecx,4), %ecx
+  jmp 3b
+
+EXTABLE 1b, 4b
+EXTABLE 2b, 3b
@@ -0,0 +1,109 @@
+/**
+ * @file user_copy.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/user_copy.h"
+
+#include "mm/paging.h"
+#include "video/text_screen.h"
+
+/**
+ * Symbols provided by the linker around the exception table.
+ */
+extern const paging::ExceptionTableEntry __start_ex_table[];
+extern const paging::ExceptionTableEntry __stop_ex_table[];
+
+/**
+ * The copy loop, defined in uaccess.s.
+ * @return The number of bytes that were not copied.
+ */
+extern "C" size_t user_copy(void *to, const void *from, size_t count);
+
+namespace paging {
+
+namespace {
+
+/**
+ * Checks that a range lies entirely in user space. This is the only check
+ * made up front, whether the pages are mapped is left to the MMU.
+ */
+inline bool is_user_range(const void *address, size_t count) {
+  auto start = reinterpret_cast<uint32_t>(address);
+  return start < kUserSpaceEnd && count <= kUserSpaceEnd - start;
+}
+
+} // namespace
+
+uint32_t SearchExceptionTable(uint32_t eip) {
+  // only a handful of entries, all from uaccess.s
+  for (auto entry = __start_ex_table; entry != __stop_ex_table; ++entry) {
+    if (entry->instruction == eip)
+      return entry->fixup;
+  }
+  return 0;
+}
+
+size_t CopyFromUser(void *to, const void *from, size_t count) {
+  if (!is_user_range(from, count))
+    return count;
+  return user_copy(to, from, count);
+}
+
+size_t CopyToUser(void *to, const void *from, size_t count) {
+  if (!is_user_range(to, count))
+    return count;
+  return user_copy(to, from, count);
+}
+
+void test_user_copy(IFrameAllocator &allocator) {
+  ActivePageDirectory page_dir;
+  const uint32_t base = 0x30000000;
+  auto page = Page::ContainingAddress(base);
+  page_dir.map(page, Entry::Flags::Writable, allocator);
+
+  char buffer[64];
+  screen::Writef("user copy test: mapped read left %d of %d\n",
+                 CopyFromUser(buffer, reinterpret_cast<const void *>(base),
+                              sizeof(buffer)),
+                 sizeof(buffer));
+
+  // the page after it isn't mapped, so the first access faults
+  auto unmapped = reinterpret_cast<const void *>(base + kPageSize);
+  screen::Writef("  unmapped read left %d of %d\n",
+                 CopyFromUser(buffer, unmapped, sizeof(buffer)),
+                 sizeof(buffer));
+
+  // a copy that runs off the end of the mapping stops at the boundary
+  auto edge = reinterpret_cast<void *>(base + kPageSize - 10);
+  screen::Writef("  copy across the end of a mapping left %d of %d\n",
+                 CopyToUser(edge, buffer, sizeof(buffer)), sizeof(buffer));
+
+  screen::Writef("  kernel address rejected: %s\n",
+                 CopyFromUser(buffer, buffer, sizeof(buffer)) ? "yes" : "no");
+
+  auto frame = *page_dir.entry(page)->pointed_frame();
+  page_dir.unmap(page, allocator);
+  allocator.Free(frame);
+}
+
+} // namespace paging
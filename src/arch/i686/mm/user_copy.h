@@ -0,0 +1,86 @@
+/**
+ * @file user_copy.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Copies data between the kernel and user space without checking the user
+ * pages first. Faults are caught through the exception table instead.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_USER_COPY_H_
+#define SRC_ARCH_I586_INCLUDE_MM_USER_COPY_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+
+namespace paging {
+
+/**
+ * The first address that is not part of user space.
+ */
+const uint32_t kUserSpaceEnd = 0xC0000000;
+
+/**
+ * An instruction allowed to fault, and where to continue if it does. The
+ * entries are collected by the linker between __start_ex_table and
+ * __stop_ex_table.
+ */
+struct ExceptionTableEntry {
+  uint32_t instruction;
+  uint32_t fixup;
+};
+
+/**
+ * Looks up the fixup for a faulting instruction.
+ * @param eip The address of the instruction that faulted.
+ * @return The address to resume at, or 0 if the instruction isn't in the
+ * table.
+ */
+uint32_t SearchExceptionTable(uint32_t eip);
+
+/**
+ * Copies data from user space into the kernel.
+ * @param to The kernel buffer to fill.
+ * @param from The user address to copy from.
+ * @param count The number of bytes to copy.
+ * @return The number of bytes that could not be copied, 0 on success.
+ */
+size_t CopyFromUser(void *to, const void *from, size_t count);
+
+/**
+ * Copies data from the kernel out to user space.
+ * @param to The user address to copy to.
+ * @param from The kernel buffer to copy from.
+ * @param count The number of bytes to copy.
+ * @return The number of bytes that could not be copied, 0 on success.
+ */
+size_t CopyToUser(void *to, const void *from, size_t count);
+
+/**
+ * Checks that a faulting copy reports an error instead of panicking.
+ * @param allocator The frame allocator to map a scratch page with.
+ */
+void test_user_copy(IFrameAllocator &allocator);
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_USER_COPY_H_
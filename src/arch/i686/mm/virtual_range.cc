@@ -0,0 +1,134 @@
+/**
+ * @file virtual_range.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/virtual_range.h"
+
+#include <cstring>
+
+#include "sys/kernel.h"
+
+namespace paging {
+
+VirtualRangeAllocator::VirtualRangeAllocator(vaddress start, size_t pages)
+    : first_page_(Page::ContainingAddress(start).index()), page_count_(pages),
+      free_pages_(pages), hint_(0) {
+  ASSERT(static_cast<size_t>(start) % kPageSize == 0);
+  ASSERT(pages <= kKernelVirtualRangePages);
+  memset(used_, 0, sizeof(used_));
+  memset(run_ends_, 0, sizeof(run_ends_));
+}
+
+optional<Page> VirtualRangeAllocator::Allocate(size_t pages, size_t align) {
+  ASSERT(pages > 0 && align > 0);
+  size_t needed = pages + 1;
+  if (needed > free_pages_)
+    return {};
+
+  // moves an index up to the next one whose page is suitably aligned
+  auto align_up = [this, align](size_t i) {
+    auto page = first_page_ + i;
+    return i + (align - page % align) % align;
+  };
+
+  // first fit
+  for (size_t start = align_up(hint_); start + needed <= page_count_;) {
+    size_t i = start;
+    while (i < start + needed && !is_used(i))
+      ++i;
+    if (i == start + needed) {
+      Mark(start, needed, true);
+      set_run_end(start + pages - 1, true);
+      if (start == hint_)
+        hint_ = start + needed;
+      return Page::ContainingAddress((first_page_ + start) * kPageSize);
+    }
+    start = align_up(i + 1);
+  }
+  return {};
+}
+
+void VirtualRangeAllocator::Free(Page first, size_t pages) {
+  ASSERT(first.index() >= first_page_);
+  size_t start = first.index() - first_page_;
+  ASSERT(start + pages + 1 <= page_count_);
+  ASSERT(is_run_end(start + pages - 1));
+  set_run_end(start + pages - 1, false);
+  Mark(start, pages + 1, false);
+  if (start < hint_)
+    hint_ = start;
+}
+
+bool VirtualRangeAllocator::Resize(Page first, size_t pages,
+                                   size_t new_pages) {
+  ASSERT(first.index() >= first_page_);
+  ASSERT(new_pages > 0);
+  size_t start = first.index() - first_page_;
+  ASSERT(is_run_end(start + pages - 1));
+
+  // the old guard page becomes part of the run, so only what comes after it
+  // (including the new guard page) needs to be free
+  if (new_pages > pages) {
+    if (start + new_pages + 1 > page_count_)
+      return false;
+    for (size_t i = start + pages + 1; i <= start + new_pages; ++i) {
+      if (is_used(i))
+        return false;
+    }
+    Mark(start + pages + 1, new_pages - pages, true);
+  } else if (new_pages < pages) {
+    Mark(start + new_pages + 1, pages - new_pages, false);
+    if (start + new_pages + 1 < hint_)
+      hint_ = start + new_pages + 1;
+  }
+
+  set_run_end(start + pages - 1, false);
+  set_run_end(start + new_pages - 1, true);
+  return true;
+}
+
+size_t VirtualRangeAllocator::RunLength(Page first) const {
+  ASSERT(first.index() >= first_page_);
+  size_t start = first.index() - first_page_;
+  size_t i = start;
+  while (i < page_count_ && !is_run_end(i))
+    ++i;
+  ASSERT(i < page_count_);
+  return i - start + 1;
+}
+
+void VirtualRangeAllocator::Mark(size_t first, size_t count, bool used) {
+  for (size_t i = first; i < first + count; ++i) {
+    ASSERT(is_used(i) != used);
+    if (used)
+      used_[i / 32] |= 1u << (i % 32);
+    else
+      used_[i / 32] &= ~(1u << (i % 32));
+  }
+  if (used)
+    free_pages_ -= count;
+  else
+    free_pages_ += count;
+}
+
+} // namespace paging
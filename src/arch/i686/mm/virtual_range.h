@@ -0,0 +1,138 @@
+/**
+ * @file virtual_range.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Hands out runs of unused virtual pages in the kernel's address space.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_VIRTUAL_RANGE_H_
+#define SRC_ARCH_I586_INCLUDE_MM_VIRTUAL_RANGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <experimental/optional>
+
+#include "mm/paging.h"
+
+namespace paging {
+
+/**
+ * The start of the kernel's dynamically mapped region.
+ */
+const uint32_t kKernelVirtualRangeStart = 0xD0000000;
+
+/**
+ * The size of the kernel's dynamically mapped region, in pages (256MiB).
+ */
+const size_t kKernelVirtualRangePages = 0x10000000 / kPageSize;
+
+/**
+ * Keeps track of which pages of a region of virtual memory are in use. It
+ * only deals in addresses; the caller maps and unmaps the pages.
+ */
+class VirtualRangeAllocator {
+public:
+  /**
+   * Creates a new VirtualRangeAllocator instance.
+   * @param start The first address of the region. Must be page aligned.
+   * @param pages The size of the region in pages, at most
+   * kKernelVirtualRangePages.
+   */
+  VirtualRangeAllocator(vaddress start, size_t pages);
+
+  /**
+   * Reserves a run of pages. Every run is followed by an unused guard page so
+   * that overruns fault instead of landing in a neighbour.
+   * @param pages The number of pages to reserve.
+   * @param align The index of the first page will be a multiple of this.
+   * @return The first page of the run, or None if there is no room.
+   */
+  optional<Page> Allocate(size_t pages, size_t align = 1);
+
+  /**
+   * Releases a run of pages returned by Allocate.
+   * @param first The first page of the run.
+   * @param pages The number of pages that were asked for.
+   */
+  void Free(Page first, size_t pages);
+
+  /**
+   * Grows or shrinks a run returned by Allocate without moving it. Growing
+   * needs the pages after the run's guard page to be free.
+   * @param first The first page of the run.
+   * @param pages The number of pages in the run now.
+   * @param new_pages The number of pages it should have.
+   * @return True if the run was resized.
+   */
+  bool Resize(Page first, size_t pages, size_t new_pages);
+
+  /**
+   * Gets the length of a run returned by Allocate.
+   * @param first The first page of the run.
+   * @return The number of pages that were asked for.
+   */
+  size_t RunLength(Page first) const;
+
+  /**
+   * Gets the number of pages that are not reserved.
+   */
+  inline size_t free_pages() const { return free_pages_; }
+
+private:
+  inline bool is_used(size_t i) const {
+    return (used_[i / 32] & (1u << (i % 32))) != 0;
+  }
+  inline bool is_run_end(size_t i) const {
+    return (run_ends_[i / 32] & (1u << (i % 32))) != 0;
+  }
+  inline void set_run_end(size_t i, bool end) {
+    if (end)
+      run_ends_[i / 32] |= 1u << (i % 32);
+    else
+      run_ends_[i / 32] &= ~(1u << (i % 32));
+  }
+
+  void Mark(size_t first, size_t count, bool used);
+
+  size_t first_page_;
+  size_t page_count_;
+  size_t free_pages_;
+
+  /**
+   * Index of the lowest page that may be free.
+   */
+  size_t hint_;
+
+  /**
+   * One bit per page, set when the page is reserved.
+   */
+  uint32_t used_[kKernelVirtualRangePages / 32];
+
+  /**
+   * One bit per page, set on the last page of each run (not counting its
+   * guard page), so runs can be measured without the caller remembering.
+   */
+  uint32_t run_ends_[kKernelVirtualRangePages / 32];
+};
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_VIRTUAL_RANGE_H_
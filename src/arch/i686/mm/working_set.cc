@@ -0,0 +1,122 @@
+/**
+ * @file working_set.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/working_set.h"
+
+#include <cstring>
+
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace paging {
+
+size_t WorkingSetEstimator::Sample::resident_pages() const {
+  return working_set_pages(kMaxIdleAge);
+}
+
+size_t WorkingSetEstimator::Sample::working_set_pages(uint32_t max_idle) const {
+  size_t pages = 0;
+  for (uint32_t age = 0; age <= max_idle && age <= kMaxIdleAge; ++age)
+    pages += idle_histogram[age];
+  return pages;
+}
+
+WorkingSetEstimator::WorkingSetEstimator(size_t first_page, size_t end_page)
+    : directory_(), first_page_(first_page), end_page_(end_page),
+      cursor_(first_page), passes_(0) {
+  ASSERT(first_page < end_page);
+  ResetPending();
+  memset(&last_, 0, sizeof(last_));
+}
+
+bool WorkingSetEstimator::Step(size_t budget) {
+  while (budget > 0) {
+    if (cursor_ >= end_page_) {
+      last_ = pending_;
+      ++passes_;
+      ResetPending();
+      cursor_ = first_page_;
+      return true;
+    }
+
+    auto page = Page::ContainingAddress(cursor_ * kPageSize);
+    auto entry = directory_.entry(page);
+    if (!entry) {
+      // no page table, skip to the next 4MiB
+      cursor_ += 1024 - page.table_index();
+      --budget;
+      continue;
+    }
+
+    ++cursor_;
+    --budget;
+    if (!entry->is(Entry::Flags::Present) ||
+        entry->is(Entry::Flags::CacheDisabled))
+      continue;
+
+    // the swap clock may have already harvested the Accessed bit, in which
+    // case it marked the page used for us
+    uint32_t age = 0;
+    if (entry->is(Entry::Flags::Accessed)) {
+      // hand the use on to the swap clock, whose second chance it is
+      entry->clear(Entry::Flags::Accessed);
+      entry->mark(Entry::Flags::Referenced);
+      // the TLB remembers that Accessed was set, flush it so the next access
+      // sets it again
+      ActivePageDirectory::flush(page);
+    } else if (!entry->is_used_since_sample()) {
+      age = entry->idle_age();
+      if (age < kMaxIdleAge)
+        ++age;
+    }
+    entry->set_idle_age(age);
+
+    ++pending_.idle_histogram[age];
+    if (age == 0 && pending_.hot_count < kWorkingSetListSize)
+      pending_.hot_pages[pending_.hot_count++] = page.index();
+    else if (age == kMaxIdleAge && pending_.cold_count < kWorkingSetListSize)
+      pending_.cold_pages[pending_.cold_count++] = page.index();
+  }
+  return false;
+}
+
+void WorkingSetEstimator::Run() {
+  while (!Step(end_page_ - first_page_))
+    continue;
+}
+
+void WorkingSetEstimator::Dump() const {
+  screen::Writef("working set after %d passes: %d of %d pages in use\n",
+                 passes_, last_.working_set_pages(),
+                 last_.resident_pages());
+  for (uint32_t age = 0; age <= kMaxIdleAge; ++age)
+    screen::Writef("  idle %d%s: %d pages\n", age,
+                   age == kMaxIdleAge ? "+" : "", last_.idle_histogram[age]);
+}
+
+void WorkingSetEstimator::ResetPending() {
+  memset(&pending_, 0, sizeof(pending_));
+}
+
+} // namespace paging
@@ -0,0 +1,144 @@
+/**
+ * @file working_set.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Estimates which pages of an address space are in active use by sampling
+ * the Accessed bits of its page tables.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_MM_WORKING_SET_H_
+#define SRC_ARCH_I586_INCLUDE_MM_WORKING_SET_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/paging.h"
+
+namespace paging {
+
+/**
+ * The maximum number of pages kept on the hot and cold lists.
+ */
+const size_t kWorkingSetListSize = 64;
+
+/**
+ * Periodically clears and samples the Accessed bit of every present page in a
+ * range of the active address space. Each page's idle age (the number of
+ * samples in a row it went unused) is kept in the spare bits of its page table
+ * entry, so the estimator needs no memory per page and never traps on access.
+ *
+ * Sampling is incremental: call Step from a background context with a small
+ * budget, and the results of the last complete pass are published when the
+ * scan wraps around.
+ */
+class WorkingSetEstimator {
+public:
+  /**
+   * Results of one full pass over the address space.
+   */
+  struct Sample {
+    /**
+     * The number of present pages with each idle age. Bucket 0 holds pages
+     * used since the previous pass, bucket kMaxIdleAge pages idle for at least
+     * that many passes.
+     */
+    size_t idle_histogram[kMaxIdleAge + 1];
+
+    /**
+     * Indexes of pages used since the previous pass.
+     */
+    size_t hot_pages[kWorkingSetListSize];
+    size_t hot_count;
+
+    /**
+     * Indexes of pages that have been idle for kMaxIdleAge passes.
+     */
+    size_t cold_pages[kWorkingSetListSize];
+    size_t cold_count;
+
+    /**
+     * Gets the number of present pages that were seen.
+     */
+    size_t resident_pages() const;
+
+    /**
+     * Gets the number of pages used within the last max_idle + 1 passes.
+     */
+    size_t working_set_pages(uint32_t max_idle = 0) const;
+  };
+
+  /**
+   * Creates a new WorkingSetEstimator instance for a range of pages.
+   * @param first_page Index of the first page to sample.
+   * @param end_page Index one past the last page to sample.
+   */
+  WorkingSetEstimator(size_t first_page, size_t end_page);
+
+  /**
+   * Samples up to budget page table entries, continuing where the previous
+   * call stopped.
+   * @return True if this call completed a pass and published a new sample.
+   */
+  bool Step(size_t budget);
+
+  /**
+   * Runs a complete pass over the range.
+   */
+  void Run();
+
+  /**
+   * Gets the results of the last complete pass.
+   */
+  inline const Sample &last_sample() const { return last_; }
+
+  /**
+   * Gets the number of passes that have completed.
+   */
+  inline size_t passes() const { return passes_; }
+
+  /**
+   * Writes the last sample to the screen.
+   */
+  void Dump() const;
+
+private:
+  void ResetPending();
+
+  ActivePageDirectory directory_;
+  size_t first_page_;
+  size_t end_page_;
+  size_t cursor_;
+  size_t passes_;
+
+  /**
+   * The pass in progress.
+   */
+  Sample pending_;
+
+  /**
+   * The last complete pass.
+   */
+  Sample last_;
+};
+
+} // namespace paging
+
+#endif // SRC_ARCH_I586_INCLUDE_MM_WORKING_SET_H_
@@ -0,0 +1,294 @@
+/**
+ * @file acpi.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "sys/acpi.h"
+
+#include <cstring>
+
+#include "mm/mmio.h"
+#include "sys/addressing.h"
+
+namespace acpi {
+
+namespace {
+
+/**
+ * The Root System Description Pointer. Revision 2 and later add a 64-bit
+ * XSDT address, which a kernel without PAE has no use for.
+ */
+struct Rsdp {
+  char signature[8];
+  uint8_t checksum;
+  char oem_id[6];
+  uint8_t revision;
+  uint32_t rsdt_address;
+} __attribute__((packed));
+
+/**
+ * The header every system description table starts with.
+ */
+struct TableHeader {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} __attribute__((packed));
+
+/**
+ * The fixed part of the MADT, which is followed by variable length entries.
+ */
+struct MadtHeader {
+  TableHeader header;
+  uint32_t local_apic_address;
+  uint32_t flags;
+} __attribute__((packed));
+
+/**
+ * The start of every MADT entry.
+ */
+struct MadtEntry {
+  uint8_t type;
+  uint8_t length;
+} __attribute__((packed));
+
+enum MadtEntryType : uint8_t {
+  kLocalApic = 0,
+  kIoApic = 1,
+  kInterruptOverride = 2,
+  kLocalApicAddressOverride = 5
+};
+
+struct LocalApicEntry {
+  MadtEntry entry;
+  uint8_t processor_id;
+  uint8_t apic_id;
+  uint32_t flags;
+} __attribute__((packed));
+
+struct IoApicEntry {
+  MadtEntry entry;
+  uint8_t id;
+  uint8_t reserved;
+  uint32_t address;
+  uint32_t gsi_base;
+} __attribute__((packed));
+
+struct InterruptOverrideEntry {
+  MadtEntry entry;
+  uint8_t bus;
+  uint8_t source;
+  uint32_t gsi;
+  uint16_t flags;
+} __attribute__((packed));
+
+struct LocalApicAddressOverrideEntry {
+  MadtEntry entry;
+  uint16_t reserved;
+  uint64_t address;
+} __attribute__((packed));
+
+/**
+ * The MADT flag saying there are 8259 PICs as well as the APICs.
+ */
+const uint32_t kPcAtCompatible = 1 << 0;
+
+/**
+ * The local APIC flag saying the processor can be used.
+ */
+const uint32_t kProcessorEnabled = 1 << 0;
+
+/**
+ * Checks that a table's bytes add up to zero.
+ */
+bool IsChecksumValid(const void *table, size_t length) {
+  auto bytes = static_cast<const uint8_t *>(table);
+  uint8_t sum = 0;
+  for (size_t i = 0; i < length; ++i)
+    sum += bytes[i];
+  return sum == 0;
+}
+
+/**
+ * Looks for the RSDP on the 16 byte boundaries of a range of low memory,
+ * which is always mapped.
+ */
+const Rsdp *ScanForRsdp(uint32_t start, size_t length) {
+  auto base = static_cast<const uint8_t *>(
+      static_cast<void *>(addressing::paddress(start).ToVirtual()));
+  for (size_t offset = 0; offset + sizeof(Rsdp) <= length; offset += 16) {
+    auto rsdp = reinterpret_cast<const Rsdp *>(base + offset);
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+        IsChecksumValid(rsdp, sizeof(Rsdp)))
+      return rsdp;
+  }
+  return nullptr;
+}
+
+/**
+ * Finds the RSDP in the first KiB of the EBDA or in the BIOS ROM area.
+ */
+const Rsdp *FindRsdp() {
+  auto ebda_segment = *static_cast<const uint16_t *>(
+      static_cast<void *>(addressing::paddress(0x40E).ToVirtual()));
+  auto rsdp = ScanForRsdp(static_cast<uint32_t>(ebda_segment) << 4, 1024);
+  if (!rsdp)
+    rsdp = ScanForRsdp(0xE0000, 0x20000);
+  return rsdp;
+}
+
+/**
+ * Maps a whole system description table and checks it.
+ * @param address The physical address of the table.
+ * @param length Receives the length of the table, for UnmapTable.
+ * @return The mapped table, or nullptr if it couldn't be mapped or is
+ * corrupt.
+ */
+const TableHeader *MapTable(uint32_t address, size_t &length,
+                            paging::VirtualRangeAllocator &ranges,
+                            paging::IFrameAllocator &allocator) {
+  // map just the header to find out how much there is
+  auto header = static_cast<const TableHeader *>(
+      paging::MapPhysical(address, sizeof(TableHeader), ranges, allocator));
+  if (!header)
+    return nullptr;
+  length = header->length;
+  paging::UnmapPhysical(const_cast<TableHeader *>(header),
+                        sizeof(TableHeader), ranges, allocator);
+  if (length < sizeof(TableHeader))
+    return nullptr;
+
+  auto table = static_cast<const TableHeader *>(
+      paging::MapPhysical(address, length, ranges, allocator));
+  if (table && !IsChecksumValid(table, length)) {
+    paging::UnmapPhysical(const_cast<TableHeader *>(table), length, ranges,
+                          allocator);
+    return nullptr;
+  }
+  return table;
+}
+
+inline void UnmapTable(const TableHeader *table, size_t length,
+                       paging::VirtualRangeAllocator &ranges,
+                       paging::IFrameAllocator &allocator) {
+  paging::UnmapPhysical(const_cast<TableHeader *>(table), length, ranges,
+                        allocator);
+}
+
+/**
+ * Copies what the kernel needs out of a mapped MADT.
+ */
+void ParseMadt(const MadtHeader *table, Madt &madt) {
+  memset(&madt, 0, sizeof(madt));
+  madt.local_apic_address = table->local_apic_address;
+  madt.has_pics = (table->flags & kPcAtCompatible) != 0;
+
+  auto bytes = reinterpret_cast<const uint8_t *>(table);
+  for (size_t offset = sizeof(MadtHeader);
+       offset + sizeof(MadtEntry) <= table->header.length;) {
+    auto entry = reinterpret_cast<const MadtEntry *>(bytes + offset);
+    if (entry->length < sizeof(MadtEntry) ||
+        offset + entry->length > table->header.length)
+      break;
+    offset += entry->length;
+
+    switch (entry->type) {
+    case kLocalApic: {
+      auto local = reinterpret_cast<const LocalApicEntry *>(entry);
+      if ((local->flags & kProcessorEnabled) &&
+          madt.cpu_count < cpu::kMaxCpus)
+        madt.apic_ids[madt.cpu_count++] = local->apic_id;
+      break;
+    }
+    case kIoApic: {
+      auto io = reinterpret_cast<const IoApicEntry *>(entry);
+      if (madt.io_apic_count < kMaxIoApics)
+        madt.io_apics[madt.io_apic_count++] = {io->id, io->address,
+                                               io->gsi_base};
+      break;
+    }
+    case kInterruptOverride: {
+      auto over = reinterpret_cast<const InterruptOverrideEntry *>(entry);
+      // bus 0 is ISA, the only bus overrides are defined for
+      if (over->bus == 0 && madt.override_count < kMaxIrqOverrides)
+        madt.overrides[madt.override_count++] = {over->source, over->gsi,
+                                                 over->flags};
+      break;
+    }
+    case kLocalApicAddressOverride: {
+      auto address =
+          reinterpret_cast<const LocalApicAddressOverrideEntry *>(entry);
+      if (address->address >> 32 == 0)
+        madt.local_apic_address = static_cast<uint32_t>(address->address);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+} // namespace
+
+bool ReadMadt(const void *rsdp_copy, Madt &madt,
+              paging::VirtualRangeAllocator &ranges,
+              paging::IFrameAllocator &allocator) {
+  auto rsdp = static_cast<const Rsdp *>(rsdp_copy);
+  if (!rsdp)
+    rsdp = FindRsdp();
+  if (!rsdp || !IsChecksumValid(rsdp, sizeof(Rsdp)))
+    return false;
+
+  size_t rsdt_length;
+  auto rsdt = MapTable(rsdp->rsdt_address, rsdt_length, ranges, allocator);
+  if (!rsdt)
+    return false;
+
+  // the RSDT is a list of 32-bit physical addresses of the other tables
+  auto entries = reinterpret_cast<const uint32_t *>(rsdt + 1);
+  auto count = (rsdt_length - sizeof(TableHeader)) / sizeof(uint32_t);
+  bool found = false;
+  for (size_t i = 0; i < count && !found; ++i) {
+    size_t length;
+    auto table = MapTable(entries[i], length, ranges, allocator);
+    if (!table)
+      continue;
+    if (memcmp(table->signature, "APIC", 4) == 0 &&
+        length >= sizeof(MadtHeader)) {
+      ParseMadt(reinterpret_cast<const MadtHeader *>(table), madt);
+      found = true;
+    }
+    UnmapTable(table, length, ranges, allocator);
+  }
+  UnmapTable(rsdt, rsdt_length, ranges, allocator);
+  return found && madt.cpu_count > 0;
+}
+
+} // namespace acpi
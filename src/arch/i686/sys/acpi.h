@@ -0,0 +1,125 @@
+/**
+ * @file acpi.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Just enough ACPI table parsing to find the interrupt controllers.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_ACPI_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_ACPI_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+#include "mm/virtual_range.h"
+#include "sys/cpu.h"
+
+namespace acpi {
+
+/**
+ * The most I/O APICs the kernel keeps track of.
+ */
+const size_t kMaxIoApics = 4;
+
+/**
+ * The most interrupt source overrides the kernel keeps track of. There can
+ * only be one for each ISA IRQ.
+ */
+const size_t kMaxIrqOverrides = 16;
+
+/**
+ * An I/O APIC from the MADT.
+ */
+struct IoApicInfo {
+  uint8_t id;
+
+  /**
+   * The physical address of its registers.
+   */
+  uint32_t address;
+
+  /**
+   * The first global system interrupt it handles.
+   */
+  uint32_t gsi_base;
+};
+
+/**
+ * An ISA IRQ that isn't wired to the global system interrupt of the same
+ * number, or isn't edge triggered and active high.
+ */
+struct IrqOverride {
+  uint8_t irq;
+  uint32_t gsi;
+
+  /**
+   * The MPS INTI flags: polarity in bits 0-1, trigger mode in bits 2-3.
+   */
+  uint16_t flags;
+};
+
+/**
+ * What the MADT says about the system's interrupt controllers.
+ */
+struct Madt {
+  /**
+   * The physical address of every processor's local APIC registers.
+   */
+  uint32_t local_apic_address;
+
+  /**
+   * Whether there are 8259 PICs that have to be masked.
+   */
+  bool has_pics;
+
+  /**
+   * The local APIC ids of the enabled processors, boot processor first.
+   */
+  size_t cpu_count;
+  uint8_t apic_ids[cpu::kMaxCpus];
+
+  size_t io_apic_count;
+  IoApicInfo io_apics[kMaxIoApics];
+
+  size_t override_count;
+  IrqOverride overrides[kMaxIrqOverrides];
+};
+
+/**
+ * Finds the MADT through the RSDP and RSDT and reads it. The tables are
+ * only mapped while they are read.
+ * @param rsdp The RSDP the bootloader passed on, or nullptr to search the
+ * BIOS areas for it.
+ * @param madt Receives the contents of the table.
+ * @param ranges Where to map the tables.
+ * @param allocator Provides frames for page tables.
+ * @return False if there is no valid MADT.
+ */
+bool ReadMadt(const void *rsdp, Madt &madt,
+              paging::VirtualRangeAllocator &ranges,
+              paging::IFrameAllocator &allocator);
+
+} // namespace acpi
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_ACPI_H_
@@ -0,0 +1,197 @@
+/**
+ * @file cpu.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "sys/cpu.h"
+
+#include "sys/kernel.h"
+
+extern "C" {
+/**
+ * Loads the GDT register and reloads every segment register with the flat
+ * kernel segments.
+ * @param gdtr The address of the GDT register contents.
+ */
+void gdt_flush(const void *gdtr);
+}
+
+namespace cpu {
+
+namespace {
+
+/**
+ * Represents a segment descriptor in the GDT.
+ */
+struct GDTEntry {
+  uint16_t limit_low;
+  uint16_t base_low;
+  uint8_t base_middle;
+
+  /**
+   * Present, privilege level, type and access bits.
+   */
+  uint8_t access;
+
+  /**
+   * The top four bits of the limit in the low nibble, then the granularity
+   * and operand size flags.
+   */
+  uint8_t granularity;
+  uint8_t base_high;
+} __attribute__((packed));
+
+/**
+ * Represents the contents of the GDT register.
+ */
+struct GDTRegister {
+  uint16_t limit;
+  uint32_t base;
+} __attribute__((packed));
+
+const uint8_t kKernelCodeAccess = 0x9A;
+const uint8_t kKernelDataAccess = 0x92;
+const uint8_t kUserCodeAccess = 0xFA;
+const uint8_t kUserDataAccess = 0xF2;
+
+/**
+ * 4KiB granularity, 32-bit segments.
+ */
+const uint8_t kPageGranular = 0xC0;
+
+/**
+ * Byte granularity, 32-bit segments.
+ */
+const uint8_t kByteGranular = 0x40;
+
+/**
+ * A present, ring 0, available 32-bit TSS.
+ */
+const uint8_t kTssAccess = 0x89;
+
+/**
+ * The per-CPU segments follow the flat ones, and each processor's TSS comes
+ * kMaxCpus entries after its per-CPU segment. The interrupt and system call
+ * stubs rely on that to find the per-CPU segment from the task register.
+ */
+const size_t kFirstPerCpuEntry = 5;
+const size_t kFirstTssEntry = kFirstPerCpuEntry + kMaxCpus;
+
+/**
+ * The task state segment. The kernel doesn't switch tasks with it; it's only
+ * there to give the stack to switch to when ring 3 is interrupted.
+ */
+struct Tss {
+  uint32_t link;
+  uint32_t esp0;
+  uint32_t ss0;
+  uint32_t unused[22];
+  uint16_t trap;
+
+  /**
+   * The offset of the I/O permission bitmap. Pointing it past the end of
+   * the segment means there isn't one, so ring 3 gets no ports.
+   */
+  uint16_t iomap_base;
+} __attribute__((packed));
+
+GDTEntry g_gdt_entries[kFirstTssEntry + kMaxCpus];
+Tss g_tss[kMaxCpus];
+GDTRegister g_gdtr;
+PerCpu g_cpus[kMaxCpus];
+size_t g_online_count = 0;
+
+void GDTSetEntry(size_t number, uint32_t base, uint32_t limit, uint8_t access,
+                 uint8_t granularity) {
+  auto &entry = g_gdt_entries[number];
+  entry.base_low = base & 0xFFFF;
+  entry.base_middle = (base >> 16) & 0xFF;
+  entry.base_high = (base >> 24) & 0xFF;
+  entry.limit_low = limit & 0xFFFF;
+  entry.granularity = ((limit >> 16) & 0x0F) | granularity;
+  entry.access = access;
+}
+
+/**
+ * Gives the calling processor the next PerCpu and points %fs at it.
+ */
+size_t BringOnline() {
+  auto id = __atomic_fetch_add(&g_online_count, 1, __ATOMIC_SEQ_CST);
+  ASSERT(id < kMaxCpus);
+
+  auto &data = g_cpus[id];
+  data.self = &data;
+  data.id = id;
+  GDTSetEntry(kFirstPerCpuEntry + id, reinterpret_cast<uint32_t>(&data),
+              sizeof(PerCpu) - 1, kKernelDataAccess, kByteGranular);
+
+  uint16_t selector = (kFirstPerCpuEntry + id) * sizeof(GDTEntry);
+  asm volatile("movw %0, %%fs" : : "r"(selector));
+
+  auto &tss = g_tss[id];
+  tss.ss0 = kKernelData;
+  tss.iomap_base = sizeof(Tss);
+  GDTSetEntry(kFirstTssEntry + id, reinterpret_cast<uint32_t>(&tss),
+              sizeof(Tss) - 1, kTssAccess, 0);
+  uint16_t tss_selector = (kFirstTssEntry + id) * sizeof(GDTEntry);
+  asm volatile("ltr %0" : : "r"(tss_selector));
+  return id;
+}
+
+} // namespace
+
+void Initialize() {
+  g_gdtr.limit = sizeof(g_gdt_entries) - 1;
+  g_gdtr.base = reinterpret_cast<uint32_t>(&g_gdt_entries);
+
+  GDTSetEntry(0, 0, 0, 0, 0);
+  GDTSetEntry(kKernelCode >> 3, 0, 0xFFFFF, kKernelCodeAccess, kPageGranular);
+  GDTSetEntry(kKernelData >> 3, 0, 0xFFFFF, kKernelDataAccess, kPageGranular);
+  GDTSetEntry(kUserCode >> 3, 0, 0xFFFFF, kUserCodeAccess, kPageGranular);
+  GDTSetEntry(kUserData >> 3, 0, 0xFFFFF, kUserDataAccess, kPageGranular);
+
+  gdt_flush(&g_gdtr);
+  BringOnline();
+
+  // interrupt.s and sysenter.s subtract this from the TSS selector in the
+  // task register to get the per-CPU one, so it is exported to them as an
+  // absolute symbol rather than written out there
+  asm(".global per_cpu_selector_offset\n"
+      ".set per_cpu_selector_offset, %c0"
+      :
+      : "i"((kFirstTssEntry - kFirstPerCpuEntry) * sizeof(GDTEntry)));
+}
+
+size_t InitializeSecondary() {
+  gdt_flush(&g_gdtr);
+  return BringOnline();
+}
+
+void set_kernel_stack(uint32_t top) { g_tss[current_id()].esp0 = top; }
+
+size_t online_count() {
+  return __atomic_load_n(&g_online_count, __ATOMIC_SEQ_CST);
+}
+
+} // namespace cpu
@@ -0,0 +1,112 @@
+/**
+ * @file cpu.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * The global descriptor table and the data each processor keeps for itself.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_CPU_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_CPU_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cpu {
+
+/**
+ * The most processors the kernel will bring online.
+ */
+const size_t kMaxCpus = 8;
+
+/**
+ * Segment selectors of the flat segments in the GDT. The order (kernel code,
+ * kernel data, user code, user data) is the one SYSENTER expects.
+ */
+const uint16_t kKernelCode = 0x08;
+const uint16_t kKernelData = 0x10;
+const uint16_t kUserCode = 0x18 | 3;
+const uint16_t kUserData = 0x20 | 3;
+
+/**
+ * The data belonging to one processor. Each processor's %fs segment is based
+ * at its own PerCpu, so fields can be read with a single %fs relative load
+ * and no lookup.
+ */
+struct PerCpu {
+  /**
+   * Points back at this structure, so its linear address is one load away.
+   */
+  PerCpu *self;
+
+  /**
+   * The processor's index, from 0 to kMaxCpus - 1, in the order they came
+   * online.
+   */
+  size_t id;
+} __attribute__((aligned(64)));
+
+/**
+ * Loads the kernel's GDT and brings the boot processor online. Must run
+ * before anything uses per-CPU data.
+ */
+void Initialize();
+
+/**
+ * Loads the GDT on a secondary processor and gives it its PerCpu.
+ * @return The new processor's id.
+ */
+size_t InitializeSecondary();
+
+/**
+ * Sets the stack the running processor switches to when an interrupt or
+ * exception arrives in ring 3.
+ * @param top The address just past the top of the stack.
+ */
+void set_kernel_stack(uint32_t top);
+
+/**
+ * Gets the number of processors that are online.
+ */
+size_t online_count();
+
+/**
+ * Gets the PerCpu of the processor this runs on.
+ */
+inline PerCpu *current() {
+  PerCpu *self;
+  asm volatile("movl %%fs:0, %0" : "=r"(self));
+  return self;
+}
+
+/**
+ * Gets the id of the processor this runs on.
+ */
+inline size_t current_id() {
+  size_t id;
+  asm volatile("movl %%fs:%c1, %0" : "=r"(id) : "i"(offsetof(PerCpu, id)));
+  return id;
+}
+
+} // namespace cpu
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_CPU_H_
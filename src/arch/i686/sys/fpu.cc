@@ -0,0 +1,326 @@
+/**
+ * @file fpu.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "sys/fpu.h"
+
+#include <cstring>
+
+#include "int/isr.h"
+#include "sys/cpu.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace fpu {
+
+namespace {
+
+/**
+ * Control register bits.
+ */
+const uint32_t kMonitorCoprocessor = 1 << 1; // CR0.MP
+const uint32_t kEmulation = 1 << 2;          // CR0.EM
+const uint32_t kTaskSwitched = 1 << 3;       // CR0.TS
+const uint32_t kOsFxsr = 1 << 9;             // CR4.OSFXSR
+const uint32_t kOsXmmExcept = 1 << 10;       // CR4.OSXMMEXCPT
+
+/**
+ * CPUID leaf 1 edx bits.
+ */
+const uint32_t kHasFxsr = 1 << 24;
+const uint32_t kHasSse = 1 << 25;
+
+/**
+ * MXCSR with every SSE exception masked, its reset value.
+ */
+const uint32_t kDefaultMxcsr = 0x1F80;
+
+/**
+ * The register state of one processor.
+ */
+struct CpuFpu {
+  /**
+   * The state the running context uses.
+   */
+  FpuState *current;
+
+  /**
+   * The state whose values are in the registers, or nullptr if nobody's
+   * are.
+   */
+  FpuState *owner;
+
+  /**
+   * Whether the kernel has the registers for a kernel_fpu_begin section.
+   */
+  bool in_kernel;
+
+  uint32_t switches;
+
+  /**
+   * The state of whatever runs before any context is switched to.
+   */
+  FpuState boot_state;
+};
+
+CpuFpu g_cpus[cpu::kMaxCpus];
+bool g_available = false;
+
+inline uint32_t read_cr0() {
+  uint32_t value;
+  asm volatile("movl %%cr0, %0" : "=r"(value));
+  return value;
+}
+
+inline void write_cr0(uint32_t value) {
+  asm volatile("movl %0, %%cr0" : : "r"(value) : "memory");
+}
+
+inline void set_task_switched() { write_cr0(read_cr0() | kTaskSwitched); }
+
+inline void clear_task_switched() { asm volatile("clts" : : : "memory"); }
+
+inline void Save(FpuState *state) {
+  asm volatile("fxsave %0" : "=m"(state->area) : : "memory");
+  state->valid = true;
+}
+
+inline void Restore(FpuState *state) {
+  if (state->valid) {
+    asm volatile("fxrstor %0" : : "m"(state->area) : "memory");
+  } else {
+    uint32_t mxcsr = kDefaultMxcsr;
+    asm volatile("fninit; ldmxcsr %0" : : "m"(mxcsr) : "memory");
+  }
+}
+
+/**
+ * Saves the owner's registers, if anyone's are loaded.
+ */
+inline void SaveOwner(CpuFpu &fpu) {
+  if (fpu.owner)
+    Save(fpu.owner);
+  fpu.owner = nullptr;
+}
+
+/**
+ * Gives the registers to the current context the first time it uses them
+ * after a switch.
+ */
+class DeviceNotAvailableHandler : public isr::InterruptHandler {
+public:
+  DeviceNotAvailableHandler()
+      : InterruptHandler(isr::Interrupts::kNoCoprocessor) {}
+
+private:
+  virtual isr::HandlerResult Handle(isr::Registers * /*regs*/) {
+    auto &fpu = g_cpus[cpu::current_id()];
+    clear_task_switched();
+    if (fpu.owner != fpu.current) {
+      SaveOwner(fpu);
+      Restore(fpu.current);
+      fpu.owner = fpu.current;
+    }
+    ++fpu.switches;
+    return isr::HandlerResult::kHandled;
+  }
+};
+
+DeviceNotAvailableHandler g_nm_handler;
+
+/**
+ * Turns the units on for the running processor, with TS set so the first
+ * use traps and loads the boot state.
+ */
+void Enable() {
+  write_cr0((read_cr0() | kMonitorCoprocessor) & ~kEmulation);
+  uint32_t cr4;
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  asm volatile("movl %0, %%cr4" : : "r"(cr4 | kOsFxsr | kOsXmmExcept));
+
+  auto &fpu = g_cpus[cpu::current_id()];
+  fpu.current = &fpu.boot_state;
+  fpu.owner = nullptr;
+  set_task_switched();
+}
+
+} // namespace
+
+bool Initialize() {
+  uint32_t regs[4];
+  cpuid(1, regs);
+  if ((regs[3] & (kHasFxsr | kHasSse)) != (kHasFxsr | kHasSse))
+    return false;
+
+  g_available = true;
+  g_nm_handler.RegisterHandler();
+  Enable();
+  return true;
+}
+
+void InitializeSecondary() {
+  if (g_available)
+    Enable();
+}
+
+bool is_available() { return g_available; }
+
+void SwitchTo(FpuState *state) {
+  auto flags = save_and_disable_interrupts();
+  auto &fpu = g_cpus[cpu::current_id()];
+  ASSERT(!fpu.in_kernel);
+  fpu.current = state;
+  // the registers stay loaded, so switching back to their owner costs
+  // nothing
+  if (fpu.owner == state)
+    clear_task_switched();
+  else
+    set_task_switched();
+  restore_interrupts(flags);
+}
+
+void Forget(FpuState *state) {
+  auto flags = save_and_disable_interrupts();
+  for (auto &fpu : g_cpus) {
+    if (fpu.owner == state)
+      fpu.owner = nullptr;
+  }
+  restore_interrupts(flags);
+}
+
+void kernel_fpu_begin() {
+  ASSERT(g_available);
+  auto flags = save_and_disable_interrupts();
+  auto &fpu = g_cpus[cpu::current_id()];
+  ASSERT(!fpu.in_kernel);
+  clear_task_switched();
+  SaveOwner(fpu);
+  fpu.in_kernel = true;
+  restore_interrupts(flags);
+}
+
+void kernel_fpu_end() {
+  auto flags = save_and_disable_interrupts();
+  auto &fpu = g_cpus[cpu::current_id()];
+  ASSERT(fpu.in_kernel);
+  fpu.in_kernel = false;
+  set_task_switched();
+  restore_interrupts(flags);
+}
+
+uint32_t switch_count() { return g_cpus[cpu::current_id()].switches; }
+
+namespace {
+
+inline void WriteXmm0(uint32_t value) {
+  asm volatile("movd %0, %%xmm0" : : "r"(value));
+}
+
+inline uint32_t ReadXmm0() {
+  uint32_t value;
+  asm volatile("movd %%xmm0, %0" : "=r"(value));
+  return value;
+}
+
+/**
+ * Copies 64 bytes at a time through the SSE registers.
+ * @param size A multiple of 64. Both buffers must be 16 byte aligned.
+ */
+void CopySse(void *dst, const void *src, size_t size) {
+  asm volatile("1:\n"
+               "movdqa   (%0), %%xmm0\n"
+               "movdqa 16(%0), %%xmm1\n"
+               "movdqa 32(%0), %%xmm2\n"
+               "movdqa 48(%0), %%xmm3\n"
+               "movdqa %%xmm0,   (%1)\n"
+               "movdqa %%xmm1, 16(%1)\n"
+               "movdqa %%xmm2, 32(%1)\n"
+               "movdqa %%xmm3, 48(%1)\n"
+               "addl $64, %0\n"
+               "addl $64, %1\n"
+               "subl $64, %2\n"
+               "jnz 1b\n"
+               : "+r"(src), "+r"(dst), "+r"(size)
+               :
+               : "memory");
+}
+
+const size_t kCopySize = 16384;
+alignas(16) uint8_t g_copy_src[kCopySize];
+alignas(16) uint8_t g_copy_dst[kCopySize];
+
+} // namespace
+
+void test_fpu() {
+  if (!g_available) {
+    screen::WriteLine("fpu test: no sse");
+    return;
+  }
+
+  // two contexts take turns with xmm0, each trap handing it over
+  FpuState a, b;
+  auto &fpu = g_cpus[cpu::current_id()];
+  auto boot = fpu.current;
+  auto switches = switch_count();
+  size_t bad = 0;
+  SwitchTo(&a);
+  WriteXmm0(0xAAAA);
+  SwitchTo(&b);
+  WriteXmm0(0xBBBB);
+  SwitchTo(&a);
+  bad += ReadXmm0() != 0xAAAA;
+  SwitchTo(&b);
+  bad += ReadXmm0() != 0xBBBB;
+  // switching back to the owner doesn't trap
+  SwitchTo(&b);
+  bad += ReadXmm0() != 0xBBBB;
+  switches = switch_count() - switches;
+  if (switches != 4)
+    ++bad;
+  SwitchTo(boot);
+  Forget(&a);
+  Forget(&b);
+
+  for (size_t i = 0; i < kCopySize; ++i)
+    g_copy_src[i] = static_cast<uint8_t>(i * 7);
+  auto start = read_tsc();
+  memcpy(g_copy_dst, g_copy_src, kCopySize);
+  auto scalar = static_cast<uint32_t>(read_tsc() - start);
+  memset(g_copy_dst, 0, kCopySize);
+  start = read_tsc();
+  kernel_fpu_begin();
+  CopySse(g_copy_dst, g_copy_src, kCopySize);
+  kernel_fpu_end();
+  auto sse = static_cast<uint32_t>(read_tsc() - start);
+  if (memcmp(g_copy_dst, g_copy_src, kCopySize) != 0)
+    ++bad;
+
+  screen::Writef("fpu test: %d lazy switches, %d problems\n", switches, bad);
+  screen::Writef("  copy %d bytes: memcpy %d cycles, sse %d cycles\n",
+                 kCopySize, scalar, sse);
+}
+
+} // namespace fpu
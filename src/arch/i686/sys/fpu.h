@@ -0,0 +1,112 @@
+/**
+ * @file fpu.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * The x87 FPU and SSE units, whose registers are only saved and restored
+ * when a context actually uses them.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_FPU_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_FPU_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fpu {
+
+/**
+ * The FPU and SSE registers of one context, in FXSAVE format.
+ */
+struct alignas(16) FpuState {
+  FpuState() : valid(false) {}
+
+  uint8_t area[512];
+
+  /**
+   * Whether area holds saved registers. A state that was never saved
+   * starts from the registers' reset values.
+   */
+  bool valid;
+};
+
+/**
+ * Enables the FPU and SSE on the boot processor and installs the #NM
+ * handler that switches register state lazily.
+ * @return False if the processor has no SSE or FXSAVE, in which case the
+ * rest of this is unusable.
+ */
+bool Initialize();
+
+/**
+ * Enables the FPU and SSE on a secondary processor.
+ */
+void InitializeSecondary();
+
+/**
+ * Gets whether Initialize found SSE.
+ */
+bool is_available();
+
+/**
+ * Makes a context's state the one the running processor should use. The
+ * registers aren't touched; the processor traps the first time the context
+ * uses them, and only then is the previous owner's state saved and this one
+ * loaded. For the scheduler, on every switch.
+ * @param state The state of the context being switched to.
+ */
+void SwitchTo(FpuState *state);
+
+/**
+ * Forgets a state that is about to be destroyed, so it is never saved to.
+ * @param state The state going away.
+ */
+void Forget(FpuState *state);
+
+/**
+ * Starts a section of kernel code that uses SSE registers. Whatever context
+ * owns the registers has them saved first. Sections don't nest, and
+ * interrupt handlers mustn't use them.
+ */
+void kernel_fpu_begin();
+
+/**
+ * Ends a section started by kernel_fpu_begin. The registers are given back
+ * lazily, the next time the current context uses them.
+ */
+void kernel_fpu_end();
+
+/**
+ * Gets the number of times the running processor has trapped to switch
+ * register state.
+ */
+uint32_t switch_count();
+
+/**
+ * Checks that lazily switched contexts keep their own registers, and
+ * compares an SSE copy against memcpy.
+ */
+void test_fpu();
+
+} // namespace fpu
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_FPU_H_
@@ -58,6 +58,38 @@ inline uint16_t inw(uint16_t port) {
   return ret;
 }
 
+/**
+ * Writes a word value to the specified port.
+ * @param port The port to send data to.
+ * @param value The word to send.
+ */
+inline void outw(uint16_t port, uint16_t value) {
+  asm volatile("outw %1, %0" : : "dN"(port), "a"(value));
+}
+
+/**
+ * Reads a block of words from the specified port using a string instruction.
+ * @param port The port to receive data from.
+ * @param buffer The buffer to place the words into.
+ * @param count The number of words to read.
+ */
+inline void insw(uint16_t port, void *buffer, uint32_t count) {
+  asm volatile("rep insw"
+               : "+D"(buffer), "+c"(count)
+               : "d"(port)
+               : "memory");
+}
+
+/**
+ * Writes a block of words to the specified port using a string instruction.
+ * @param port The port to send data to.
+ * @param buffer The buffer containing the words to send.
+ * @param count The number of words to send.
+ */
+inline void outsw(uint16_t port, const void *buffer, uint32_t count) {
+  asm volatile("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port));
+}
+
 /**
  * Wait for the IO port to be ready.
  */
@@ -73,4 +105,94 @@ inline void enable_interrupts() { asm volatile("sti"); }
  */
 inline void disable_interrupts() { asm volatile("cli"); }
 
+/**
+ * Checks whether interrupts are currently enabled.
+ * @return True if the interrupt flag is set.
+ */
+inline bool interrupts_enabled() {
+  uint32_t flags;
+  asm volatile("pushfl; popl %0" : "=r"(flags));
+  return (flags & 0x200) != 0;
+}
+
+/**
+ * Disables interrupts, remembering whether they were enabled.
+ * @return The flags register from before, for restore_interrupts.
+ */
+inline uint32_t save_and_disable_interrupts() {
+  uint32_t flags;
+  asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+/**
+ * Re-enables interrupts if they were enabled when the flags were saved.
+ * @param flags The value returned by save_and_disable_interrupts.
+ */
+inline void restore_interrupts(uint32_t flags) {
+  if (flags & 0x200)
+    asm volatile("sti" : : : "memory");
+}
+
+/**
+ * Reads the processor's time stamp counter.
+ * @return The number of cycles since reset.
+ */
+inline uint64_t read_tsc() {
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+/**
+ * Divides a 64-bit value by a 32-bit one with two divl instructions, high
+ * half first, so the kernel needs no 64-bit division routine from libgcc.
+ * @return The quotient.
+ */
+inline uint64_t divide64(uint64_t dividend, uint32_t divisor) {
+  uint32_t high, low, remainder;
+  asm("divl %4"
+      : "=a"(high), "=d"(remainder)
+      : "a"(static_cast<uint32_t>(dividend >> 32)), "d"(0), "rm"(divisor));
+  asm("divl %4"
+      : "=a"(low), "=d"(remainder)
+      : "a"(static_cast<uint32_t>(dividend)), "d"(remainder), "rm"(divisor));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+/**
+ * Runs the CPUID instruction.
+ * @param leaf The leaf to query, in eax.
+ * @param regs Receives eax, ebx, ecx and edx, in that order.
+ */
+inline void cpuid(uint32_t leaf, uint32_t regs[4]) {
+  asm volatile("cpuid"
+               : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+               : "a"(leaf), "c"(0));
+}
+
+/**
+ * Reads a model specific register.
+ * @param msr The register number.
+ * @return The register's value.
+ */
+inline uint64_t read_msr(uint32_t msr) {
+  uint32_t lo, hi;
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+/**
+ * Writes a model specific register.
+ * @param msr The register number.
+ * @param value The value to write.
+ */
+inline void write_msr(uint32_t msr, uint64_t value) {
+  asm volatile("wrmsr"
+               :
+               : "c"(msr), "a"(static_cast<uint32_t>(value)),
+                 "d"(static_cast<uint32_t>(value >> 32))
+               : "memory");
+}
+
 #endif // SRC_ARCH_I586_INCLUDE_SYS_IO_H_
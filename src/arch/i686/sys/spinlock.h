@@ -0,0 +1,97 @@
+/**
+ * @file spinlock.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * A simple lock for short critical sections shared between processors.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_SPINLOCK_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_SPINLOCK_H_
+
+#include <cstdint>
+
+#include "sys/io.h"
+
+/**
+ * A test-and-test-and-set spinlock. Interrupts are disabled while it is held
+ * so an interrupt handler on the same processor can't deadlock on it.
+ */
+class Spinlock {
+public:
+  Spinlock() : locked_(0), flags_(0) {}
+
+  inline void Lock() {
+    auto flags = save_and_disable_interrupts();
+    while (__atomic_exchange_n(&locked_, 1, __ATOMIC_ACQUIRE)) {
+      // wait on a plain read so the cache line isn't bounced around
+      while (__atomic_load_n(&locked_, __ATOMIC_RELAXED))
+        asm volatile("pause");
+    }
+    flags_ = flags;
+  }
+
+  /**
+   * Takes the lock only if nobody holds it, including this processor.
+   * @return True if the lock was taken.
+   */
+  inline bool TryLock() {
+    auto flags = save_and_disable_interrupts();
+    if (__atomic_exchange_n(&locked_, 1, __ATOMIC_ACQUIRE)) {
+      restore_interrupts(flags);
+      return false;
+    }
+    flags_ = flags;
+    return true;
+  }
+
+  inline void Unlock() {
+    auto flags = flags_;
+    __atomic_store_n(&locked_, 0, __ATOMIC_RELEASE);
+    restore_interrupts(flags);
+  }
+
+private:
+  uint32_t locked_;
+
+  /**
+   * The interrupt state to go back to when the lock is released.
+   */
+  uint32_t flags_;
+};
+
+/**
+ * Holds a Spinlock for the lifetime of the guard.
+ */
+class SpinlockGuard {
+public:
+  explicit SpinlockGuard(Spinlock &lock) : lock_(lock) { lock_.Lock(); }
+  ~SpinlockGuard() { lock_.Unlock(); }
+
+  SpinlockGuard(const SpinlockGuard &) = delete;
+  SpinlockGuard &operator=(const SpinlockGuard &) = delete;
+
+private:
+  Spinlock &lock_;
+};
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_SPINLOCK_H_
@@ -0,0 +1,222 @@
+/**
+ * @file syscall.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "sys/syscall.h"
+
+#include <cstring>
+
+#include "int/isr.h"
+#include "mm/paging.h"
+#include "sys/cpu.h"
+#include "sys/io.h"
+#include "video/text_screen.h"
+
+namespace syscall {
+
+extern "C" {
+/**
+ * Enters ring 3 at eip with the stack at esp, with interrupts enabled.
+ * Returns once the code there makes the exit system call.
+ * @param saved_esp Where to keep the kernel stack pointer meanwhile.
+ * @return The exit status.
+ */
+uint32_t enter_user(uint32_t eip, uint32_t esp, uint32_t *saved_esp);
+
+/**
+ * Leaves ring 3 for the kernel code that called enter_user, restoring its
+ * registers and interrupt flag.
+ * @param saved_esp The stack pointer enter_user stored.
+ * @param value What enter_user returns.
+ */
+void leave_user(uint32_t saved_esp, uint32_t value);
+
+/**
+ * Where SYSENTER lands.
+ */
+void sysenter_entry();
+
+/// @cond
+extern const uint8_t user_bench_start[];
+extern const uint8_t user_bench_end[];
+/// @endcond
+}
+
+namespace {
+
+/**
+ * The kernel stack pointer each processor had when it last entered ring 3.
+ */
+uint32_t g_user_return[cpu::kMaxCpus];
+
+int32_t SysNull(uint32_t, uint32_t, uint32_t) { return 0; }
+
+int32_t SysExit(uint32_t status, uint32_t, uint32_t) {
+  leave_user(g_user_return[cpu::current_id()], status);
+  return -1;
+}
+
+} // namespace
+
+extern "C" {
+/**
+ * The system calls, indexed by number. sysenter_entry calls through it
+ * directly, so it is plain data with C linkage.
+ */
+extern const SyscallFunction syscall_table[];
+extern const uint32_t syscall_count;
+
+const SyscallFunction syscall_table[] = {SysNull, SysExit};
+const uint32_t syscall_count = sizeof(syscall_table) / sizeof(syscall_table[0]);
+}
+
+namespace {
+
+/**
+ * The SYSENTER model specific registers.
+ */
+const uint32_t kSysenterCs = 0x174;
+const uint32_t kSysenterEsp = 0x175;
+const uint32_t kSysenterEip = 0x176;
+
+/**
+ * CPUID leaf 1 edx bit for SYSENTER/SYSEXIT.
+ */
+const uint32_t kHasSep = 1 << 11;
+
+const size_t kKernelStackSize = 8192;
+
+/**
+ * The stack each processor switches to on entry from ring 3, by SYSENTER or
+ * by an interrupt. Only one of the two can be in use at a time.
+ */
+alignas(16) uint8_t g_kernel_stacks[cpu::kMaxCpus][kKernelStackSize];
+
+bool g_has_sysenter = false;
+
+/**
+ * Runs a system call that came through int 0x80.
+ */
+class SyscallGate : public isr::InterruptHandler {
+public:
+  SyscallGate() : InterruptHandler(isr::Interrupts::kSyscall) {}
+
+private:
+  virtual isr::HandlerResult Handle(isr::Registers *regs) {
+    if (regs->eax < syscall_count)
+      regs->eax = syscall_table[regs->eax](regs->ebx, regs->esi, regs->edi);
+    else
+      regs->eax = static_cast<uint32_t>(-1);
+    return isr::HandlerResult::kHandled;
+  }
+};
+
+SyscallGate g_gate;
+
+/**
+ * Gives the running processor its kernel stack, for both ways in.
+ */
+void Enable() {
+  auto top = reinterpret_cast<uint32_t>(
+      g_kernel_stacks[cpu::current_id()] + kKernelStackSize);
+  cpu::set_kernel_stack(top);
+  if (!g_has_sysenter)
+    return;
+  write_msr(kSysenterCs, cpu::kKernelCode);
+  write_msr(kSysenterEsp, top);
+  write_msr(kSysenterEip, reinterpret_cast<uint32_t>(sysenter_entry));
+}
+
+} // namespace
+
+bool Initialize() {
+  uint32_t regs[4];
+  cpuid(1, regs);
+  // the Pentium Pro reports SEP but has no working SYSENTER
+  auto model = (regs[0] >> 4) & 0xF;
+  auto stepping = regs[0] & 0xF;
+  g_has_sysenter = (regs[3] & kHasSep) &&
+                   !(((regs[0] >> 8) & 0xF) == 6 && model < 3 && stepping < 3);
+
+  g_gate.RegisterHandler();
+  Enable();
+  return g_has_sysenter;
+}
+
+void InitializeSecondary() { Enable(); }
+
+bool has_sysenter() { return g_has_sysenter; }
+
+void benchmark_syscalls(paging::IFrameAllocator &allocator) {
+  using paging::Entry;
+  using paging::Page;
+
+  const uint32_t kCodeBase = 0x40000000;
+  const uint32_t kStackBase = 0x40002000;
+  const uint32_t kIterations = 10000;
+
+  // the code is copied to its own page, since the kernel's aren't user
+  // accessible
+  paging::ActivePageDirectory page_dir;
+  auto flags = Entry::Flags::Writable | Entry::Flags::UserAccessible;
+  auto code_page = Page::ContainingAddress(kCodeBase);
+  auto stack_page = Page::ContainingAddress(kStackBase);
+  if (!page_dir.map(code_page, flags, allocator) ||
+      !page_dir.map(stack_page, flags, allocator)) {
+    screen::WriteLine("syscall benchmark: out of memory");
+    return;
+  }
+  memcpy(reinterpret_cast<void *>(kCodeBase), user_bench_start,
+         user_bench_end - user_bench_start);
+
+  // the user code finds the iteration counts for its two loops on top of
+  // its stack and leaves the timings just above them
+  auto args = reinterpret_cast<uint32_t *>(kStackBase + paging::kPageSize -
+                                           4 * sizeof(uint32_t));
+  args[0] = g_has_sysenter ? kIterations : 0;
+  args[1] = kIterations;
+  args[2] = args[3] = 0;
+  auto status = enter_user(kCodeBase, reinterpret_cast<uint32_t>(args),
+                           &g_user_return[cpu::current_id()]);
+
+  if (g_has_sysenter) {
+    screen::Writef("null syscall: %d cycles sysenter, %d cycles int 0x80\n",
+                   args[2] / kIterations, args[3] / kIterations);
+  } else {
+    screen::Writef("null syscall: no sysenter, %d cycles int 0x80\n",
+                   args[3] / kIterations);
+  }
+  if (status != 0)
+    screen::Writef("  user code exited with %d\n", status);
+
+  Page pages[] = {code_page, stack_page};
+  for (auto page : pages) {
+    auto frame = *page_dir.entry(page)->pointed_frame();
+    page_dir.unmap(page, allocator);
+    allocator.Free(frame);
+  }
+}
+
+} // namespace syscall
@@ -0,0 +1,89 @@
+/**
+ * @file syscall.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * System calls from ring 3, through SYSENTER where the processor has it and
+ * through the int 0x80 gate everywhere.
+ */
+
+#ifndef SRC_ARCH_I586_INCLUDE_SYS_SYSCALL_H_
+#define SRC_ARCH_I586_INCLUDE_SYS_SYSCALL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/frame_allocator.h"
+
+namespace syscall {
+
+/**
+ * The system call numbers, passed in eax. Up to three arguments go in ebx,
+ * esi and edi, and the result comes back in eax. Through SYSENTER, edx holds
+ * the address to return to and ecx the user stack pointer; both are
+ * clobbered.
+ */
+enum Number : uint32_t {
+  /**
+   * Does nothing and returns 0.
+   */
+  kNull = 0,
+
+  /**
+   * Leaves ring 3 for good, back to the kernel code that entered it.
+   */
+  kExit = 1
+};
+
+/**
+ * A system call. Its arguments are the caller's ebx, esi and edi.
+ * @return The value for the caller's eax.
+ */
+typedef int32_t (*SyscallFunction)(uint32_t, uint32_t, uint32_t);
+
+/**
+ * Installs the int 0x80 handler and, if the processor has it, points
+ * SYSENTER at the kernel on the boot processor.
+ * @return False if there is no SYSENTER, in which case only int 0x80 works.
+ */
+bool Initialize();
+
+/**
+ * Points SYSENTER at the kernel on a secondary processor.
+ */
+void InitializeSecondary();
+
+/**
+ * Gets whether Initialize found SYSENTER.
+ */
+bool has_sysenter();
+
+/**
+ * Runs a loop of null system calls in ring 3, once through SYSENTER and once
+ * through int 0x80, and prints the round trip cost of each.
+ * @param allocator Provides the frames for the user code and stack.
+ */
+void benchmark_syscalls(paging::IFrameAllocator &allocator);
+
+} // namespace syscall
+
+#endif // SRC_ARCH_I586_INCLUDE_SYS_SYSCALL_H_
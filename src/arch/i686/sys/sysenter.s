@@ -0,0 +1,160 @@
+/** @file sysenter.s
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * The SYSENTER entry point, the switches into and out of ring 3, and the
+ * ring 3 half of the system call benchmark.
+ */
+.code32
+
+.section .text
+
+// Where SYSENTER lands, on the stack from the SYSENTER_ESP MSR with
+// interrupts disabled. edx holds the address to return to and ecx the user
+// stack pointer, as SYSEXIT wants them back. The number is in eax and the
+// arguments in ebx, esi and edi.
+.global sysenter_entry
+sysenter_entry:
+  pushl %ecx
+  pushl %edx
+  movw %fs, %cx         // keep the caller's %fs
+  pushl %ecx
+
+  movw $0x10, %cx       // kernel data segments
+  movw %cx, %ds
+  movw %cx, %es
+  str %cx               // and this processor's per-CPU segment, kMaxCpus
+  subw $per_cpu_selector_offset, %cx // entries before its TSS, see cpu.cc
+  movw %cx, %fs
+  cld
+  sti
+
+  cmpl syscall_count, %eax
+  jae 1f
+  pushl %edi
+  pushl %esi
+  pushl %ebx
+  call *syscall_table(,%eax,4)
+  addl $12, %esp
+  jmp 2f
+1:
+  movl $-1, %eax        // no such system call
+2:
+  cli
+  popl %ecx
+  movw %cx, %fs
+  movw $0x23, %cx       // user data segments
+  movw %cx, %ds
+  movw %cx, %es
+  popl %edx
+  popl %ecx
+  sti                   // takes effect after sysexit
+  sysexit
+
+// uint32_t enter_user(uint32_t eip, uint32_t esp, uint32_t *saved_esp)
+// Saves the callee saved registers and the interrupt flag, stores the stack
+// pointer for leave_user, and irets to ring 3.
+.global enter_user
+enter_user:
+  pushfl
+  pushl %ebp
+  pushl %ebx
+  pushl %esi
+  pushl %edi
+  movl 24(%esp), %ecx   // eip
+  movl 28(%esp), %edx   // esp
+  movl 32(%esp), %eax   // saved_esp
+  movl %esp, (%eax)
+
+  cli
+  movw $0x23, %ax
+  movw %ax, %ds
+  movw %ax, %es
+  movw %ax, %gs
+  pushl $0x23           // ss
+  pushl %edx            // esp
+  pushl $0x202          // eflags, with interrupts enabled
+  pushl $0x1B           // cs
+  pushl %ecx            // eip
+  iret
+
+// void leave_user(uint32_t saved_esp, uint32_t value)
+// Abandons the system call's stack and returns value from enter_user.
+.global leave_user
+leave_user:
+  movl 8(%esp), %eax
+  movl 4(%esp), %esp
+  movw $0x10, %cx
+  movw %cx, %ds
+  movw %cx, %es
+  movw %cx, %gs
+  popl %edi
+  popl %esi
+  popl %ebx
+  popl %ebp
+  popfl
+  ret
+
+// The ring 3 side of benchmark_syscalls, copied to a user page, so it has
+// to be position independent. On entry the stack holds the number of
+// SYSENTER calls to make, the number of int 0x80 calls, and room for the
+// cycles each loop took.
+.global user_bench_start
+.global user_bench_end
+user_bench_start:
+  call 1f               // find where sysexit should come back to
+1:
+  popl %ebp
+  addl $(3f - 1b), %ebp
+
+  movl (%esp), %edi
+  testl %edi, %edi
+  jz 4f
+  rdtsc
+  movl %eax, %esi
+2:
+  xorl %eax, %eax       // the null system call
+  movl %ebp, %edx
+  movl %esp, %ecx
+  sysenter
+3:
+  decl %edi
+  jnz 2b
+  rdtsc
+  subl %esi, %eax
+  movl %eax, 8(%esp)
+
+4:
+  movl 4(%esp), %edi
+  rdtsc
+  movl %eax, %esi
+5:
+  xorl %eax, %eax
+  int $0x80
+  decl %edi
+  jnz 5b
+  rdtsc
+  subl %esi, %eax
+  movl %eax, 12(%esp)
+
+  movl $1, %eax         // exit(0)
+  xorl %ebx, %ebx
+  int $0x80
+user_bench_end:
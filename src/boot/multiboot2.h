@@ -14,7 +14,9 @@ enum class TagType : uint32_t {
     kBasicMemoryInfo = 4,
     kBiosBootDevice = 5,
     kMemoryMap = 6,
-    kElfSymbols = 9
+    kElfSymbols = 9,
+    kAcpiOldRsdp = 14,
+    kAcpiNewRsdp = 15
 };
 
 struct Tag {
@@ -93,6 +95,13 @@ struct ElfSymbolsTag : Tag {
     }
 };
 
+/**
+ * A copy of the ACPI RSDP the firmware provided.
+ */
+struct AcpiRsdpTag : Tag {
+    uint8_t rsdp[0];
+};
+
 /**
  * Represents the multiboot2 information structure provided by the bootloader.
  * See
@@ -120,6 +129,19 @@ struct Info {
         return reinterpret_cast<ElfSymbolsTag*>(find_tag(TagType::kElfSymbols));
     }
 
+    /**
+     * Gets the ACPI RSDP, preferring the ACPI 2.0 one if both were passed.
+     * @return The RSDP, or nullptr if the bootloader didn't pass one.
+     */
+    const void* acpi_rsdp() {
+        auto tag = find_tag(TagType::kAcpiNewRsdp);
+        if (!tag)
+            tag = find_tag(TagType::kAcpiOldRsdp);
+        if (!tag)
+            return nullptr;
+        return reinterpret_cast<AcpiRsdpTag*>(tag)->rsdp;
+    }
+
     private:
     Tag* find_tag(TagType type) {
         for (auto t = &first_tag; t != nullptr; t = t->next()) {
@@ -0,0 +1,73 @@
+/**
+ * @file block_device.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Interface implemented by devices that store data in fixed size sectors.
+ */
+
+#ifndef SRC_INCLUDE_DEV_BLOCK_DEVICE_H_
+#define SRC_INCLUDE_DEV_BLOCK_DEVICE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dev {
+
+/**
+ * The size of a single sector in bytes.
+ */
+const size_t kSectorSize = 512;
+
+/**
+ * Represents a device that can be read and written a sector at a time.
+ */
+class BlockDevice {
+public:
+  virtual ~BlockDevice() {}
+
+  /**
+   * Gets the number of addressable sectors on the device.
+   */
+  virtual uint32_t sector_count() const = 0;
+
+  /**
+   * Reads a run of consecutive sectors from the device.
+   * @param lba The address of the first sector to read.
+   * @param count The number of sectors to read.
+   * @param buffer The buffer to place the data into. Must hold
+   * count * kSectorSize bytes.
+   * @return True if all sectors were read successfully.
+   */
+  virtual bool Read(uint32_t lba, uint32_t count, void *buffer) = 0;
+
+  /**
+   * Writes a run of consecutive sectors to the device.
+   * @param lba The address of the first sector to write.
+   * @param count The number of sectors to write.
+   * @param buffer The data to write. Must hold count * kSectorSize bytes.
+   * @return True if all sectors were written successfully.
+   */
+  virtual bool Write(uint32_t lba, uint32_t count, const void *buffer) = 0;
+};
+
+} // namespace dev
+
+#endif // SRC_INCLUDE_DEV_BLOCK_DEVICE_H_
@@ -26,46 +26,176 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <new>
 
 #include "boot/multiboot2.h"
+#include "dev/ata.h"
+#include "dev/serial.h"
+#include "int/apic.h"
+#include "int/deferred.h"
+#include "int/idt.h"
+#include "int/stats.h"
+#include "int/timer.h"
+#include "mm/allocator_bench.h"
+#include "mm/arena.h"
+#include "mm/background_scan.h"
+#include "mm/cpu_cache.h"
+#include "mm/early_allocator.h"
 #include "mm/frame_allocator.h"
+#include "mm/heap_profile.h"
+#include "mm/huge_page.h"
+#include "mm/kheap.h"
+#include "mm/page_allocator.h"
+#include "mm/page_fault_handler.h"
+#include "mm/page_mapper.h"
 #include "mm/paging.h"
+#include "mm/shrinker.h"
+#include "mm/ring_buffer.h"
+#include "mm/size_class.h"
+#include "mm/slab.h"
+#include "mm/swap.h"
+#include "mm/user_copy.h"
+#include "mm/virtual_range.h"
+#include "mm/working_set.h"
+#include "sys/acpi.h"
 #include "sys/addressing.h"
+#include "sys/cpu.h"
+#include "sys/fpu.h"
+#include "sys/io.h"
+#include "sys/symbols.h"
+#include "sys/syscall.h"
 #include "video/text_screen.h"
 
 extern const uint32_t __kernel_start, __kernel_data, __kernel_end;
 
 namespace {
 
-// unsigned char heap_memory[sizeof(alloc::KHeap)];
-// alloc::KHeap *kernel_heap = nullptr;
-
-// void InitializeKernelHeap() {
-//   // set up the heap boundaries (1MiB initial, 2MiB max)
-//   // 0xC0400000  <-- 1MiB -->  0xC0500000  <-- 1MiB -->  0xC0600000
-//   uint32_t heap_start = static_cast<uint32_t>(0xC0400000);
-//   if (heap_start % paging::kPageSize)
-//     heap_start += paging::kPageSize - (heap_start % paging::kPageSize);
-//   uint32_t heap_end = heap_start + 0x100000;
-//   uint32_t max_heap = heap_end + 0x100000;
-
-//   // now map in the necessary pages for the heap
-//   paging::Page *page = paging::PageAllocator::instance().AllocatePages(
-//       (heap_end - heap_start) / paging::kPageSize);
-//   for (uint32_t addr = heap_start; addr < heap_end; addr +=
-//   paging::kPageSize)
-//     paging::PageDirectory::kernel_directory().MapPage(
-//         page++, reinterpret_cast<void *>(addr));
-
-//   // create the heap instance and tell it the memory to manage
-//   kernel_heap = new (static_cast<void *>(heap_memory)) alloc::KHeap(
-//       reinterpret_cast<void *>(heap_start), reinterpret_cast<void
-//       *>(heap_end),
-//       reinterpret_cast<void *>(max_heap), false, false);
-
-//   // make the heap our active allocator
-//   alloc::SetActiveAllocator(*kernel_heap);
-// }
+// these are too big to live on the boot stack
+alignas(paging::AreaFrameAllocator)
+unsigned char frame_allocator_memory[sizeof(paging::AreaFrameAllocator)];
+alignas(paging::SwapSpace)
+unsigned char swap_memory[sizeof(paging::SwapSpace)];
+alignas(paging::HugePagePromoter)
+unsigned char promoter_memory[sizeof(paging::HugePagePromoter)];
+alignas(paging::BackgroundScanner)
+unsigned char scanner_memory[sizeof(paging::BackgroundScanner)];
+
+/**
+ * Virtual addresses for memory the kernel maps on demand.
+ */
+paging::VirtualRangeAllocator kernel_ranges(
+    paging::kKernelVirtualRangeStart, paging::kKernelVirtualRangePages);
+
+paging::PageFaultHandler page_fault_handler;
+
+/**
+ * The disk used as swap space, if there is one.
+ */
+ata::Drive swap_drive(ata::Bus::kPrimary, ata::Position::kMaster);
+
+/**
+ * The first serial port, where diagnostics too long for the screen go.
+ */
+serial::Port com1(serial::Com::kCom1);
+
+/**
+ * Tracks how much of the user half of the address space is in active use.
+ */
+paging::WorkingSetEstimator working_set(0, 768 * 1024);
+
+alignas(alloc::KHeap) unsigned char heap_memory[sizeof(alloc::KHeap)];
+alloc::KHeap *kernel_heap = nullptr;
+
+void InitializeKernelHeap(paging::IFrameAllocator &frames) {
+  // set up the heap boundaries (1MiB initial, growing up to the region for
+  // large allocations, which ends where on demand mappings start)
+  // 0xC0400000  <-- 1MiB -->  0xC0500000  <-- ... -->  0xC8000000
+  // 0xC8000000  <-- large allocations -->  0xD0000000
+  uint32_t heap_start = static_cast<uint32_t>(0xC0400000);
+  uint32_t heap_end = heap_start + 0x100000;
+  uint32_t max_heap = static_cast<uint32_t>(0xC8000000);
+  uint32_t large_end = paging::kKernelVirtualRangeStart;
+
+  // create the heap instance, which maps its own pages
+  kernel_heap = new (static_cast<void *>(heap_memory)) alloc::KHeap(
+      reinterpret_cast<void *>(heap_start), reinterpret_cast<void *>(heap_end),
+      reinterpret_cast<void *>(max_heap), reinterpret_cast<void *>(large_end),
+      true, false, frames, paging::ActivePageMapper::instance());
+
+  // make the heap our active allocator
+  alloc::SetActiveAllocator(*kernel_heap);
+}
+
+alignas(alloc::SizeClassAllocator) unsigned char
+    size_class_memory[sizeof(alloc::SizeClassAllocator)];
+alloc::SizeClassAllocator *size_classes = nullptr;
+
+/**
+ * Puts the size class allocator in front of the kernel heap. Needs the
+ * PageAllocator for its slabs.
+ */
+void InitializeSizeClasses() {
+  size_classes = new (static_cast<void *>(size_class_memory))
+      alloc::SizeClassAllocator(*kernel_heap);
+  alloc::SetActiveAllocator(*size_classes);
+}
+
+alignas(alloc::CpuCacheAllocator) unsigned char
+    cpu_cache_memory[sizeof(alloc::CpuCacheAllocator)];
+alloc::CpuCacheAllocator *cpu_caches = nullptr;
+
+/**
+ * Puts the per-CPU caches in front of the size classes.
+ */
+void InitializeCpuCaches() {
+  cpu_caches = new (static_cast<void *>(cpu_cache_memory))
+      alloc::CpuCacheAllocator(*size_classes);
+  alloc::SetActiveAllocator(*cpu_caches);
+  paging::RegisterShrinker(*cpu_caches);
+}
+
+/**
+ * Switches interrupt delivery from the PICs to the APICs if the MADT lists
+ * them.
+ */
+void InitializeInterruptControllers(multiboot2::Info *mbd,
+                                    paging::IFrameAllocator &frames) {
+  acpi::Madt madt;
+  if (!acpi::ReadMadt(mbd->acpi_rsdp(), madt, kernel_ranges, frames) ||
+      !apic::Initialize(madt, kernel_ranges, frames)) {
+    screen::WriteLine("apic: not found, using the PICs");
+    return;
+  }
+  screen::Writef("apic: %d cpus, %d io apics, %d irq overrides\n",
+                 madt.cpu_count, madt.io_apic_count, madt.override_count);
+#ifdef BOOT_TESTS
+  apic::test_apic();
+#endif
+}
+
+#ifdef BOOT_TESTS
+/**
+ * Gets the memory held by the allocator stack: the heap, its large blocks,
+ * and the pages behind the slabs.
+ */
+size_t AllocatorFootprint() {
+  return kernel_heap->mapped_bytes() + kernel_heap->large_bytes() +
+         paging::PageAllocator::instance().used_pages() * paging::kPageSize;
+}
+
+/**
+ * Compares every layer of the allocator stack on the same workloads, and
+ * fuzzes each layer against the heap underneath.
+ */
+void BenchmarkAllocators() {
+  const alloc::BenchSubject subjects[] = {{"heap", kernel_heap},
+                                          {"size classes", size_classes},
+                                          {"cpu caches", cpu_caches}};
+  alloc::benchmark_allocators(subjects, 3, AllocatorFootprint);
+  alloc::fuzz_allocators(subjects[0], subjects[1], 0x1234567, 4096);
+  alloc::fuzz_allocators(subjects[0], subjects[2], 0x7654321, 4096);
+}
+#endif
 
 /**
  * Main entry point into kernel from loader assembly.
@@ -131,9 +261,27 @@ extern "C" void kmain(multiboot2::Info *mbd, uint32_t magic) {
   auto multiboot_end = multiboot_start + static_cast<size_t>(mbd->total_size);
   screen::Writef("multiboot_start: 0x%x, multiboot_end: 0x%x\n", multiboot_start, multiboot_end);
 
-  paging::AreaFrameAllocator allocator(
+  // keep the early allocator away from the multiboot information, and the
+  // frame allocator away from everything the early allocator may use
+  auto &early = alloc::GetEarlyAllocator();
+  early.Reserve(static_cast<uint32_t>(static_cast<size_t>(multiboot_start)),
+                mbd->total_size);
+
+  // the symbol tables are only loaded, not claimed, so keep them too
+  if (symbols::Initialize(mbd->elf_symbols())) {
+    auto symtab = symbols::symbol_table();
+    auto strtab = symbols::string_table();
+    early.Reserve(symtab.start, symtab.size);
+    early.Reserve(strtab.start, strtab.size);
+  } else {
+    screen::WriteLine("-- no kernel symbols --");
+  }
+  if (!com1.Initialize())
+    screen::WriteLine("-- no serial port on COM1 --");
+
+  auto &allocator = *new (frame_allocator_memory) paging::AreaFrameAllocator(
     kernel_start.ToPhysical(),
-    kernel_end.ToPhysical(),
+    addressing::vaddress(early.limit() - 1).ToPhysical(),
     multiboot_start.ToPhysical(),
     multiboot_end.ToPhysical());
 
@@ -152,10 +300,109 @@ extern "C" void kmain(multiboot2::Info *mbd, uint32_t magic) {
     }
   }
 
+  cpu::Initialize();
+  idt::Initialize();
+  page_fault_handler.RegisterHandler();
+#ifdef BOOT_TESTS
+  isr::benchmark_interrupts();
+#endif
+  InitializeInterruptControllers(mbd, allocator);
+#ifdef BOOT_TESTS
+  isr::test_deferred_work();
+#endif
+  if (!fpu::Initialize())
+    screen::WriteLine("-- no sse --");
+#ifdef BOOT_TESTS
+  fpu::test_fpu();
+#endif
+  if (!syscall::Initialize())
+    screen::WriteLine("-- no sysenter --");
+#ifdef BOOT_TESTS
+  syscall::benchmark_syscalls(allocator);
+#endif
+  timer::Initialize();
+#ifdef BOOT_TESTS
+  timer::test_timers();
   paging::test_paging(allocator);
+#endif
+
+  InitializeKernelHeap(allocator);
+#ifdef BOOT_TESTS
+  alloc::test_kheap(*kernel_heap);
+#endif
+  screen::Writef("early allocator: %d bytes used, %d frames released\n",
+                 early.used_bytes(), early.Release(allocator));
+
+  paging::PageAllocator::InitSingleton(kernel_ranges, allocator,
+                                       paging::ActivePageMapper::instance());
+  paging::RegisterShrinker(alloc::SlabCache::shrinker());
+#ifdef BOOT_TESTS
+  alloc::test_slab();
+#endif
+  InitializeSizeClasses();
+#ifdef BOOT_TESTS
+  alloc::test_size_classes(*size_classes, *kernel_heap);
+#endif
+  InitializeCpuCaches();
+#ifdef BOOT_TESTS
+  alloc::benchmark_cpu_cache(*cpu_caches, *size_classes);
+  alloc::test_atomic_allocation(*cpu_caches);
+  alloc::test_arena();
+  BenchmarkAllocators();
+#endif
+
+  // swap isn't registered yet, so this only empties the caches
+  auto free_frames = allocator.free_frames();
+  auto released = paging::ShrinkCaches(static_cast<size_t>(-1));
+  screen::Writef("shrinkers: %d frames released, %d free before, %d after\n",
+                 released, free_frames, allocator.free_frames());
+
+#ifdef BOOT_TESTS
+  paging::test_huge_pages(allocator);
+  paging::test_ring_buffer(kernel_ranges, allocator);
+  paging::test_user_copy(allocator);
+#endif
+
+  if (!swap_drive.Identify()) {
+    screen::WriteLine("swap: no disk on primary master");
+  } else if (!paging::SwapSpace::Probe(swap_drive, 0)) {
+    screen::WriteLine("swap: no swap signature on primary master");
+  } else {
+    auto swap = new (swap_memory) paging::SwapSpace(swap_drive, 0, allocator);
+    paging::RegisterShrinker(*swap);
+    page_fault_handler.set_swap_space(swap);
+    screen::Writef("swap: %d slots on primary master\n", swap->slot_count());
+#ifdef BOOT_TESTS
+    paging::test_swap(*swap, allocator, 4096);
+
+    // take two samples by hand rather than wait for the background scan:
+    // the first harvests the Accessed bits left by the earlier tests, the
+    // second shows what has gone idle since
+    working_set.Run();
+    working_set.Run();
+    working_set.Dump();
+#endif
+  }
 
-  for (;;)
-    continue;
+#ifdef HEAP_PROFILE
+  alloc::DumpHeapProfile(com1);
+#endif
+  isr::DumpInterruptStats(com1);
+
+  // nothing else touches the user half's page tables from here on, so the
+  // scans can run under whatever is interrupted
+  auto promoter = new (promoter_memory)
+      paging::HugePagePromoter(0, paging::kUserSpaceEnd >> 22, allocator);
+  auto scanner = new (scanner_memory)
+      paging::BackgroundScanner(working_set, *promoter);
+  scanner->Start();
+
+  // the idle loop holds nothing, so deferred work can run with interrupts on
+  enable_interrupts();
+  for (;;) {
+    isr::RunPendingWork();
+    timer::Idle();
+  }
 
 /*
   // mbd->mmap_length
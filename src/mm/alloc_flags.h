@@ -0,0 +1,71 @@
+/**
+ * @file alloc_flags.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Flags that say what an allocation is allowed to do to find memory.
+ */
+
+#ifndef SRC_INCLUDE_MM_ALLOC_FLAGS_H_
+#define SRC_INCLUDE_MM_ALLOC_FLAGS_H_
+
+#include <cstdint>
+
+namespace alloc {
+
+enum class AllocFlags : uint32_t {
+  /**
+   * Anything goes, including asking the shrinkers for memory, which may
+   * write pages out to disk.
+   */
+  kNone = 0,
+
+  /**
+   * Fail rather than do anything slow to find memory: no shrinking, no
+   * growing, no waiting on other processors beyond a short spinlock.
+   */
+  kNoWait = 1 << 0,
+
+  /**
+   * For interrupt handlers. Implies kNoWait, takes no lock that code outside
+   * the handler may be holding on this processor, and may dip into the
+   * emergency reserves that everything else leaves alone.
+   */
+  kAtomic = (1 << 1) | kNoWait,
+};
+
+inline constexpr AllocFlags operator|(AllocFlags lhs, AllocFlags rhs) {
+  return AllocFlags(static_cast<uint32_t>(lhs) | static_cast<uint32_t>(rhs));
+}
+
+inline constexpr AllocFlags operator&(AllocFlags lhs, AllocFlags rhs) {
+  return AllocFlags(static_cast<uint32_t>(lhs) & static_cast<uint32_t>(rhs));
+}
+
+/**
+ * Checks whether every bit of a flag is set.
+ */
+inline constexpr bool has_flag(AllocFlags flags, AllocFlags flag) {
+  return (flags & flag) == flag;
+}
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_ALLOC_FLAGS_H_
@@ -26,8 +26,12 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
-#include "mm/ks_allocator.h"
+#include "mm/arena.h"
+#include "mm/early_allocator.h"
+#include "mm/heap_profile.h"
+#include "mm/paging.h"
 #include "sys/kernel.h"
 
 /**
@@ -38,34 +42,170 @@ extern const uint32_t ebss;
 namespace alloc {
 
 /**
- * Singleton instance of the KernelSpaceAllocator used before the heap is
+ * Singleton instance of the EarlyAllocator used before the heap is
  * initialized.
  */
-KernelSpaceAllocator g_ks_allocator(reinterpret_cast<uint32_t>(&ebss));
+EarlyAllocator g_early_allocator(reinterpret_cast<uint32_t>(&ebss),
+                                 kInitialMappingEnd);
 
 /**
  * Points the currently active allocator that will be used to satisfy C++
- * new/delete requests.
+ * new requests.
  */
-Allocator *g_current_allocator = &g_ks_allocator;
+Allocator *g_current_allocator = &g_early_allocator;
+
+/**
+ * Points the allocator set with SetActiveAllocator, which delete requests go
+ * to unless an arena owns the block.
+ */
+Allocator *g_default_allocator = &g_early_allocator;
+
+EarlyAllocator &GetEarlyAllocator() { return g_early_allocator; }
 
 void SetActiveAllocator(Allocator &allocator) {
   g_current_allocator = &allocator;
+  g_default_allocator = &allocator;
+}
+
+Allocator &GetActiveAllocator() { return *g_current_allocator; }
+
+void RedirectNew(Allocator &allocator) { g_current_allocator = &allocator; }
+
+void *Allocator::AllocateAligned(size_t size, size_t alignment) {
+  if (alignment <= kDefaultAlignment)
+    return Allocate(size);
+  if (alignment <= paging::kPageSize)
+    return Allocate(size, true);
+  return nullptr;
+}
+
+void *Allocator::Reallocate(void *ptr, size_t old_size, size_t new_size) {
+  if (ptr == nullptr)
+    return Allocate(new_size);
+  if (new_size == 0) {
+    FreeSized(ptr, old_size);
+    return nullptr;
+  }
+  if (TryExpandInPlace(ptr, new_size))
+    return ptr;
+
+  auto moved = Allocate(new_size);
+  if (!moved)
+    return nullptr;
+  memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+  FreeSized(ptr, old_size);
+  return moved;
 }
 
 } // namespace alloc
 
+namespace {
+
+/**
+ * Takes a block for operator new from the active allocator.
+ * @param site The return address of operator new, for the heap profile.
+ */
+inline void *NewBlock(size_t size, size_t alignment, void *site) {
+#ifdef HEAP_PROFILE
+  return alloc::ProfiledAllocate(*alloc::g_current_allocator, size, alignment,
+                                 site);
+#else
+  (void)site;
+  if (alignment <= alloc::kDefaultAlignment)
+    return alloc::g_current_allocator->Allocate(size, false);
+  return alloc::g_current_allocator->AllocateAligned(size, alignment);
+#endif
+}
+
+/**
+ * Finds the allocator a block from NewBlock belongs to, which isn't
+ * necessarily the active one: blocks from before the heap existed may be
+ * deleted long after, arena blocks after their scope has ended, and heap
+ * blocks inside one.
+ */
+inline alloc::Allocator &OwnerOf(void *ptr) {
+  auto address = reinterpret_cast<uint32_t>(ptr);
+  if (address >= reinterpret_cast<uint32_t>(&ebss) &&
+      address < alloc::kInitialMappingEnd)
+    return alloc::g_early_allocator;
+  if (auto arena = alloc::Arena::Owning(ptr))
+    return *arena;
+  return *alloc::g_default_allocator;
+}
+
+/**
+ * Gives a block from NewBlock back to the allocator it came from.
+ * @param size The size asked for, or 0 if it isn't known.
+ */
+inline void DeleteBlock(void *ptr, size_t size, size_t alignment) {
+  auto &owner = OwnerOf(ptr);
+#ifdef HEAP_PROFILE
+  (void)size;
+  (void)alignment;
+  alloc::ProfiledFree(owner, ptr);
+#else
+  if (size)
+    owner.FreeSized(ptr, size, alignment);
+  else
+    owner.Free(ptr);
+#endif
+}
+
+} // namespace
+
 /// @cond
 void *operator new(size_t size) {
-  return alloc::g_current_allocator->Allocate(size, false);
+  return NewBlock(size, alloc::kDefaultAlignment, __builtin_return_address(0));
 }
 
 void *operator new[](size_t size) {
-  return alloc::g_current_allocator->Allocate(size, false);
+  return NewBlock(size, alloc::kDefaultAlignment, __builtin_return_address(0));
 }
 
-void operator delete(void *ptr) { alloc::g_current_allocator->Free(ptr); }
+void operator delete(void *ptr) noexcept {
+  DeleteBlock(ptr, 0, alloc::kDefaultAlignment);
+}
+
+void operator delete[](void *ptr) noexcept {
+  DeleteBlock(ptr, 0, alloc::kDefaultAlignment);
+}
 
-void operator delete[](void *ptr) { alloc::g_current_allocator->Free(ptr); }
+void operator delete(void *ptr, size_t size) noexcept {
+  DeleteBlock(ptr, size, alloc::kDefaultAlignment);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept {
+  DeleteBlock(ptr, size, alloc::kDefaultAlignment);
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t size, std::align_val_t alignment) {
+  return NewBlock(size, static_cast<size_t>(alignment),
+                  __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return NewBlock(size, static_cast<size_t>(alignment),
+                  __builtin_return_address(0));
+}
+
+void operator delete(void *ptr, std::align_val_t alignment) noexcept {
+  DeleteBlock(ptr, 0, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void *ptr, std::align_val_t alignment) noexcept {
+  DeleteBlock(ptr, 0, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr, size_t size,
+                     std::align_val_t alignment) noexcept {
+  DeleteBlock(ptr, size, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void *ptr, size_t size,
+                       std::align_val_t alignment) noexcept {
+  DeleteBlock(ptr, size, static_cast<size_t>(alignment));
+}
+#endif
 
 /// @endcond
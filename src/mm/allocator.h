@@ -26,9 +26,17 @@
 #define SRC_INCLUDE_MM_ALLOCATOR_H_
 
 #include <cstddef>
+#include <new>
+
+#include "mm/alloc_flags.h"
 
 namespace alloc {
 
+/**
+ * The alignment every block gets without asking.
+ */
+const size_t kDefaultAlignment = 8;
+
 /**
  * Represents an algorithm for allocating memory.
  */
@@ -43,12 +51,67 @@ public:
    */
   virtual void *Allocate(size_t size, bool align = false) = 0;
 
+  /**
+   * Allocate a block of memory, doing only what the flags allow to find it.
+   * Allocators that don't look at the flags keep this default, which fails
+   * anything other than kNone. Blocks are freed like any other.
+   * @param size The size, in bytes, to allocate.
+   * @param flags What the allocator may do to find memory.
+   * @return The block, or nullptr if it couldn't be allocated.
+   */
+  virtual void *Allocate(size_t size, AllocFlags flags) {
+    return flags == AllocFlags::kNone ? Allocate(size) : nullptr;
+  }
+
   /**
    * Releases a previously allocated block of memory. The memory must have
    * been allocated using this same allocator.
    * @param ptr A pointer to the block to release.
    */
   virtual void Free(void *ptr) = 0;
+
+  /**
+   * Allocate a block of memory with a particular alignment. The default
+   * rounds anything above kDefaultAlignment up to a whole page.
+   * @param size The size, in bytes, to allocate.
+   * @param alignment The alignment of the block, a power of two.
+   * @return The block, or nullptr if it couldn't be allocated.
+   */
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Releases a block whose size is known, which lets some allocators skip
+   * finding out where the block came from. The default ignores the size.
+   * @param ptr A pointer to the block to release.
+   * @param size The size that was asked for when the block was allocated.
+   * @param alignment The alignment that was asked for, if any.
+   */
+  virtual void FreeSized(void *ptr, size_t size,
+                         size_t alignment = kDefaultAlignment) {
+    Free(ptr);
+  }
+
+  /**
+   * Tries to resize a block without moving it. The default can't resize
+   * anything. Once a block has been resized, FreeSized must be given the new
+   * size.
+   * @param ptr A block allocated without extra alignment.
+   * @param new_size The size, in bytes, the block should hold.
+   * @return True if the block now holds new_size bytes.
+   */
+  virtual bool TryExpandInPlace(void *ptr, size_t new_size) { return false; }
+
+  /**
+   * Resizes a block, in place if TryExpandInPlace can, otherwise by moving
+   * it to a new block and freeing the old one.
+   * @param ptr A block allocated without extra alignment, or nullptr to
+   * allocate a new block.
+   * @param old_size The size the block holds now.
+   * @param new_size The size it should hold, or 0 to free it.
+   * @return The resized block, or nullptr if there was no memory, in which
+   * case the old block is left alone.
+   */
+  virtual void *Reallocate(void *ptr, size_t old_size, size_t new_size);
 };
 
 /**
@@ -57,14 +120,41 @@ public:
  */
 void SetActiveAllocator(Allocator &allocator);
 
-} // namespace alloc
+/**
+ * Gets the allocator operator new currently uses.
+ */
+Allocator &GetActiveAllocator();
+
+/**
+ * Points operator new at an allocator, but not operator delete. It keeps
+ * giving blocks to the Arena they came from, or else to the allocator set
+ * with SetActiveAllocator.
+ * @param allocator The allocator for operator new to use.
+ */
+void RedirectNew(Allocator &allocator);
+
+/**
+ * Makes an arena the allocator operator new uses for the lifetime of the
+ * object, then puts the previous one back. Blocks can be deleted inside or
+ * outside the scope, because operator delete finds their owner. The active
+ * allocator is shared by every processor and interrupt handler, so the scope
+ * should be kept short.
+ */
+class ScopedActiveAllocator {
+public:
+  explicit ScopedActiveAllocator(Allocator &allocator)
+      : previous_(GetActiveAllocator()) {
+    RedirectNew(allocator);
+  }
+  ~ScopedActiveAllocator() { RedirectNew(previous_); }
 
-/// @cond
-inline void *operator new(size_t, void *p) throw() { return p; }
-inline void *operator new[](size_t, void *p) throw() { return p; }
-inline void operator delete(void *, void *)throw(){};
-inline void operator delete(void *, size_t) throw() {};
-inline void operator delete[](void *, void *) throw(){};
-/// @endcond
+  ScopedActiveAllocator(const ScopedActiveAllocator &) = delete;
+  ScopedActiveAllocator &operator=(const ScopedActiveAllocator &) = delete;
+
+private:
+  Allocator &previous_;
+};
+
+} // namespace alloc
 
 #endif // SRC_INCLUDE_MM_ALLOCATOR_H_
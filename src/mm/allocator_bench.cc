@@ -0,0 +1,340 @@
+/**
+ * @file allocator_bench.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/allocator_bench.h"
+
+#include <cstring>
+
+#include "sys/io.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+/**
+ * A xorshift generator, so every run sees the same requests.
+ */
+inline uint32_t NextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/**
+ * Picks a request size: mostly small objects, some buffers, and now and
+ * then something big enough to take the heap's large allocation path.
+ */
+size_t RandomSize(uint32_t &state) {
+  auto r = NextRandom(state);
+  switch (r % 16) {
+  case 0:
+    return 4096 + (r >> 8) % 28672;
+  case 1:
+  case 2:
+  case 3:
+    return 256 + (r >> 8) % 1792;
+  default:
+    return 8 + (r >> 8) % 248;
+  }
+}
+
+/**
+ * One step of a trace: allocate size bytes into slot, or free the slot if
+ * size is 0.
+ */
+struct TraceOp {
+  uint8_t slot;
+  uint16_t size;
+};
+
+/**
+ * A vector growing by doubling, a list of nodes with a name string each, a
+ * couple of I/O buffers, and everything torn down again. It leaves every
+ * slot empty, so it can be replayed back to back.
+ */
+const TraceOp kTrace[] = {
+    // the vector
+    {0, 16}, {1, 32}, {0, 0}, {0, 64}, {1, 0}, {1, 128}, {0, 0}, {0, 256},
+    {1, 0}, {1, 512}, {0, 0}, {0, 1024}, {1, 0}, {1, 2048}, {0, 0},
+    // the list
+    {2, 48}, {3, 24}, {4, 48}, {5, 24}, {6, 48}, {7, 24}, {8, 48}, {9, 24},
+    {3, 0}, {5, 0}, {7, 0}, {9, 0},
+    // the buffers
+    {10, 20000}, {11, 4096},
+    // tear down
+    {2, 0}, {4, 0}, {6, 0}, {8, 0}, {10, 0}, {11, 0}, {1, 0}};
+
+const size_t kTraceSlots = 12;
+const size_t kTraceRepeats = 256;
+
+const size_t kRandomSlots = 128;
+const size_t kRandomOperations = 8192;
+
+/**
+ * Runs one workload against one allocator, timing every request and keeping
+ * track of how much memory is live.
+ */
+class Workload {
+public:
+  Workload(Allocator &allocator, FootprintFunction footprint)
+      : allocator_(allocator), footprint_(footprint), operations_(0),
+        cycles_(0), worst_(0), failures_(0), live_bytes_(0),
+        peak_live_bytes_(0), base_footprint_(footprint()),
+        peak_footprint_(base_footprint_) {
+    memset(blocks_, 0, sizeof(blocks_));
+    memset(sizes_, 0, sizeof(sizes_));
+  }
+
+  inline bool is_live(size_t slot) const { return blocks_[slot] != nullptr; }
+
+  void Allocate(size_t slot, size_t size) {
+    auto start = read_tsc();
+    auto block = allocator_.Allocate(size);
+    Count(read_tsc() - start);
+    if (!block) {
+      ++failures_;
+      return;
+    }
+
+    // touch the block like a caller would, outside the timed part
+    auto bytes = static_cast<uint8_t *>(block);
+    bytes[0] = bytes[size - 1] = static_cast<uint8_t>(slot);
+    blocks_[slot] = block;
+    sizes_[slot] = size;
+    live_bytes_ += size;
+    if (live_bytes_ > peak_live_bytes_)
+      peak_live_bytes_ = live_bytes_;
+    auto footprint = footprint_();
+    if (footprint > peak_footprint_)
+      peak_footprint_ = footprint;
+  }
+
+  void Free(size_t slot) {
+    auto start = read_tsc();
+    allocator_.Free(blocks_[slot]);
+    Count(read_tsc() - start);
+    blocks_[slot] = nullptr;
+    live_bytes_ -= sizes_[slot];
+  }
+
+  void FreeAll() {
+    for (size_t slot = 0; slot < kRandomSlots; ++slot) {
+      if (is_live(slot))
+        Free(slot);
+    }
+  }
+
+  void Report(const char *workload, const char *name) const {
+    auto held = footprint_();
+    screen::Writef("  %s %s: %d cycles/op, worst %d, %d failed\n", workload,
+                   name,
+                   static_cast<uint32_t>(divide64(cycles_, operations_)),
+                   worst_, failures_);
+    screen::Writef("    peak %d bytes live, footprint +%d, %d kept\n",
+                   peak_live_bytes_, peak_footprint_ - base_footprint_,
+                   held > base_footprint_ ? held - base_footprint_ : 0);
+  }
+
+private:
+  inline void Count(uint64_t cycles) {
+    ++operations_;
+    cycles_ += cycles;
+    if (cycles > worst_)
+      worst_ = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<uint32_t>(cycles);
+  }
+
+  Allocator &allocator_;
+  FootprintFunction footprint_;
+  void *blocks_[kRandomSlots];
+  size_t sizes_[kRandomSlots];
+  uint32_t operations_;
+  uint64_t cycles_;
+  uint32_t worst_;
+  size_t failures_;
+  size_t live_bytes_;
+  size_t peak_live_bytes_;
+  size_t base_footprint_;
+  size_t peak_footprint_;
+};
+
+void RunTrace(const BenchSubject &subject, FootprintFunction footprint) {
+  static_assert(kTraceSlots <= kRandomSlots, "trace uses too many slots");
+  Workload workload(*subject.allocator, footprint);
+  for (size_t repeat = 0; repeat < kTraceRepeats; ++repeat) {
+    for (auto &op : kTrace) {
+      if (op.size)
+        workload.Allocate(op.slot, op.size);
+      else if (workload.is_live(op.slot))
+        workload.Free(op.slot);
+    }
+  }
+  workload.FreeAll();
+  workload.Report("trace", subject.name);
+}
+
+void RunRandom(const BenchSubject &subject, FootprintFunction footprint) {
+  Workload workload(*subject.allocator, footprint);
+  uint32_t state = 0x9E3779B9;
+  for (size_t i = 0; i < kRandomOperations; ++i) {
+    auto slot = NextRandom(state) % kRandomSlots;
+    if (workload.is_live(slot))
+      workload.Free(slot);
+    else
+      workload.Allocate(slot, RandomSize(state));
+  }
+  workload.FreeAll();
+  workload.Report("random", subject.name);
+}
+
+const size_t kFuzzSlots = 64;
+
+/**
+ * The same request made to both allocators.
+ */
+struct FuzzBlock {
+  uint8_t *blocks[2];
+  size_t size;
+  size_t alignment;
+  uint8_t fill;
+  bool sized;
+};
+
+/**
+ * Checks whether a new block overlaps any live block from the same
+ * allocator.
+ */
+bool Overlaps(const FuzzBlock *live, size_t which, const uint8_t *block,
+              size_t size) {
+  for (size_t i = 0; i < kFuzzSlots; ++i) {
+    auto other = live[i].blocks[which];
+    if (live[i].size && other && block < other + live[i].size &&
+        other < block + size)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Checks that both copies of a block still hold what was written, then frees
+ * them.
+ * @return The number of problems found.
+ */
+size_t Release(FuzzBlock &live, Allocator **allocators) {
+  size_t problems = 0;
+  for (size_t which = 0; which < 2; ++which) {
+    auto block = live.blocks[which];
+    if (!block)
+      continue;
+    for (size_t i = 0; i < live.size; ++i) {
+      if (block[i] != static_cast<uint8_t>(live.fill + i)) {
+        ++problems;
+        break;
+      }
+    }
+    if (live.sized)
+      allocators[which]->FreeSized(block, live.size, live.alignment);
+    else
+      allocators[which]->Free(block);
+  }
+  live.size = 0;
+  return problems;
+}
+
+} // namespace
+
+void benchmark_allocators(const BenchSubject *subjects, size_t count,
+                          FootprintFunction footprint) {
+  screen::WriteLine("allocator benchmark:");
+
+  // warm everything up first, so nobody pays for their first slabs
+  for (size_t i = 0; i < count; ++i) {
+    Workload warm_up(*subjects[i].allocator, footprint);
+    for (size_t slot = 0; slot < kRandomSlots; ++slot)
+      warm_up.Allocate(slot, 8 + slot * 16);
+    warm_up.FreeAll();
+  }
+
+  for (size_t i = 0; i < count; ++i)
+    RunTrace(subjects[i], footprint);
+  for (size_t i = 0; i < count; ++i)
+    RunRandom(subjects[i], footprint);
+}
+
+size_t fuzz_allocators(const BenchSubject &reference,
+                       const BenchSubject &candidate, uint32_t seed,
+                       size_t operations) {
+  FuzzBlock live[kFuzzSlots];
+  memset(live, 0, sizeof(live));
+  Allocator *allocators[2] = {reference.allocator, candidate.allocator};
+
+  size_t problems = 0;
+  uint32_t state = seed ? seed : 1;
+  for (size_t op = 0; op < operations; ++op) {
+    auto r = NextRandom(state);
+    auto &slot = live[r % kFuzzSlots];
+    if (slot.size) {
+      problems += Release(slot, allocators);
+      continue;
+    }
+
+    // a quarter of the requests are aligned, from 16 bytes up to 1KiB
+    slot.size = RandomSize(state);
+    slot.alignment =
+        (r >> 8) % 4 ? kDefaultAlignment : 16u << ((r >> 10) % 7);
+    slot.fill = static_cast<uint8_t>(r >> 24);
+    slot.sized = slot.alignment != kDefaultAlignment || (r >> 16) % 2;
+    for (size_t which = 0; which < 2; ++which) {
+      auto block = static_cast<uint8_t *>(
+          slot.alignment == kDefaultAlignment
+              ? allocators[which]->Allocate(slot.size)
+              : allocators[which]->AllocateAligned(slot.size,
+                                                   slot.alignment));
+      slot.blocks[which] = nullptr;
+      if (!block || reinterpret_cast<uint32_t>(block) % slot.alignment ||
+          Overlaps(live, which, block, slot.size)) {
+        ++problems;
+        if (block)
+          allocators[which]->Free(block);
+        continue;
+      }
+      for (size_t i = 0; i < slot.size; ++i)
+        block[i] = static_cast<uint8_t>(slot.fill + i);
+      slot.blocks[which] = block;
+    }
+  }
+  for (size_t i = 0; i < kFuzzSlots; ++i) {
+    if (live[i].size)
+      problems += Release(live[i], allocators);
+  }
+
+  screen::Writef("allocator fuzz, %s against %s: %d problems in %d ops\n",
+                 candidate.name, reference.name, problems, operations);
+  return problems;
+}
+
+} // namespace alloc
@@ -0,0 +1,82 @@
+/**
+ * @file allocator_bench.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Workload benchmarks and a differential fuzzer that work on any Allocator,
+ * so allocator changes can be compared on the same boot.
+ */
+
+#ifndef SRC_INCLUDE_MM_ALLOCATOR_BENCH_H_
+#define SRC_INCLUDE_MM_ALLOCATOR_BENCH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/allocator.h"
+
+namespace alloc {
+
+/**
+ * An allocator to benchmark, and what to call it in the results.
+ */
+struct BenchSubject {
+  const char *name;
+  Allocator *allocator;
+};
+
+/**
+ * Gets the number of bytes of memory the allocators are holding on to, so
+ * the benchmarks can tell how much of it is live.
+ */
+typedef size_t (*FootprintFunction)();
+
+/**
+ * Runs a replayed allocation trace and a random workload against each
+ * allocator. For each it prints the average and worst cycles per operation,
+ * the peak live bytes against how far the footprint grew to hold them, and
+ * how much of that growth is still held once everything is freed.
+ * @param subjects The allocators to run.
+ * @param count The number of subjects.
+ * @param footprint Measures the memory behind all the subjects.
+ */
+void benchmark_allocators(const BenchSubject *subjects, size_t count,
+                          FootprintFunction footprint);
+
+/**
+ * Feeds the same random sequence of plain, aligned and sized requests to two
+ * allocators, filling every block, and checks that both always succeed,
+ * honour the alignment, never hand out overlapping blocks and give back
+ * exactly what was written.
+ * @param reference The allocator the candidate is compared against.
+ * @param candidate The allocator under test.
+ * @param seed Picks the sequence; the same seed gives the same sequence.
+ * @param operations The number of requests to make.
+ * @return The number of problems found.
+ */
+size_t fuzz_allocators(const BenchSubject &reference,
+                       const BenchSubject &candidate, uint32_t seed,
+                       size_t operations);
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_ALLOCATOR_BENCH_H_
@@ -0,0 +1,210 @@
+/**
+ * @file arena.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/arena.h"
+
+#include "mm/page_allocator.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+inline uint32_t round_up(uint32_t x, uint32_t align) {
+  return (x + align - 1) & ~(align - 1);
+}
+
+/**
+ * Chunks start on a unit boundary and, with their guard page, fill whole
+ * units, so no other run of the kernel virtual range shares a unit with one.
+ */
+const size_t kUnitPages = 4;
+const size_t kUnitSize = kUnitPages * paging::kPageSize;
+const size_t kUnits = paging::kKernelVirtualRangePages / kUnitPages;
+
+/**
+ * The arena owning each unit of the kernel virtual range, or nullptr. Only
+ * the owning arena writes its units; a delete reads the unit of a live
+ * block, which can't change under it.
+ */
+Arena *unit_owners[kUnits];
+
+/**
+ * Records the owner of every unit a chunk and its guard page cover.
+ */
+void SetOwner(const void *chunk, size_t pages, Arena *owner) {
+  auto first = (reinterpret_cast<uint32_t>(chunk) -
+                paging::kKernelVirtualRangeStart) /
+               kUnitSize;
+  for (size_t i = 0; i < (pages + 1) / kUnitPages; ++i)
+    __atomic_store_n(&unit_owners[first + i], owner, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+Arena::Arena()
+    : chunks_(nullptr), current_(0), end_(0), last_(nullptr), last_start_(0),
+      allocated_bytes_(0), chunk_count_(0) {}
+
+Arena::~Arena() { Reset(); }
+
+Arena *Arena::Owning(const void *ptr) {
+  auto address = reinterpret_cast<uint32_t>(ptr);
+  if (address < paging::kKernelVirtualRangeStart)
+    return nullptr;
+  auto unit = (address - paging::kKernelVirtualRangeStart) / kUnitSize;
+  if (unit >= kUnits)
+    return nullptr;
+  return __atomic_load_n(&unit_owners[unit], __ATOMIC_ACQUIRE);
+}
+
+void *Arena::Allocate(size_t size, bool align) {
+  return AllocateAligned(size, align ? paging::kPageSize : kDefaultAlignment);
+}
+
+void *Arena::AllocateAligned(size_t size, size_t alignment) {
+  if (alignment < kDefaultAlignment)
+    alignment = kDefaultAlignment;
+  auto start = round_up(current_, alignment);
+  if (!chunks_ || start + size > end_ || start + size < start) {
+    // the block may need up to alignment bytes of padding in a new chunk
+    if (!NewChunk(size + alignment))
+      return nullptr;
+    start = round_up(current_, alignment);
+  }
+
+  last_start_ = current_;
+  current_ = start + size;
+  last_ = reinterpret_cast<void *>(start);
+  allocated_bytes_ += size;
+  return last_;
+}
+
+void Arena::Free(void *ptr) {
+  if (ptr == nullptr || ptr != last_)
+    return;
+
+  allocated_bytes_ -= current_ - reinterpret_cast<uint32_t>(ptr);
+  current_ = last_start_;
+  last_ = nullptr;
+}
+
+bool Arena::TryExpandInPlace(void *ptr, size_t new_size) {
+  auto start = reinterpret_cast<uint32_t>(ptr);
+  if (ptr == nullptr || ptr != last_ || new_size > end_ - start)
+    return false;
+
+  allocated_bytes_ = allocated_bytes_ - (current_ - start) + new_size;
+  current_ = start + new_size;
+  return true;
+}
+
+void Arena::Reset() {
+  auto &pages = paging::PageAllocator::instance();
+  while (chunks_) {
+    auto chunk = chunks_;
+    chunks_ = chunk->next;
+    auto count = chunk->pages;
+    SetOwner(chunk, count, nullptr);
+    pages.FreePages(chunk, count);
+  }
+  current_ = end_ = 0;
+  last_ = nullptr;
+  allocated_bytes_ = 0;
+  chunk_count_ = 0;
+}
+
+bool Arena::NewChunk(size_t size) {
+  auto pages =
+      round_up(size + sizeof(Chunk), paging::kPageSize) / paging::kPageSize;
+  // leave room for the guard page in the last unit
+  pages = round_up(pages + 1, kUnitPages) - 1;
+  auto chunk = static_cast<Chunk *>(
+      paging::PageAllocator::instance().AllocatePages(pages, kUnitPages));
+  if (!chunk)
+    return false;
+
+  chunk->pages = pages;
+  chunk->next = chunks_;
+  chunks_ = chunk;
+  SetOwner(chunk, pages, this);
+  ++chunk_count_;
+
+  current_ = reinterpret_cast<uint32_t>(chunk) + sizeof(Chunk);
+  end_ = reinterpret_cast<uint32_t>(chunk) + pages * paging::kPageSize;
+  last_ = nullptr;
+  return true;
+}
+
+namespace {
+
+struct TestNode {
+  TestNode *next;
+  uint32_t value;
+};
+
+} // namespace
+
+void test_arena() {
+  const uint32_t kNodes = 1000;
+  Arena arena;
+  TestNode *list = nullptr;
+  size_t bad = 0;
+  auto outside = new TestNode{nullptr, 0};
+
+  {
+    ScopedActiveAllocator scope(arena);
+    for (uint32_t i = 0; i < kNodes; ++i)
+      list = new TestNode{list, i};
+    // has to go back to the heap, not the arena
+    if (Arena::Owning(outside))
+      ++bad;
+    delete outside;
+  }
+
+  uint32_t expected = kNodes;
+  for (auto node = list; node; node = node->next) {
+    if (node->value != --expected)
+      ++bad;
+  }
+  if (arena.allocated_bytes() != kNodes * sizeof(TestNode))
+    ++bad;
+
+  // the last node is still the arena's to take back once the scope is gone
+  auto head = list;
+  list = list->next;
+  delete head;
+  if (arena.allocated_bytes() != (kNodes - 1) * sizeof(TestNode))
+    ++bad;
+
+  screen::Writef("arena test: %d bytes in %d chunks, %d problems\n",
+                 arena.allocated_bytes(), arena.chunk_count(), bad);
+  // nothing to delete one by one, it all goes here
+  arena.Reset();
+}
+
+} // namespace alloc
@@ -0,0 +1,145 @@
+/**
+ * @file arena.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * An allocator for groups of objects that are all released together.
+ */
+
+#ifndef SRC_INCLUDE_MM_ARENA_H_
+#define SRC_INCLUDE_MM_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/allocator.h"
+
+namespace alloc {
+
+/**
+ * Allocator that hands out memory by bumping a pointer through a chain of
+ * page sized chunks. Individual blocks are never freed (except the most
+ * recent one, which is cheap to take back); everything goes at once when the
+ * arena is reset or destroyed, in time proportional to the number of chunks.
+ *
+ * Use it with ScopedActiveAllocator to send a burst of operator new calls to
+ * the arena. Chunks are aligned to whole units of the kernel virtual range
+ * and each unit records the arena that owns it, so operator delete can send
+ * a block back to its arena, even after the scope has ended, without
+ * searching.
+ */
+class Arena : public Allocator {
+public:
+  /**
+   * Creates a new, empty Arena instance. Chunks come from
+   * paging::PageAllocator as they are needed.
+   */
+  Arena();
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  /**
+   * Takes a block from the current chunk, starting a new chunk if it doesn't
+   * fit. Blocks bigger than a chunk get a chunk of their own.
+   */
+  using Allocator::Allocate;
+  virtual void *Allocate(size_t size, bool align = false);
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Gives the block back if it was the last one allocated, otherwise does
+   * nothing until Reset.
+   */
+  virtual void Free(void *ptr);
+
+  /**
+   * Resizes the block if it was the last one allocated and the chunk has
+   * room, which lets a buffer being built up grow without copying.
+   */
+  virtual bool TryExpandInPlace(void *ptr, size_t new_size);
+
+  /**
+   * Releases every block and chunk.
+   */
+  void Reset();
+
+  /**
+   * Gets the number of bytes handed out since the last Reset.
+   */
+  inline size_t allocated_bytes() const { return allocated_bytes_; }
+
+  /**
+   * Gets the number of chunks the arena holds.
+   */
+  inline size_t chunk_count() const { return chunk_count_; }
+
+  /**
+   * Finds the arena whose chunks hold a block, with a range test and one
+   * lookup.
+   * @return The arena, or nullptr if the block didn't come from one.
+   */
+  static Arena *Owning(const void *ptr);
+
+private:
+  /**
+   * Placed at the start of every chunk.
+   */
+  struct Chunk {
+    Chunk *next;
+    size_t pages;
+  };
+
+  /**
+   * Maps a new chunk with room for at least size bytes and makes it current.
+   * @return False if there was no memory.
+   */
+  bool NewChunk(size_t size);
+
+  /**
+   * The most recent chunk, which blocks are carved from.
+   */
+  Chunk *chunks_;
+  uint32_t current_;
+  uint32_t end_;
+
+  /**
+   * The last block handed out, and where current_ was before it.
+   */
+  void *last_;
+  uint32_t last_start_;
+
+  size_t allocated_bytes_;
+  size_t chunk_count_;
+};
+
+/**
+ * Allocates a batch of objects through operator new while an arena is
+ * active, checks they came from the arena and that deletes inside and after
+ * the scope reach the right allocator, and resets it.
+ */
+void test_arena();
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_ARENA_H_
@@ -0,0 +1,331 @@
+/**
+ * @file cpu_cache.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/cpu_cache.h"
+
+#include <cstring>
+
+#include "mm/virtual_range.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+/**
+ * Draining the caches is cheap, and has to happen before the slab shrinker
+ * runs to do any good.
+ */
+const unsigned kCpuCacheShrinkCost = 0;
+
+} // namespace
+
+CpuCacheAllocator::CpuCacheAllocator(SizeClassAllocator &shared)
+    : Shrinker(kCpuCacheShrinkCost), shared_(shared), refills_(0),
+      flushes_(0) {
+  memset(magazines_, 0, sizeof(magazines_));
+  memset(reserves_, 0, sizeof(reserves_));
+
+  // the first ordinary allocation on each processor fills its reserves
+  for (auto &low : reserves_low_)
+    low = true;
+}
+
+void *CpuCacheAllocator::Allocate(size_t size, bool align) {
+  if (align)
+    return AllocateAligned(size, paging::kPageSize);
+  return AllocateAligned(size, kDefaultAlignment);
+}
+
+void CpuCacheAllocator::Free(void *ptr) {
+  if (ptr == nullptr)
+    return;
+
+  auto index = shared_.ClassOf(ptr);
+  if (index == SizeClassAllocator::kSizeClassCount) {
+    SpinlockGuard guard(lock_);
+    shared_.Free(ptr);
+    return;
+  }
+  FreeToMagazine(index, ptr);
+}
+
+void *CpuCacheAllocator::Allocate(size_t size, AllocFlags flags) {
+  if (!has_flag(flags, AllocFlags::kNoWait))
+    return Allocate(size);
+  if (size > SizeClassAllocator::kMaxSizeClass)
+    return nullptr;
+
+  auto index = SizeClassAllocator::ClassIndex(size);
+  auto irq_flags = save_and_disable_interrupts();
+  auto id = cpu::current_id();
+  auto &magazine = magazines_[id][index];
+  auto &reserve = reserves_[id][index];
+  void *ptr = nullptr;
+  if (magazine.count) {
+    ptr = magazine.blocks[--magazine.count];
+  } else if (has_flag(flags, AllocFlags::kAtomic) && reserve.count) {
+    ptr = reserve.blocks[--reserve.count];
+    reserves_low_[id] = true;
+  }
+  restore_interrupts(irq_flags);
+  return ptr;
+}
+
+void *CpuCacheAllocator::AllocateAligned(size_t size, size_t alignment) {
+  if (reserves_low_[cpu::current_id()])
+    RefillReserves();
+
+  auto index = SizeClassAllocator::ClassFor(size, alignment);
+  void *ptr = nullptr;
+  if (index != SizeClassAllocator::kSizeClassCount)
+    ptr = AllocateFromMagazine(index);
+
+  if (!ptr) {
+    // too big, or the class is out of memory and the fallback might help
+    SpinlockGuard guard(lock_);
+    ptr = shared_.AllocateAligned(size, alignment);
+  }
+  return ptr;
+}
+
+void CpuCacheAllocator::FreeSized(void *ptr, size_t size, size_t alignment) {
+  if (ptr == nullptr)
+    return;
+
+  auto index = SizeClassAllocator::ClassFor(size, alignment);
+  if (index == SizeClassAllocator::kSizeClassCount ||
+      reinterpret_cast<uint32_t>(ptr) < paging::kKernelVirtualRangeStart) {
+    SpinlockGuard guard(lock_);
+    shared_.FreeSized(ptr, size, alignment);
+    return;
+  }
+  FreeToMagazine(index, ptr);
+}
+
+bool CpuCacheAllocator::TryExpandInPlace(void *ptr, size_t new_size) {
+  SpinlockGuard guard(lock_);
+  return shared_.TryExpandInPlace(ptr, new_size);
+}
+
+void *CpuCacheAllocator::AllocateFromMagazine(size_t index) {
+  auto flags = save_and_disable_interrupts();
+  auto &magazine = magazines_[cpu::current_id()][index];
+  if (magazine.count == 0)
+    Refill(index, magazine);
+  void *ptr = magazine.count ? magazine.blocks[--magazine.count] : nullptr;
+  restore_interrupts(flags);
+  return ptr;
+}
+
+void CpuCacheAllocator::FreeToMagazine(size_t index, void *ptr) {
+  auto flags = save_and_disable_interrupts();
+  auto &magazine = magazines_[cpu::current_id()][index];
+  if (magazine.count == kMagazineSize)
+    Flush(magazine, kBatchSize);
+  magazine.blocks[magazine.count++] = ptr;
+  restore_interrupts(flags);
+}
+
+size_t CpuCacheAllocator::Drain() {
+  size_t drained = 0;
+  auto flags = save_and_disable_interrupts();
+  for (auto &magazine : magazines_[cpu::current_id()]) {
+    drained += magazine.count;
+    Flush(magazine, magazine.count);
+  }
+  restore_interrupts(flags);
+  return drained;
+}
+
+size_t CpuCacheAllocator::Count() {
+  size_t bytes = 0;
+  auto &magazines = magazines_[cpu::current_id()];
+  for (size_t i = 0; i < SizeClassAllocator::kSizeClassCount; ++i)
+    bytes += magazines[i].count * SizeClassAllocator::ClassSize(i);
+  return (bytes + paging::kPageSize - 1) / paging::kPageSize;
+}
+
+size_t CpuCacheAllocator::Scan(size_t /*count*/) {
+  // memory ran out inside a refill or flush, which holds the lock and may be
+  // halfway through a magazine, so leave the magazines alone
+  if (!lock_.TryLock())
+    return 0;
+  lock_.Unlock();
+  Drain();
+  return 0;
+}
+
+void CpuCacheAllocator::RefillReserves() {
+  // the lock keeps interrupts off, so this processor's atomic allocations
+  // can't get in between
+  SpinlockGuard guard(lock_);
+  auto id = cpu::current_id();
+  for (size_t i = 0; i < SizeClassAllocator::kSizeClassCount; ++i) {
+    auto &reserve = reserves_[id][i];
+    while (reserve.count < kReserveSize) {
+      auto ptr = shared_.AllocateFromClass(i);
+      if (!ptr)
+        return;
+      reserve.blocks[reserve.count++] = ptr;
+    }
+  }
+  reserves_low_[id] = false;
+}
+
+void CpuCacheAllocator::Refill(size_t index, Magazine &magazine) {
+  SpinlockGuard guard(lock_);
+  while (magazine.count < kBatchSize) {
+    auto ptr = shared_.AllocateFromClass(index);
+    if (!ptr)
+      break;
+    magazine.blocks[magazine.count++] = ptr;
+  }
+  ++refills_;
+}
+
+void CpuCacheAllocator::Flush(Magazine &magazine, size_t count) {
+  if (count == 0)
+    return;
+
+  SpinlockGuard guard(lock_);
+  while (count--)
+    shared_.Free(magazine.blocks[--magazine.count]);
+  ++flushes_;
+}
+
+namespace {
+
+/**
+ * A xorshift generator, so the benchmark is the same every boot.
+ */
+inline uint32_t NextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+uint32_t ThreadTest(Allocator &allocator) {
+  const int kRounds = 32;
+  const int kBlocks = 256;
+  void *blocks[kBlocks];
+
+  auto start = read_tsc();
+  for (int round = 0; round < kRounds; ++round) {
+    for (int i = 0; i < kBlocks; ++i)
+      blocks[i] = allocator.Allocate(64);
+    for (int i = 0; i < kBlocks; ++i)
+      allocator.Free(blocks[i]);
+  }
+  return static_cast<uint32_t>(read_tsc() - start);
+}
+
+uint32_t Larson(Allocator &allocator) {
+  const int kSlots = 512;
+  const int kReplacements = 8192;
+  void *slots[kSlots];
+  uint32_t state = 0x2545F491;
+
+  for (int i = 0; i < kSlots; ++i)
+    slots[i] = allocator.Allocate(8 + NextRandom(state) % 248);
+
+  auto start = read_tsc();
+  for (int i = 0; i < kReplacements; ++i) {
+    auto slot = NextRandom(state) % kSlots;
+    allocator.Free(slots[slot]);
+    slots[slot] = allocator.Allocate(8 + NextRandom(state) % 248);
+  }
+  auto cycles = static_cast<uint32_t>(read_tsc() - start);
+
+  for (int i = 0; i < kSlots; ++i)
+    allocator.Free(slots[i]);
+  return cycles;
+}
+
+} // namespace
+
+void test_atomic_allocation(CpuCacheAllocator &allocator) {
+  const size_t kSize = 64;
+  const size_t kCount = CpuCacheAllocator::kReserveSize + 1;
+  void *blocks[kCount];
+
+  // takes kCount atomic blocks and gives them back, returning how many
+  // there were
+  auto take_atomic = [&allocator, &blocks]() {
+    size_t taken = 0;
+    for (size_t i = 0; i < kCount; ++i) {
+      blocks[i] = allocator.Allocate(kSize, AllocFlags::kAtomic);
+      if (blocks[i])
+        ++taken;
+    }
+    for (size_t i = 0; i < kCount; ++i)
+      allocator.Free(blocks[i]);
+    allocator.Drain();
+    return taken;
+  };
+
+  // an ordinary allocation fills the reserves, then the magazines are
+  // emptied so only the reserves are left
+  allocator.Free(allocator.Allocate(kSize));
+  allocator.Drain();
+
+  size_t bad = 0;
+  auto no_wait = allocator.Allocate(kSize, AllocFlags::kNoWait);
+  if (no_wait)
+    ++bad;
+  auto first = take_atomic();
+  allocator.Free(allocator.Allocate(kSize));
+  allocator.Drain();
+  auto second = take_atomic();
+  if (first != CpuCacheAllocator::kReserveSize ||
+      second != CpuCacheAllocator::kReserveSize)
+    ++bad;
+  allocator.Free(no_wait);
+
+  screen::Writef("atomic allocation test: %d then %d from the reserve, "
+                 "%d problems\n", first, second, bad);
+}
+
+void benchmark_cpu_cache(CpuCacheAllocator &cached,
+                         SizeClassAllocator &shared) {
+  screen::Writef("cpu cache benchmark on cpu %d of %d:\n", cpu::current_id(),
+                 cpu::online_count());
+
+  // once each to warm up, so neither pays for growing its slabs
+  ThreadTest(shared);
+  ThreadTest(cached);
+  screen::Writef("  threadtest: %d cycles cached, %d shared\n",
+                 ThreadTest(cached), ThreadTest(shared));
+  screen::Writef("  larson: %d cycles cached, %d shared\n", Larson(cached),
+                 Larson(shared));
+  screen::Writef("  %d refills, %d flushes, %d blocks drained\n",
+                 cached.refills(), cached.flushes(), cached.Drain());
+}
+
+} // namespace alloc
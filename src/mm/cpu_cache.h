@@ -0,0 +1,203 @@
+/**
+ * @file cpu_cache.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Per-processor caches of free blocks in front of the shared size classes.
+ */
+
+#ifndef SRC_INCLUDE_MM_CPU_CACHE_H_
+#define SRC_INCLUDE_MM_CPU_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/allocator.h"
+#include "mm/shrinker.h"
+#include "mm/size_class.h"
+#include "sys/cpu.h"
+#include "sys/spinlock.h"
+
+namespace alloc {
+
+/**
+ * Allocator that keeps a small stack (a magazine) of free blocks per size
+ * class on every processor. Allocate and Free only touch the running
+ * processor's magazine, with interrupts briefly disabled and no lock. When a
+ * magazine runs dry it is refilled with a batch of blocks from the shared
+ * SizeClassAllocator, and when it fills up half of it is flushed back, both
+ * under a single lock acquisition. Large blocks go straight to the shared
+ * allocator under the lock.
+ *
+ * As a shrinker it drains the running processor's magazines, so their blocks
+ * can empty out slabs for the slab shrinker to release.
+ */
+class CpuCacheAllocator : public Allocator, public paging::Shrinker {
+public:
+  /**
+   * The most blocks a magazine holds.
+   */
+  static const size_t kMagazineSize = 32;
+
+  /**
+   * The number of blocks moved between a magazine and the shared allocator
+   * at once.
+   */
+  static const size_t kBatchSize = kMagazineSize / 2;
+
+  /**
+   * The number of blocks of each class kept back on every processor for
+   * kAtomic allocations.
+   */
+  static const size_t kReserveSize = 8;
+
+  /**
+   * Creates a new CpuCacheAllocator instance. cpu::Initialize must have run.
+   * @param shared The allocator behind the caches. Only this allocator may
+   * use it from now on.
+   */
+  explicit CpuCacheAllocator(SizeClassAllocator &shared);
+
+  virtual void *Allocate(size_t size, bool align = false);
+
+  /**
+   * With kNoWait, takes a block from the running processor's magazine and
+   * nothing else, with interrupts disabled and no lock. kAtomic may also
+   * take from the processor's emergency reserve, which the next ordinary
+   * allocation on that processor refills. Only size classes can be
+   * allocated this way.
+   */
+  virtual void *Allocate(size_t size, AllocFlags flags);
+  virtual void Free(void *ptr);
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Releases a block without reading its slab to find its class.
+   */
+  virtual void FreeSized(void *ptr, size_t size,
+                         size_t alignment = kDefaultAlignment);
+  virtual bool TryExpandInPlace(void *ptr, size_t new_size);
+
+  /**
+   * Returns every block cached by the running processor to the shared
+   * allocator.
+   * @return The number of blocks returned.
+   */
+  size_t Drain();
+
+  /**
+   * Estimates the pages' worth of blocks cached by the running processor.
+   */
+  virtual size_t Count();
+
+  /**
+   * Drains the running processor's magazines. Nothing is released directly,
+   * so it always returns 0.
+   */
+  virtual size_t Scan(size_t count);
+
+  /**
+   * Tops up the running processor's reserves from the shared allocator.
+   * Must not be called from an interrupt handler.
+   */
+  void RefillReserves();
+
+  /**
+   * Gets the number of times a magazine was refilled from, or flushed to,
+   * the shared allocator.
+   */
+  inline size_t refills() const { return refills_; }
+  inline size_t flushes() const { return flushes_; }
+
+private:
+  struct Magazine {
+    size_t count;
+    void *blocks[kMagazineSize];
+  };
+
+  /**
+   * Pops a block of one class off the running processor's magazine.
+   * @return The block, or nullptr if the class is out of memory.
+   */
+  void *AllocateFromMagazine(size_t index);
+
+  /**
+   * Pushes a block of one class onto the running processor's magazine.
+   */
+  void FreeToMagazine(size_t index, void *ptr);
+
+  /**
+   * Moves up to kBatchSize blocks of one class into an empty magazine.
+   */
+  void Refill(size_t index, Magazine &magazine);
+
+  /**
+   * Moves the given number of blocks off the top of a magazine back to the
+   * shared allocator.
+   */
+  void Flush(Magazine &magazine, size_t count);
+
+  SizeClassAllocator &shared_;
+
+  /**
+   * Guards shared_ and the statistics.
+   */
+  Spinlock lock_;
+  size_t refills_;
+  size_t flushes_;
+
+  Magazine magazines_[cpu::kMaxCpus][SizeClassAllocator::kSizeClassCount];
+
+  /**
+   * The emergency reserves, and whether each processor has used its own
+   * since they were last refilled.
+   */
+  struct Reserve {
+    size_t count;
+    void *blocks[kReserveSize];
+  };
+  Reserve reserves_[cpu::kMaxCpus][SizeClassAllocator::kSizeClassCount];
+  bool reserves_low_[cpu::kMaxCpus];
+};
+
+/**
+ * Checks that kAtomic allocations are served from the emergency reserve
+ * once the magazines are empty, that kNoWait ones are not, and that the
+ * reserve is refilled afterwards.
+ * @param allocator The allocator to exercise.
+ */
+void test_atomic_allocation(CpuCacheAllocator &allocator);
+
+/**
+ * Runs a threadtest style benchmark (each processor allocates and frees
+ * batches of blocks) and a larson style one (blocks are replaced at random,
+ * so they are often freed long after, and on real SMP by a different
+ * processor than, they were allocated) against both allocators and prints
+ * the cycles taken.
+ * @param cached The per-processor allocator.
+ * @param shared The shared allocator behind it.
+ */
+void benchmark_cpu_cache(CpuCacheAllocator &cached, SizeClassAllocator &shared);
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_CPU_CACHE_H_
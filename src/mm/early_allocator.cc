@@ -0,0 +1,198 @@
+/**
+ * @file early_allocator.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/early_allocator.h"
+
+#include "sys/addressing.h"
+#include "sys/kernel.h"
+
+namespace alloc {
+
+namespace {
+
+inline uint32_t round_up(uint32_t x, uint32_t align) {
+  return (x + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+EarlyAllocator::EarlyAllocator(uint32_t start, uint32_t limit)
+    : start_(start), limit_(limit), released_(false), last_start_(0),
+      last_end_(0), region_count_(0) {
+  ASSERT(start <= limit);
+}
+
+void *EarlyAllocator::Allocate(size_t size, bool align) {
+  return AllocateAligned(size, align ? paging::kPageSize : kDefaultAlignment);
+}
+
+void *EarlyAllocator::AllocateAligned(size_t size, size_t alignment) {
+  if (released_)
+    PANIC("Early allocation after the early allocator was released");
+  if (alignment < kDefaultAlignment)
+    alignment = kDefaultAlignment;
+  if (size == 0)
+    size = 1;
+
+  // first fit, walking the gaps between recorded ranges
+  auto candidate = round_up(start_, alignment);
+  for (size_t i = 0; i < region_count_; ++i) {
+    if (candidate + size <= regions_[i].start)
+      break;
+    if (regions_[i].end > candidate)
+      candidate = round_up(regions_[i].end, alignment);
+  }
+  if (candidate + size > limit_ || candidate + size < candidate)
+    return nullptr;
+  if (!Insert(candidate, candidate + size))
+    return nullptr;
+
+  last_start_ = candidate;
+  last_end_ = candidate + size;
+  return reinterpret_cast<void *>(candidate);
+}
+
+void EarlyAllocator::Free(void *ptr) {
+  auto start = reinterpret_cast<uint32_t>(ptr);
+  if (ptr == nullptr || start != last_start_)
+    return;
+  Remove(last_start_, last_end_);
+  last_start_ = last_end_ = 0;
+}
+
+void EarlyAllocator::FreeSized(void *ptr, size_t size, size_t) {
+  if (ptr == nullptr)
+    return;
+  auto start = reinterpret_cast<uint32_t>(ptr);
+  Remove(start, start + (size ? size : 1));
+  if (start == last_start_)
+    last_start_ = last_end_ = 0;
+}
+
+void EarlyAllocator::Reserve(uint32_t start, size_t size) {
+  // only the part inside our range matters
+  auto end = start + size;
+  if (start < start_)
+    start = start_;
+  if (end > limit_)
+    end = limit_;
+  if (start < end && !Insert(start, end))
+    PANIC("Too many early memory reservations");
+}
+
+size_t EarlyAllocator::Release(paging::IFrameAllocator &frames) {
+  released_ = true;
+
+  size_t released = 0, i = 0;
+  for (auto page = round_up(start_, paging::kPageSize);
+       page + paging::kPageSize <= limit_; page += paging::kPageSize) {
+    while (i < region_count_ && regions_[i].end <= page)
+      ++i;
+    if (i < region_count_ && regions_[i].start < page + paging::kPageSize)
+      continue;
+
+    auto physical = addressing::vaddress(page).ToPhysical();
+    frames.Free(paging::Frame::ContainingAddress(physical));
+    ++released;
+  }
+  return released;
+}
+
+size_t EarlyAllocator::used_bytes() const {
+  size_t used = 0;
+  for (size_t i = 0; i < region_count_; ++i)
+    used += regions_[i].end - regions_[i].start;
+  return used;
+}
+
+bool EarlyAllocator::Insert(uint32_t start, uint32_t end) {
+  // find the first region that touches or follows the new range, and how many
+  // regions it swallows
+  size_t first = 0;
+  while (first < region_count_ && regions_[first].end < start)
+    ++first;
+  size_t last = first;
+  while (last < region_count_ && regions_[last].start <= end) {
+    if (regions_[last].start < start)
+      start = regions_[last].start;
+    if (regions_[last].end > end)
+      end = regions_[last].end;
+    ++last;
+  }
+
+  if (first == last) {
+    // no overlap, so open up a slot
+    if (region_count_ == kMaxRegions)
+      return false;
+    for (auto i = region_count_; i > first; --i)
+      regions_[i] = regions_[i - 1];
+    ++region_count_;
+  } else if (last - first > 1) {
+    // close the gap left by the merged regions
+    auto merged = last - first - 1;
+    for (auto i = last; i < region_count_; ++i)
+      regions_[i - merged] = regions_[i];
+    region_count_ -= merged;
+  }
+  regions_[first].start = start;
+  regions_[first].end = end;
+  return true;
+}
+
+void EarlyAllocator::Remove(uint32_t start, uint32_t end) {
+  for (size_t i = 0; i < region_count_; ++i) {
+    auto &region = regions_[i];
+    if (region.end <= start || region.start >= end)
+      continue;
+
+    if (region.start < start && region.end > end) {
+      // splitting needs a slot; without one the range just stays recorded
+      if (region_count_ == kMaxRegions)
+        return;
+      for (auto j = region_count_; j > i + 1; --j)
+        regions_[j] = regions_[j - 1];
+      ++region_count_;
+      regions_[i + 1].start = end;
+      regions_[i + 1].end = region.end;
+      region.end = start;
+      return;
+    }
+
+    if (region.start < start) {
+      region.end = start;
+    } else if (region.end > end) {
+      region.start = end;
+    } else {
+      // completely covered, drop it
+      for (auto j = i + 1; j < region_count_; ++j)
+        regions_[j - 1] = regions_[j];
+      --region_count_;
+      --i;
+    }
+  }
+}
+
+} // namespace alloc
@@ -0,0 +1,149 @@
+/**
+ * @file early_allocator.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * The allocator used during boot, before the frame allocator and the kernel
+ * heap are ready.
+ */
+
+#ifndef SRC_INCLUDE_MM_EARLY_ALLOCATOR_H_
+#define SRC_INCLUDE_MM_EARLY_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/allocator.h"
+#include "mm/frame_allocator.h"
+
+namespace alloc {
+
+/**
+ * The end of the 4MiB the loader maps for the kernel. Early allocations must
+ * stay below it, since nothing else is mapped yet.
+ */
+const uint32_t kInitialMappingEnd = 0xC0400000;
+
+/**
+ * Allocator for the memory between the end of the kernel image and the end of
+ * the loader's initial mapping. It keeps a sorted list of every range in use,
+ * whether handed out or reserved for something else (like the multiboot
+ * information), and fits new blocks into the gaps. Once the real allocators
+ * are up, Release gives every untouched page to the frame allocator.
+ */
+class EarlyAllocator : public Allocator {
+public:
+  /**
+   * The most separate ranges that can be recorded. Adjacent ranges merge, so
+   * this only limits how fragmented early memory may get.
+   */
+  static const size_t kMaxRegions = 32;
+
+  /**
+   * Creates a new EarlyAllocator instance.
+   * @param start The first address it may hand out.
+   * @param limit The address it must stay below.
+   */
+  EarlyAllocator(uint32_t start, uint32_t limit);
+
+  using Allocator::Allocate;
+  virtual void *Allocate(size_t size, bool align = false);
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Only takes back the most recent block, since the size of any other isn't
+   * known. Use FreeSized to give back an older one.
+   */
+  virtual void Free(void *ptr);
+
+  /**
+   * Removes the block from the record so its pages can be released. Blocks
+   * still in use at Release keep their pages, even once they are freed.
+   */
+  virtual void FreeSized(void *ptr, size_t size,
+                         size_t alignment = kDefaultAlignment);
+
+  /**
+   * Marks a range as in use by something other than this allocator.
+   * @param start The first address of the range.
+   * @param size The size of the range in bytes.
+   */
+  void Reserve(uint32_t start, size_t size);
+
+  /**
+   * Hands every page no recorded range touches to the frame allocator. No
+   * more allocations can be made afterwards. The frame allocator must have
+   * been told to leave [start, limit) alone.
+   * @param frames The frame allocator to release the pages to.
+   * @return The number of frames released.
+   */
+  size_t Release(paging::IFrameAllocator &frames);
+
+  inline uint32_t limit() const { return limit_; }
+
+  /**
+   * Gets the number of bytes covered by recorded ranges.
+   */
+  size_t used_bytes() const;
+
+private:
+  struct Region {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  /**
+   * Records [start, end), merging it with any ranges it touches.
+   * @return False if there was no room for another region.
+   */
+  bool Insert(uint32_t start, uint32_t end);
+
+  /**
+   * Removes [start, end) from the record.
+   */
+  void Remove(uint32_t start, uint32_t end);
+
+  uint32_t start_;
+  uint32_t limit_;
+  bool released_;
+
+  /**
+   * The most recent block, for Free.
+   */
+  uint32_t last_start_;
+  uint32_t last_end_;
+
+  /**
+   * Sorted by address, never overlapping or touching.
+   */
+  Region regions_[kMaxRegions];
+  size_t region_count_;
+};
+
+/**
+ * Gets the allocator that serves operator new until the heap is up.
+ */
+EarlyAllocator &GetEarlyAllocator();
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_EARLY_ALLOCATOR_H_
@@ -0,0 +1,185 @@
+/**
+ * @file heap_profile.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/heap_profile.h"
+
+#include "sys/kernel.h"
+#include "sys/spinlock.h"
+#include "sys/symbols.h"
+
+namespace alloc {
+
+namespace {
+
+/**
+ * Placed in front of every profiled block.
+ */
+struct Header {
+  /**
+   * The distance back from the caller's pointer to the start of the block,
+   * which is the alignment for aligned blocks, so it needs all 32 bits.
+   */
+  uint32_t offset;
+  uint32_t size;
+  uint32_t alignment;
+
+  /**
+   * Where the call site's statistics are in g_sites. Shares a word with the
+   * magic to keep the header at 16 bytes.
+   */
+  uint16_t slot;
+  uint16_t magic;
+};
+
+static_assert(sizeof(Header) == 16, "blocks must stay aligned past it");
+
+const uint16_t kHeaderMagic = 0x1A7C;
+
+struct CallSite {
+  uint32_t address;
+  uint32_t count;
+  uint32_t bytes;
+  uint32_t live_count;
+  uint32_t live_bytes;
+};
+
+/**
+ * An open addressed hash table of call sites. The last slot is kept for
+ * sites that don't fit.
+ */
+CallSite g_sites[kMaxCallSites + 1];
+const uint16_t kOverflowSlot = kMaxCallSites;
+Spinlock g_lock;
+
+uint16_t FindSlot(uint32_t address) {
+  // return addresses are spread out enough that a multiplicative hash does
+  auto slot = (address * 2654435761u) % kMaxCallSites;
+  for (size_t probe = 0; probe < kMaxCallSites; ++probe) {
+    auto &site = g_sites[slot];
+    if (site.address == address)
+      return slot;
+    if (site.address == 0) {
+      site.address = address;
+      return slot;
+    }
+    slot = (slot + 1) % kMaxCallSites;
+  }
+  return kOverflowSlot;
+}
+
+} // namespace
+
+void *ProfiledAllocate(Allocator &allocator, size_t size, size_t alignment,
+                       void *site) {
+  // the header goes in the padding in front of the aligned block
+  size_t offset = sizeof(Header);
+  void *block;
+  if (alignment <= kDefaultAlignment) {
+    alignment = kDefaultAlignment;
+    block = allocator.Allocate(size + offset);
+  } else {
+    if (offset < alignment)
+      offset = alignment;
+    block = allocator.AllocateAligned(size + offset, alignment);
+  }
+  if (!block)
+    return nullptr;
+
+  auto ptr = static_cast<uint8_t *>(block) + offset;
+  auto header = reinterpret_cast<Header *>(ptr) - 1;
+  header->offset = offset;
+  header->size = size;
+  header->alignment = alignment;
+  header->magic = kHeaderMagic;
+
+  SpinlockGuard guard(g_lock);
+  header->slot = FindSlot(reinterpret_cast<uint32_t>(site));
+  auto &stats = g_sites[header->slot];
+  ++stats.count;
+  stats.bytes += size;
+  ++stats.live_count;
+  stats.live_bytes += size;
+  return ptr;
+}
+
+void ProfiledFree(Allocator &allocator, void *ptr) {
+  if (ptr == nullptr)
+    return;
+
+  auto header = static_cast<Header *>(ptr) - 1;
+  ASSERT(header->magic == kHeaderMagic);
+  header->magic = 0;
+  {
+    SpinlockGuard guard(g_lock);
+    auto &stats = g_sites[header->slot];
+    --stats.live_count;
+    stats.live_bytes -= header->size;
+  }
+
+  auto block = static_cast<uint8_t *>(ptr) - header->offset;
+  allocator.FreeSized(block, header->size + header->offset, header->alignment);
+}
+
+void DumpHeapProfile(serial::Port &port) {
+  // sort by live bytes with a selection over a snapshot of the table, which
+  // is small enough not to bother with anything cleverer
+  static CallSite sorted[kMaxCallSites + 1];
+  size_t count = 0;
+  {
+    SpinlockGuard guard(g_lock);
+    for (auto &site : g_sites) {
+      if (site.count)
+        sorted[count++] = site;
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = i + 1; j < count; ++j) {
+      if (sorted[j].live_bytes > sorted[i].live_bytes) {
+        auto swap = sorted[i];
+        sorted[i] = sorted[j];
+        sorted[j] = swap;
+      }
+    }
+  }
+
+  port.Writef("heap profile: %d call sites\n", count);
+  port.Writef("  live bytes  live  total bytes  total  site\n");
+  for (size_t i = 0; i < count; ++i) {
+    auto &site = sorted[i];
+    port.Writef("  %d  %d  %d  %d  ", site.live_bytes, site.live_count,
+                site.bytes, site.count);
+    uint32_t offset;
+    auto name = site.address ? symbols::Lookup(site.address, &offset) : nullptr;
+    if (!site.address)
+      port.Writef("(other sites)\n");
+    else if (name)
+      port.Writef("%s+0x%x\n", name, offset);
+    else
+      port.Writef("0x%x\n", site.address);
+  }
+}
+
+} // namespace alloc
@@ -0,0 +1,72 @@
+/**
+ * @file heap_profile.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Optional per call site accounting of operator new, enabled by building with
+ * HEAP_PROFILE defined.
+ */
+
+#ifndef SRC_INCLUDE_MM_HEAP_PROFILE_H_
+#define SRC_INCLUDE_MM_HEAP_PROFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dev/serial.h"
+#include "mm/allocator.h"
+
+namespace alloc {
+
+/**
+ * The most distinct call sites that can be told apart. Allocations from any
+ * more are counted together under an unknown site.
+ */
+const size_t kMaxCallSites = 256;
+
+/**
+ * Allocates a block with a small header in front recording who asked for it,
+ * and counts it against that call site.
+ * @param allocator The allocator to take the block from.
+ * @param size The size the caller asked for.
+ * @param alignment The alignment the caller asked for.
+ * @param site The caller's return address.
+ */
+void *ProfiledAllocate(Allocator &allocator, size_t size, size_t alignment,
+                       void *site);
+
+/**
+ * Frees a block from ProfiledAllocate and takes it off its call site's live
+ * total.
+ */
+void ProfiledFree(Allocator &allocator, void *ptr);
+
+/**
+ * Writes the statistics of every call site, most live bytes first, to a
+ * serial port, naming each site from the kernel's symbol table.
+ * @param port The port to write to.
+ */
+void DumpHeapProfile(serial::Port &port);
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_HEAP_PROFILE_H_
@@ -1,424 +1,533 @@
-// /**
-//  * @file kheap.cc
-//  *
-//  * @section LICENSE
-//  *
-//  * Copyright (C) 2013  Ryan Bunker
-//  *
-//  * This program is free software: you can redistribute it and/or modify
-//  * it under the terms of the GNU General Public License as published by
-//  * the Free Software Foundation, either version 3 of the License, or
-//  * (at your option) any later version.
-//  *
-//  * This program is distributed in the hope that it will be useful,
-//  * but WITHOUT ANY WARRANTY; without even the implied warranty of
-//  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-//  * GNU General Public License for more details.
-//  *
-//  * You should have received a copy of the GNU General Public License
-//  * along with this program.  If not, see [http://www.gnu.org/licenses/].
-//  *
-//  * @section DESCRIPTION
-//  *
-//  */
-
-// #include "mm/kheap.h"
-
-// #include <cstring>
-
-// #include "mm/page_allocator.h"
-// #include "mm/paging.h"
-// #include "sys/addressing.h"
-// #include "sys/kernel.h"
-
-// namespace alloc {
-
-// /**
-//  * The amount of space to use to store the heap index.
-//  */
-// const uint32_t kHeapIndexSize = 0x4000;
-
-// /**
-//  * The minimum size of the heap.
-//  */
-// const size_t kHeapMinSize = 0x70000;
-
-// KHeap::KHeap(void *start_address, void *end_address, void *max_address,
-//              bool supervisor, bool readonly)
-//     : start_address_(reinterpret_cast<uint32_t>(start_address)),
-//       end_address_(reinterpret_cast<uint32_t>(end_address)),
-//       max_address_(reinterpret_cast<uint32_t>(max_address)),
-//       supervisor_(supervisor), readonly_(readonly),
-//       index_(static_cast<KHeap::Header **>(start_address), kHeapIndexSize) {
-//   // assert that the start and end address are page aligned
-//   ASSERT(start_address_ % paging::kPageSize == 0);
-//   ASSERT(end_address_ % paging::kPageSize == 0);
-
-//   // Shift the start address forward to resemble where we can start putting data
-//   start_address_ += sizeof(KHeap::Header) * kHeapIndexSize;
-
-//   // Make sure the start address is page-aligned
-//   if ((start_address_ & paging::kPageAlignMask) != 0) {
-//     start_address_ &= paging::kPageAlignMask;
-//     start_address_ += paging::kPageSize;
-//   }
-
-//   // We start off with one large hole in the index
-//   KHeap::Header *hole = reinterpret_cast<KHeap::Header *>(start_address_);
-//   hole->size = end_address_ - start_address_;
-//   hole->magic = Magic::kValue;
-//   hole->is_hole = true;
-//   index_.Insert(hole);
-// }
-
-// void *KHeap::Allocate(size_t size, bool align) {
-//   // make sure we take the size of header/footer into account
-//   size_t new_size = size + sizeof(KHeap::Header) + sizeof(KHeap::Footer);
-//   // find the smallest hole that will fit
-//   int iterator = FindSmallestHole(new_size, align);
-
-//   if (iterator == -1) {
-//     // if we didn't find a suitable hole save some previous data
-//     uint32_t old_length = end_address_ - start_address_;
-//     uint32_t old_end_address = end_address_;
-
-//     // we need to allocate some more space
-//     Expand(old_length + new_size);
-//     uint32_t new_length = end_address_ - start_address_;
-
-//     // find the endmost header (not endmost in size, but in location)
-//     // index and value of the endmost header found so far
-//     int idx = -1;
-//     uint32_t value = 0x0;
-//     for (iterator = 0; iterator < index_.size(); ++iterator) {
-//       uint32_t tmp = reinterpret_cast<uint32_t>(index_[iterator]);
-//       if (tmp <= value)
-//         continue;
-//       value = tmp;
-//       idx = iterator;
-//     }
-
-//     // if we didn't find ANY headers, we need to add one
-//     if (idx == -1) {
-//       KHeap::Header *header =
-//           reinterpret_cast<KHeap::Header *>(old_end_address);
-//       header->magic = Magic::kValue;
-//       header->size = new_length - old_length;
-//       header->is_hole = true;
-
-//       KHeap::Footer *footer = reinterpret_cast<KHeap::Footer *>(
-//           old_end_address + header->size - sizeof(KHeap::Footer));
-//       footer->magic = Magic::kValue;
-//       footer->header = header;
-//       index_.Insert(header);
-//     } else {
-//       // the last header needs adjusting
-//       KHeap::Header *header = index_[idx];
-//       header->size += new_length - old_length;
-//       // rewrite the footer
-//       KHeap::Footer *footer = reinterpret_cast<KHeap::Footer *>(
-//           reinterpret_cast<uint32_t>(header) + header->size -
-//           sizeof(KHeap::Footer));
-//       footer->header = header;
-//       footer->magic = Magic::kValue;
-//     }
-
-//     // we now have enough space. Recurse, and call the function again
-//     return Allocate(size, align);
-//   } // if no hole found
-
-//   KHeap::Header *orig_hole_header = index_[iterator];
-//   uint32_t orig_hole_pos = reinterpret_cast<uint32_t>(orig_hole_header);
-//   uint32_t orig_hole_size = orig_hole_header->size;
-//   // here we work out if we should split the hole we found into two parts
-//   // is the original hole size - requested hole size less than the overhead for
-//   // adding a new hole?
-//   size_t overhead = sizeof(KHeap::Header) + sizeof(KHeap::Footer);
-//   if (orig_hole_size - new_size < overhead) {
-//     // then just increase the requested size to the size of the hole we found
-//     size += orig_hole_size - new_size;
-//     new_size = orig_hole_size;
-//   }
-
-//   // if we need to page-align the data, do it now and make a new hole in front
-//   // of our block.
-//   if (align && (orig_hole_pos & paging::kPageAlignMask)) {
-//     uint32_t new_location = orig_hole_pos + paging::kPageSize -
-//                             (orig_hole_pos & 0xFFF) - sizeof(KHeap::Header);
-
-//     KHeap::Header *hole_header =
-//         reinterpret_cast<KHeap::Header *>(orig_hole_pos);
-//     hole_header->size =
-//         paging::kPageSize - (orig_hole_pos & 0xFFF) - sizeof(KHeap::Header);
-//     hole_header->magic = Magic::kValue;
-//     hole_header->is_hole = true;
-
-//     KHeap::Footer *hole_footer =
-//         reinterpret_cast<KHeap::Footer *>(new_location - sizeof(KHeap::Footer));
-//     hole_footer->magic = Magic::kValue;
-//     hole_footer->header = hole_header;
-//     orig_hole_pos = new_location;
-//     orig_hole_size = orig_hole_size - hole_header->size;
-//   } else {
-//     // else we don't need this hole any more, delete it from the index
-//     index_.Remove(iterator);
-//   }
-
-//   // overwrite the original header...
-//   KHeap::Header *block_header =
-//       reinterpret_cast<KHeap::Header *>(orig_hole_pos);
-//   block_header->magic = Magic::kValue;
-//   block_header->is_hole = false;
-//   block_header->size = new_size;
-
-//   // ...and the footer
-//   KHeap::Footer *block_footer = reinterpret_cast<KHeap::Footer *>(
-//       orig_hole_pos + sizeof(KHeap::Header) + size);
-//   block_footer->magic = Magic::kValue;
-//   block_footer->header = block_header;
-
-//   // we may need to write a new hole after the allocated block
-//   // we do this only if the new hole would have positive size...
-//   if (orig_hole_size - new_size > 0) {
-//     KHeap::Header *hole_header = reinterpret_cast<KHeap::Header *>(
-//         orig_hole_pos + sizeof(KHeap::Header) + size + sizeof(KHeap::Footer));
-//     hole_header->magic = Magic::kValue;
-//     hole_header->is_hole = true;
-//     hole_header->size = orig_hole_size - new_size;
-
-//     KHeap::Footer *hole_footer = reinterpret_cast<KHeap::Footer *>(
-//         reinterpret_cast<uint32_t>(hole_header) + orig_hole_size - new_size -
-//         sizeof(KHeap::Footer));
-//     if (reinterpret_cast<uint32_t>(hole_footer) < end_address_) {
-//       hole_footer->magic = Magic::kValue;
-//       hole_footer->header = hole_header;
-//     }
-
-//     // put the new hole in the index
-//     index_.Insert(hole_header);
-//   }
-
-//   // ...and we're done!
-//   return reinterpret_cast<void *>(reinterpret_cast<uint32_t>(block_header) +
-//                                   sizeof(KHeap::Header));
-// }
-
-// void KHeap::Free(void *p) {
-//   // exit gracefully for null pointers
-//   if (p == nullptr)
-//     return;
-
-//   // get the header and footer associated with this pointer
-//   KHeap::Header *header = reinterpret_cast<KHeap::Header *>(
-//       reinterpret_cast<uint32_t>(p) - sizeof(KHeap::Header));
-//   KHeap::Footer *footer =
-//       reinterpret_cast<KHeap::Footer *>(reinterpret_cast<uint32_t>(header) +
-//                                         header->size - sizeof(KHeap::Footer));
-
-//   // sanity checks
-//   ASSERT(header->magic == Magic::kValue);
-//   ASSERT(footer->magic == Magic::kValue);
-
-//   // make us a hole
-//   header->is_hole = true;
-
-//   // do we want to add this header into the 'free holes' index?
-//   bool do_add = true;
-
-//   // == unify left ==
-//   // if the thing immediately to the left of us is a footer...
-//   KHeap::Footer *test_footer = reinterpret_cast<KHeap::Footer *>(
-//       reinterpret_cast<uint32_t>(header) - sizeof(KHeap::Footer));
-//   if (test_footer->magic == Magic::kValue && test_footer->header->is_hole) {
-//     // cache our current size
-//     uint32_t cache_size = header->size;
-//     // rewrite our header with the new one
-//     header = test_footer->header;
-//     // rewrite our footer to point to the new header
-//     footer->header = header;
-//     // change the size
-//     header->size += cache_size;
-//     // since this header is already in the index, we don't want to add it again
-//     do_add = false;
-//   }
-
-//   // == unify right ==
-//   // if the thing immediately to the right of us is a header...
-//   KHeap::Header *test_header = reinterpret_cast<KHeap::Header *>(
-//       reinterpret_cast<uint32_t>(footer) + sizeof(KHeap::Footer));
-//   if (test_header->magic == Magic::kValue && test_header->is_hole) {
-//     // increase our size
-//     header->size += test_header->size;
-//     // rewrite it's footer to point to our header
-//     test_footer = reinterpret_cast<KHeap::Footer *>(
-//         reinterpret_cast<uint32_t>(test_header) + test_header->size -
-//         sizeof(KHeap::Footer));
-//     footer = test_footer;
-//     // find and remove this header from the index
-//     int iterator = 0;
-//     while ((iterator < index_.size()) && (index_[iterator] != test_header))
-//       iterator++;
-
-//     // make sure we actually found the item
-//     ASSERT(iterator < index_.size());
-//     // remove it
-//     index_.Remove(iterator);
-//   }
-
-//   // if the footer location is the end address, we can contract
-//   if (reinterpret_cast<uint32_t>(footer) + sizeof(KHeap::Footer) ==
-//       end_address_) {
-//     uint32_t old_length = end_address_ - start_address_;
-//     uint32_t new_length =
-//         Contract(reinterpret_cast<uint32_t>(header) - start_address_);
-//     // check how big we will be after resizing
-//     if (header->size - (old_length - new_length) > 0) {
-//       // we will still exist, so resize us
-//       header->size -= old_length - new_length;
-//       footer = reinterpret_cast<KHeap::Footer *>(
-//           reinterpret_cast<uint32_t>(header) + header->size -
-//           sizeof(KHeap::Footer));
-//       footer->magic = Magic::kValue;
-//       footer->header = header;
-//     } else {
-//       // we will no longer exist :( so remove us from the index
-//       int iterator = 0;
-//       while ((iterator < index_.size()) && (index_[iterator] != test_header))
-//         iterator++;
-//       // if we didn't find ourselves, we have nothing to remove
-//       if (iterator < index_.size())
-//         index_.Remove(iterator);
-//     }
-//   }
-
-//   if (do_add)
-//     index_.Insert(header);
-// }
-
-// int32_t KHeap::FindSmallestHole(size_t size, bool align) {
-//   // find the smallest hole that will fit
-//   int iterator = 0;
-//   while (iterator < index_.size()) {
-//     KHeap::Header *header = index_[iterator];
-//     // if the user has requested the memory be page-aligned
-//     if (align) {
-//       // page-align the starting point of this header
-//       uint32_t location = reinterpret_cast<uint32_t>(&header);
-//       int32_t offset = 0;
-//       if (((location + sizeof(KHeap::Header)) & paging::kPageAlignMask) != 0)
-//         offset = paging::kPageSize -
-//                  (location + sizeof(KHeap::Header)) % paging::kPageSize;
-//       int32_t hole_size = static_cast<int32_t>(header->size) - offset;
-//       // can we fit now?
-//       if (hole_size >= static_cast<int32_t>(size))
-//         break;
-//     } else if (header->size >= size) {
-//       break;
-//     }
-//     ++iterator;
-//   }
-
-//   // why did the loop exit?
-//   if (iterator == index_.size())
-//     return -1; // we got to the end and didn't find anything
-//   else
-//     return iterator;
-// }
-
-// void KHeap::Expand(size_t new_size) {
-//   ASSERT(new_size > end_address_ - start_address_);
-
-//   // get the nearest following page boundary
-//   if ((new_size & paging::kPageAlignMask) != 0) {
-//     new_size &= paging::kPageAlignMask;
-//     new_size += paging::kPageSize;
-//   }
-//   // make sure we are not over-reaching ourselves
-//   ASSERT(start_address_ + new_size <= max_address_);
-
-//   // this should always be on a page boundary
-//   size_t old_size = end_address_ - start_address_;
-//   uint32_t frames_needed = (new_size - old_size) / paging::kPageSize;
-//   paging::Page *first_frame =
-//       paging::PageAllocator::instance().AllocatePages(frames_needed);
-//   for (uint32_t i = 0; i < frames_needed; ++i, ++first_frame)
-//     paging::PageDirectory::current_directory()->MapPage(
-//         first_frame,
-//         reinterpret_cast<void *>(end_address_ + i * paging::kPageSize));
-
-//   end_address_ = start_address_ + new_size;
-// }
-
-// size_t KHeap::Contract(size_t new_size) {
-//   ASSERT(new_size < end_address_ - start_address_);
-
-//   // get the nearest following page boundary
-//   if (new_size & paging::kPageSize) {
-//     new_size &= paging::kPageSize;
-//     new_size += paging::kPageSize;
-//   }
-
-//   // don't contract too far!
-//   if (new_size < kHeapMinSize)
-//     new_size = kHeapMinSize;
-
-//   size_t old_size = end_address_ - start_address_;
-
-//   for (uint32_t i = old_size - paging::kPageSize; new_size < i;
-//        i -= paging::kPageSize) {
-//     paging::Page *frame = paging::PageDirectory::current_directory()->UnmapPage(
-//         reinterpret_cast<void *>(i));
-//     paging::PageAllocator::instance().FreePage(*frame);
-//   }
-
-//   end_address_ = start_address_ + new_size;
-//   return new_size;
-// }
-
-// KHeap::OrderedHeaderArray::OrderedHeaderArray(uint32_t max_size)
-//     : array_(new KHeap::Header *[max_size]), size_(0), max_size_(max_size) {
-//   memset(array_, 0, max_size * sizeof(KHeap::Header *));
-// }
-
-// KHeap::OrderedHeaderArray::OrderedHeaderArray(KHeap::Header **addr,
-//                                               uint32_t max_size)
-//     : array_(addr), size_(0), max_size_(max_size) {
-//   memset(array_, 0, max_size * sizeof(KHeap::Header *));
-// }
-
-// KHeap::OrderedHeaderArray::~OrderedHeaderArray() { delete[] array_; }
-
-// bool KHeap::OrderedHeaderArray::Insert(const KHeap::Header *item) {
-//   if (size_ == max_size_)
-//     return false;
-
-//   int iterator = 0;
-//   while (iterator < size_ && array_[iterator]->size < item->size)
-//     iterator++;
-//   if (iterator == size_) { // just add at the end of the array.
-//     array_[size_++] = const_cast<KHeap::Header *>(item);
-//   } else {
-//     KHeap::Header *tmp = array_[iterator];
-//     array_[iterator] = const_cast<KHeap::Header *>(item);
-//     while (iterator < size_) {
-//       ++iterator;
-//       KHeap::Header *tmp2 = array_[iterator];
-//       array_[iterator] = tmp;
-//       tmp = tmp2;
-//     }
-//     ++size_;
-//   }
-//   return true;
-// }
-
-// KHeap::Header *KHeap::OrderedHeaderArray::operator[](const int index) {
-//   return array_[index];
-// }
-
-// void KHeap::OrderedHeaderArray::Remove(int i) {
-//   for (; i < size_; ++i)
-//     array_[i] = array_[i + 1];
-//   --size_;
-// }
-
-// } // namespace alloc
+/**
+ * @file kheap.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/kheap.h"
+
+#include <cstring>
+
+#include "mm/paging.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+/**
+ * The least the heap grows by at once, so that a run of small allocations
+ * doesn't map one page at a time.
+ */
+const size_t kHeapMinGrowth = 0x10000;
+
+inline size_t round_up(size_t x, size_t align) {
+  return (x + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+KHeap::KHeap(void *start_address, void *end_address, void *max_address,
+             void *large_end, bool supervisor, bool readonly,
+             paging::IFrameAllocator &frames, paging::IPageMapper &mapper)
+    : start_address_(reinterpret_cast<uint32_t>(start_address)),
+      end_address_(reinterpret_cast<uint32_t>(end_address)),
+      max_address_(reinterpret_cast<uint32_t>(max_address)),
+      large_end_(reinterpret_cast<uint32_t>(large_end)),
+      supervisor_(supervisor), readonly_(readonly), frames_(frames),
+      mapper_(mapper), sentinel_(nullptr), used_bytes_(0), large_bytes_(0),
+      large_ranges_(reinterpret_cast<uint32_t>(max_address),
+                    (large_end_ - max_address_) / paging::kPageSize),
+      fl_bitmap_(0) {
+  // assert that the start and end address are page aligned
+  ASSERT(start_address_ % paging::kPageSize == 0);
+  ASSERT(end_address_ % paging::kPageSize == 0);
+  ASSERT(start_address_ < end_address_ && end_address_ <= max_address_);
+  ASSERT(max_address_ - start_address_ < (1u << kFirstLevelMax));
+
+  memset(sl_bitmap_, 0, sizeof(sl_bitmap_));
+  memset(free_lists_, 0, sizeof(free_lists_));
+
+  if (!MapPages(start_address_, end_address_))
+    PANIC("Not enough memory for the kernel heap");
+
+  // We start off with one large free block, followed by the sentinel
+  auto block = reinterpret_cast<Block *>(start_address_);
+  sentinel_ = reinterpret_cast<Block *>(end_address_ - kOverhead);
+  block->prev_physical = nullptr;
+  block->size_and_flags = reinterpret_cast<uint8_t *>(sentinel_) -
+                          static_cast<uint8_t *>(block->payload());
+  sentinel_->prev_physical = block;
+  sentinel_->size_and_flags = 0;
+  InsertFree(block);
+}
+
+void *KHeap::Allocate(size_t size, bool align) {
+  if (size >= kLargeAllocationSize)
+    return AllocateLarge(size);
+  if (align)
+    return AllocateAligned(size, paging::kPageSize);
+
+  size = size < kMinBlockSize ? kMinBlockSize : round_up(size, kAlign);
+  auto block = Take(size);
+  if (!block && Expand(size))
+    block = Take(size);
+  if (!block)
+    return nullptr;
+
+  Trim(block, size);
+  block->set_free(false);
+  used_bytes_ += block->size() + kOverhead;
+  return block->payload();
+}
+
+void KHeap::Free(void *ptr) {
+  // exit gracefully for null pointers
+  if (ptr == nullptr)
+    return;
+
+  auto address = reinterpret_cast<uint32_t>(ptr);
+  if (is_large(address)) {
+    FreeLarge(ptr);
+    return;
+  }
+  ASSERT(address > start_address_ && address < end_address_);
+  auto block = Block::from_payload(ptr);
+  ASSERT(!block->is_free());
+
+  used_bytes_ -= block->size() + kOverhead;
+  block->set_free(true);
+  InsertFree(Coalesce(block));
+}
+
+bool KHeap::TryExpandInPlace(void *ptr, size_t new_size) {
+  auto address = reinterpret_cast<uint32_t>(ptr);
+  if (is_large(address))
+    return ResizeLarge(address, new_size);
+  ASSERT(address > start_address_ && address < end_address_);
+  return ResizeBlock(Block::from_payload(ptr), new_size);
+}
+
+void *KHeap::Reallocate(void *ptr, size_t old_size, size_t new_size) {
+  if (ptr == nullptr)
+    return Allocate(new_size);
+  if (new_size == 0) {
+    Free(ptr);
+    return nullptr;
+  }
+  if (TryExpandInPlace(ptr, new_size))
+    return ptr;
+
+  auto address = reinterpret_cast<uint32_t>(ptr);
+  if (is_large(address))
+    return MoveLarge(address, new_size);
+
+  // only growing can fail, so the whole old block is copied
+  auto moved = Allocate(new_size);
+  if (!moved)
+    return nullptr;
+  memcpy(moved, ptr, Block::from_payload(ptr)->size());
+  Free(ptr);
+  return moved;
+}
+
+bool KHeap::ResizeBlock(Block *block, size_t size) {
+  ASSERT(!block->is_free());
+  size = size < kMinBlockSize ? kMinBlockSize : round_up(size, kAlign);
+
+  auto next = block->next_physical();
+  auto room = block->size();
+  if (next->is_free())
+    room += kOverhead + next->size();
+  if (room < size) {
+    // the last block can grow the heap, which merges into a free next block
+    auto last = next->is_free() ? next->next_physical() : next;
+    if (last != sentinel_ || !Expand(size - room))
+      return false;
+    next = block->next_physical();
+    if (block->size() + kOverhead + next->size() < size)
+      return false;
+  }
+
+  used_bytes_ -= block->size();
+  if (next->is_free()) {
+    RemoveFree(next);
+    block->set_size(block->size() + kOverhead + next->size());
+    block->next_physical()->prev_physical = block;
+  }
+  Trim(block, size);
+  used_bytes_ += block->size();
+  return true;
+}
+
+KHeap::Block *KHeap::FindSuitable(uint32_t &fl, uint32_t &sl) {
+  if (fl >= kFirstLevelCount)
+    return nullptr;
+
+  // anything left in this first level?
+  auto sl_map = sl_bitmap_[fl] & (~0u << sl);
+  if (!sl_map) {
+    // no, so move on to the next non-empty first level
+    auto fl_map = fl + 1 < 32 ? fl_bitmap_ & (~0u << (fl + 1)) : 0;
+    if (!fl_map)
+      return nullptr;
+    fl = __builtin_ctz(fl_map);
+    sl_map = sl_bitmap_[fl];
+  }
+  sl = __builtin_ctz(sl_map);
+  return free_lists_[fl][sl];
+}
+
+void KHeap::InsertFree(Block *block) {
+  uint32_t fl, sl;
+  tlsf::MappingInsert(block->size(), fl, sl);
+  auto head = free_lists_[fl][sl];
+  block->next_free = head;
+  block->prev_free = nullptr;
+  if (head)
+    head->prev_free = block;
+  free_lists_[fl][sl] = block;
+  fl_bitmap_ |= 1u << fl;
+  sl_bitmap_[fl] |= 1u << sl;
+  block->set_free(true);
+}
+
+void KHeap::RemoveFree(Block *block) {
+  uint32_t fl, sl;
+  tlsf::MappingInsert(block->size(), fl, sl);
+  if (block->next_free)
+    block->next_free->prev_free = block->prev_free;
+  if (block->prev_free) {
+    block->prev_free->next_free = block->next_free;
+    return;
+  }
+
+  // it was the head of its list
+  free_lists_[fl][sl] = block->next_free;
+  if (!block->next_free) {
+    sl_bitmap_[fl] &= ~(1u << sl);
+    if (!sl_bitmap_[fl])
+      fl_bitmap_ &= ~(1u << fl);
+  }
+}
+
+void KHeap::Trim(Block *block, size_t size) {
+  if (block->size() < size + kOverhead + kMinBlockSize)
+    return;
+
+  auto rest = reinterpret_cast<Block *>(
+      static_cast<uint8_t *>(block->payload()) + size);
+  rest->prev_physical = block;
+  rest->size_and_flags = block->size() - size - kOverhead;
+  block->set_size(size);
+  rest->next_physical()->prev_physical = rest;
+  InsertFree(rest);
+}
+
+KHeap::Block *KHeap::Coalesce(Block *block) {
+  auto prev = block->prev_physical;
+  if (prev && prev->is_free()) {
+    RemoveFree(prev);
+    prev->set_size(prev->size() + kOverhead + block->size());
+    block = prev;
+    block->next_physical()->prev_physical = block;
+  }
+
+  auto next = block->next_physical();
+  if (next->is_free()) {
+    RemoveFree(next);
+    block->set_size(block->size() + kOverhead + next->size());
+    block->next_physical()->prev_physical = block;
+  }
+  return block;
+}
+
+KHeap::Block *KHeap::Take(size_t size) {
+  uint32_t fl, sl;
+  tlsf::MappingSearch(size, fl, sl);
+  auto block = FindSuitable(fl, sl);
+  if (block)
+    RemoveFree(block);
+  return block;
+}
+
+paging::Entry::Flags KHeap::page_flags() const {
+  auto flags = paging::Entry::Flags::None;
+  if (!readonly_)
+    flags = flags | paging::Entry::Flags::Writable;
+  if (!supervisor_)
+    flags = flags | paging::Entry::Flags::UserAccessible;
+  return flags;
+}
+
+bool KHeap::MapPages(uint32_t from, uint32_t to) {
+  auto flags = page_flags();
+  for (auto addr = from; addr < to; addr += paging::kPageSize) {
+    auto frame = frames_.Allocate();
+    if (!frame || !mapper_.Map(paging::Page::ContainingAddress(addr), *frame,
+                               flags, frames_)) {
+      // give back what we got so far
+      if (frame)
+        frames_.Free(*frame);
+      UnmapPages(from, addr);
+      return false;
+    }
+  }
+  return true;
+}
+
+void KHeap::UnmapPages(uint32_t from, uint32_t to) {
+  for (auto addr = from; addr < to; addr += paging::kPageSize)
+    frames_.Free(mapper_.Unmap(paging::Page::ContainingAddress(addr), frames_));
+}
+
+void *KHeap::AllocateLarge(size_t size) {
+  auto pages = round_up(size, paging::kPageSize) / paging::kPageSize;
+  auto first = large_ranges_.Allocate(pages);
+  if (!first)
+    return nullptr;
+
+  auto from = static_cast<uint32_t>(first->start_address());
+  if (!MapPages(from, from + pages * paging::kPageSize)) {
+    large_ranges_.Free(*first, pages);
+    return nullptr;
+  }
+  large_bytes_ += pages * paging::kPageSize;
+  return reinterpret_cast<void *>(from);
+}
+
+void KHeap::FreeLarge(void *ptr) {
+  auto from = reinterpret_cast<uint32_t>(ptr);
+  ASSERT(from % paging::kPageSize == 0);
+  auto first = paging::Page::ContainingAddress(from);
+  auto pages = large_ranges_.RunLength(first);
+  UnmapPages(from, from + pages * paging::kPageSize);
+  large_ranges_.Free(first, pages);
+  large_bytes_ -= pages * paging::kPageSize;
+}
+
+bool KHeap::ResizeLarge(uint32_t address, size_t size) {
+  auto first = paging::Page::ContainingAddress(address);
+  auto pages = large_ranges_.RunLength(first);
+  auto new_pages = round_up(size ? size : 1, paging::kPageSize) /
+                   paging::kPageSize;
+  if (new_pages == pages)
+    return true;
+  if (!large_ranges_.Resize(first, pages, new_pages))
+    return false;
+
+  auto end = address + pages * paging::kPageSize;
+  auto new_end = address + new_pages * paging::kPageSize;
+  if (new_pages < pages) {
+    UnmapPages(new_end, end);
+    large_bytes_ -= end - new_end;
+    return true;
+  }
+  if (!MapPages(end, new_end)) {
+    large_ranges_.Resize(first, new_pages, pages);
+    return false;
+  }
+  large_bytes_ += new_end - end;
+  return true;
+}
+
+void *KHeap::MoveLarge(uint32_t address, size_t size) {
+  auto first = paging::Page::ContainingAddress(address);
+  auto pages = large_ranges_.RunLength(first);
+  auto new_pages = round_up(size, paging::kPageSize) / paging::kPageSize;
+  ASSERT(new_pages > pages);
+  auto target = large_ranges_.Allocate(new_pages);
+  if (!target)
+    return nullptr;
+
+  auto to = static_cast<uint32_t>(target->start_address());
+  if (!MapPages(to + pages * paging::kPageSize,
+                to + new_pages * paging::kPageSize)) {
+    large_ranges_.Free(*target, new_pages);
+    return nullptr;
+  }
+
+  // the contents move with the frames, so nothing is copied
+  auto flags = page_flags();
+  auto move = [flags, this](uint32_t from, uint32_t to) {
+    auto page = paging::Page::ContainingAddress(from);
+    auto frame = mapper_.Unmap(page, frames_);
+    if (mapper_.Map(paging::Page::ContainingAddress(to), frame, flags,
+                    frames_))
+      return true;
+    // the old page table is still there, so this can't fail
+    mapper_.Map(page, frame, flags, frames_);
+    return false;
+  };
+  for (size_t i = 0; i < pages; ++i) {
+    auto offset = i * paging::kPageSize;
+    if (!move(address + offset, to + offset)) {
+      // there was no frame for a page table, so put everything back
+      while (i--)
+        move(to + i * paging::kPageSize, address + i * paging::kPageSize);
+      UnmapPages(to + pages * paging::kPageSize,
+                 to + new_pages * paging::kPageSize);
+      large_ranges_.Free(*target, new_pages);
+      return nullptr;
+    }
+  }
+  large_ranges_.Free(first, pages);
+  large_bytes_ += (new_pages - pages) * paging::kPageSize;
+  return reinterpret_cast<void *>(to);
+}
+
+bool KHeap::Expand(size_t min_size) {
+  // enough for the request after MappingSearch rounds it up, plus a header
+  auto grow = round_up(min_size + (min_size >> kSecondLevelLog2) + kOverhead,
+                       paging::kPageSize);
+  if (grow < kHeapMinGrowth)
+    grow = kHeapMinGrowth;
+  if (grow > max_address_ - end_address_)
+    grow = round_up(max_address_ - end_address_, paging::kPageSize);
+  if (grow == 0 || !MapPages(end_address_, end_address_ + grow))
+    return false;
+
+  // the old sentinel becomes the header of the new space
+  auto block = sentinel_;
+  end_address_ += grow;
+  sentinel_ = reinterpret_cast<Block *>(end_address_ - kOverhead);
+  block->size_and_flags = reinterpret_cast<uint8_t *>(sentinel_) -
+                          static_cast<uint8_t *>(block->payload());
+  sentinel_->prev_physical = block;
+  sentinel_->size_and_flags = 0;
+  block->set_free(true);
+  InsertFree(Coalesce(block));
+  return true;
+}
+
+void *KHeap::AllocateAligned(size_t size, size_t alignment) {
+  ASSERT((alignment & (alignment - 1)) == 0);
+  if (alignment <= kAlign || (size >= kLargeAllocationSize &&
+                              alignment <= paging::kPageSize))
+    return Allocate(size);
+  size = size < kMinBlockSize ? kMinBlockSize : round_up(size, kAlign);
+
+  // leave room for a gap in front of the aligned payload, which has to be big
+  // enough to be a free block of its own
+  auto search = size + alignment + kOverhead + kMinBlockSize;
+  auto block = Take(search);
+  if (!block && Expand(search))
+    block = Take(search);
+  if (!block)
+    return nullptr;
+
+  auto payload = reinterpret_cast<uint32_t>(block->payload());
+  auto aligned = round_up(payload, alignment);
+  if (aligned != payload) {
+    while (aligned - payload < kOverhead + kMinBlockSize)
+      aligned += alignment;
+
+    // split the gap off the front and give it back
+    auto gap = block;
+    block = Block::from_payload(reinterpret_cast<void *>(aligned));
+    block->prev_physical = gap;
+    block->size_and_flags = gap->size() - (aligned - payload);
+    block->next_physical()->prev_physical = block;
+    gap->set_size(aligned - payload - kOverhead);
+    InsertFree(gap);
+  }
+
+  Trim(block, size);
+  block->set_free(false);
+  used_bytes_ += block->size() + kOverhead;
+  return block->payload();
+}
+
+void test_kheap(KHeap &heap) {
+  const int kCount = 64;
+  void *blocks[kCount];
+  auto used = heap.used_bytes();
+
+  screen::Writef("kheap test: %d bytes mapped\n", heap.mapped_bytes());
+  for (int i = 0; i < kCount; ++i) {
+    blocks[i] = heap.Allocate(8 + (i * 97) % 3000, i % 16 == 0);
+    memset(blocks[i], i, 8);
+  }
+
+  // free every other block first so the rest have to merge on both sides
+  size_t bad = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = pass; i < kCount; i += 2) {
+      if (static_cast<uint8_t *>(blocks[i])[7] != i)
+        ++bad;
+      if (i % 16 == 0 &&
+          reinterpret_cast<uint32_t>(blocks[i]) % paging::kPageSize)
+        ++bad;
+      heap.Free(blocks[i]);
+    }
+  }
+
+  // everything merged back, so the biggest block the free lists serve should
+  // fit without growing the heap
+  auto mapped = heap.mapped_bytes();
+  auto big = heap.Allocate(KHeap::kLargeAllocationSize - kDefaultAlignment);
+  if (!big || heap.mapped_bytes() != mapped)
+    ++bad;
+  heap.Free(big);
+
+  // large blocks get pages of their own and leave the heap alone
+  const size_t kLargeSize = 0x10000;
+  auto large = static_cast<uint8_t *>(heap.Allocate(kLargeSize));
+  if (!large || heap.mapped_bytes() != mapped ||
+      heap.large_bytes() != kLargeSize)
+    ++bad;
+  large[0] = large[kLargeSize - 1] = 0x5A;
+  heap.Free(large);
+  if (heap.large_bytes() != 0)
+    ++bad;
+
+  // a block grows into the free block after it instead of moving
+  auto grown = static_cast<uint8_t *>(heap.Allocate(64));
+  auto after = heap.Allocate(64);
+  memset(grown, 0x3C, 64);
+  heap.Free(after);
+  if (heap.Reallocate(grown, 64, 200) != grown || grown[63] != 0x3C)
+    ++bad;
+
+  // a large block hemmed in by another one moves, but keeps its contents
+  large = static_cast<uint8_t *>(heap.Allocate(kLargeSize));
+  auto blocker = heap.Allocate(kLargeSize);
+  large[0] = large[kLargeSize - 1] = 0x5A;
+  auto moved = static_cast<uint8_t *>(
+      heap.Reallocate(large, kLargeSize, 2 * kLargeSize));
+  if (!moved || moved == large || moved[0] != 0x5A ||
+      moved[kLargeSize - 1] != 0x5A)
+    ++bad;
+
+  // ...and with the neighbour gone, grows where it is
+  heap.Free(blocker);
+  heap.Free(grown);
+  if (heap.Reallocate(moved, 2 * kLargeSize, 3 * kLargeSize) != moved ||
+      heap.large_bytes() != 3 * kLargeSize)
+    ++bad;
+  heap.Free(moved);
+
+  screen::Writef("  %d problems, %d bytes leaked\n", bad,
+                 heap.used_bytes() - used);
+}
+
+} // namespace alloc
@@ -20,106 +20,277 @@
  *
  * @section DESCRIPTION
  *
+ * The kernel heap, a two-level segregated fit (TLSF) allocator.
  */
 
 #ifndef SRC_INCLUDE_MM_KHEAP_H_
 #define SRC_INCLUDE_MM_KHEAP_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #include "mm/allocator.h"
+#include "mm/frame_allocator.h"
+#include "mm/page_mapper.h"
+#include "mm/tlsf.h"
+#include "mm/virtual_range.h"
 
 namespace alloc {
 
 /**
  * Allocator that manages a heap of memory.
+ *
+ * Free blocks are kept on segregated lists indexed two levels deep: the first
+ * level splits sizes by power of two, the second splits each power of two
+ * into kSecondLevelCount equal ranges. A bitmap per level records which lists
+ * are non-empty, so finding a block that fits is a couple of bit scans and
+ * both Allocate and Free run in constant time. Every block starts with a
+ * header pointing at the block physically before it, which lets Free merge
+ * with free neighbours on both sides immediately.
+ *
+ * Requests of kLargeAllocationSize bytes or more skip the free lists. They
+ * get a run of pages of their own in a separate virtual region, mapped to
+ * whatever frames are free, and the frames go straight back on Free, so big
+ * buffers don't fragment the heap.
  */
 class KHeap : public Allocator {
 public:
   /**
-   * Creates a new KHeap instance.
+   * Requests at least this big are mapped as whole pages.
+   */
+  static const size_t kLargeAllocationSize = 0x4000;
+
+  /**
+   * Creates a new KHeap instance and maps its initial pages.
    * @param start_address The virtual address of the start of the heap.
    * @param end_address The virtual address of the end of the heap.
    * @param max_address The maximum allowable address for the heap to grow into.
+   * @param large_end The end of the region for large allocations, which
+   * starts at max_address.
    * @param supervisor Indicates whether the heap is only accessible from
    * kernel-space.
    * @param readonly Indicates whether the heap is read only.
+   * @param frames The allocator to take frames from when the heap grows.
+   * @param mapper Maps the heap's pages to those frames.
    */
   KHeap(void *start_address, void *end_address, void *max_address,
-        bool supervisor, bool readonly);
+        void *large_end, bool supervisor, bool readonly,
+        paging::IFrameAllocator &frames, paging::IPageMapper &mapper);
 
+  using Allocator::Allocate;
   virtual void *Allocate(size_t size, bool align = false);
   virtual void Free(void *ptr);
 
+  /**
+   * Hands out a block whose payload starts on a multiple of alignment, by
+   * taking a block with room to spare and giving the gap in front back.
+   */
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Resizes a block without moving it. Blocks grow into the free block after
+   * them, growing the heap if they are last; large blocks grow by mapping the
+   * pages after them. Shrinking always succeeds and gives the tail back.
+   */
+  virtual bool TryExpandInPlace(void *ptr, size_t new_size);
+
+  /**
+   * Resizes a block, in place if possible. A large block that has to move is
+   * moved by remapping its frames rather than copying them. The heap knows
+   * how big every block is, so old_size is ignored.
+   */
+  virtual void *Reallocate(void *ptr, size_t old_size, size_t new_size);
+
+  /**
+   * Gets the number of bytes handed out and not yet freed, including block
+   * headers.
+   */
+  inline size_t used_bytes() const { return used_bytes_; }
+
+  /**
+   * Gets the number of bytes currently mapped for the heap.
+   */
+  inline size_t mapped_bytes() const { return end_address_ - start_address_; }
+
+  /**
+   * Gets the number of bytes mapped for large allocations.
+   */
+  inline size_t large_bytes() const { return large_bytes_; }
+
 private:
-  enum class Magic : uint32_t { kValue = 0x123890AB };
+  /**
+   * The shape of the free list index, see mm/tlsf.h.
+   */
+  static const uint32_t kSecondLevelLog2 = tlsf::kSecondLevelLog2;
+  static const uint32_t kSecondLevelCount = tlsf::kSecondLevelCount;
+  static const size_t kAlign = tlsf::kAlign;
+  static const uint32_t kFirstLevelMax = tlsf::kFirstLevelMax;
+  static const uint32_t kFirstLevelCount = tlsf::kFirstLevelCount;
 
   /**
-   * Header information placed at the beginning of every block of allocated
-   * memory.
+   * Placed at the start of every block. The free list links only exist
+   * while the block is free; otherwise they are the first bytes handed out.
    */
-  struct Header {
+  struct Block {
     /**
-     * Magic number used for error check and block boundary recognition.
+     * The block immediately before this one in memory, or nullptr.
      */
-    Magic magic;
+    Block *prev_physical;
 
     /**
-     * True if this memory is available for allocation.
+     * Size of the block's payload in bytes. The low bit is set when the
+     * block is free.
      */
-    bool is_hole;
+    size_t size_and_flags;
 
-    /**
-     * Size of the block in bytes, including the footer.
-     */
-    size_t size;
+    Block *next_free;
+    Block *prev_free;
+
+    inline size_t size() const { return size_and_flags & ~kFreeBit; }
+    inline bool is_free() const { return size_and_flags & kFreeBit; }
+    inline void set_size(size_t size) {
+      size_and_flags = size | (size_and_flags & kFreeBit);
+    }
+    inline void set_free(bool free) {
+      size_and_flags = free ? (size_and_flags | kFreeBit)
+                            : (size_and_flags & ~kFreeBit);
+    }
+
+    inline void *payload() {
+      return reinterpret_cast<uint8_t *>(this) + kOverhead;
+    }
+    inline Block *next_physical() {
+      return reinterpret_cast<Block *>(static_cast<uint8_t *>(payload()) +
+                                       size());
+    }
+    static inline Block *from_payload(void *ptr) {
+      return reinterpret_cast<Block *>(static_cast<uint8_t *>(ptr) -
+                                       kOverhead);
+    }
   };
 
+  static const size_t kFreeBit = 1;
+
   /**
-   * Footer information placed at the end of every block of allocated memory.
+   * The bytes in front of every payload.
    */
-  struct Footer {
-    /**
-     * Magic number, same as in Header.
-     */
-    Magic magic;
+  static const size_t kOverhead = 2 * sizeof(void *);
 
-    /**
-     * Pointer to the block header.
-     */
-    Header *header;
-  };
+  /**
+   * The smallest payload, big enough to hold the free list links.
+   */
+  static const size_t kMinBlockSize = 2 * sizeof(void *);
 
-  class OrderedHeaderArray {
-  public:
-    explicit OrderedHeaderArray(uint32_t);
-    OrderedHeaderArray(KHeap::Header **, uint32_t);
-    ~OrderedHeaderArray();
+  Block *FindSuitable(uint32_t &fl, uint32_t &sl);
+  void InsertFree(Block *block);
+  void RemoveFree(Block *block);
 
-    bool Insert(const KHeap::Header *item);
-    KHeap::Header *operator[](const int index);
-    void Remove(int i);
+  /**
+   * Splits the tail off a block if it's big enough to be a block of its own,
+   * and puts it on the free lists.
+   */
+  void Trim(Block *block, size_t size);
 
-    int size() { return size_; }
+  /**
+   * Merges a free block with its free neighbours.
+   * @return The merged block, not on any list.
+   */
+  Block *Coalesce(Block *block);
 
-  private:
-    KHeap::Header **array_;
-    int size_;
-    int max_size_;
-  };
+  /**
+   * Finds and takes a free block with at least size bytes of payload.
+   */
+  Block *Take(size_t size);
+
+  /**
+   * Resizes a block in the heap where it is.
+   */
+  bool ResizeBlock(Block *block, size_t size);
+
+  /**
+   * Maps or unmaps pages at the end of a large block.
+   */
+  bool ResizeLarge(uint32_t address, size_t size);
+
+  /**
+   * Moves a large block to a bigger run of pages, taking its frames with it.
+   * @return The new address, or nullptr if there was no room.
+   */
+  void *MoveLarge(uint32_t address, size_t size);
+
+  /**
+   * Gets the flags every page of the heap is mapped with.
+   */
+  paging::Entry::Flags page_flags() const;
+
+  /**
+   * Maps fresh frames at [from, to).
+   * @return False if there weren't enough frames, in which case nothing is
+   * left mapped.
+   */
+  bool MapPages(uint32_t from, uint32_t to);
+
+  /**
+   * Unmaps [from, to) and frees the frames behind it.
+   */
+  void UnmapPages(uint32_t from, uint32_t to);
+
+  /**
+   * Maps a run of pages in the large allocation region.
+   */
+  void *AllocateLarge(size_t size);
+  void FreeLarge(void *ptr);
+
+  inline bool is_large(uint32_t address) const {
+    return address >= max_address_ && address < large_end_;
+  }
 
-  int32_t FindSmallestHole(size_t size, bool align);
-  void Expand(size_t new_size);
-  size_t Contract(size_t new_size);
+  /**
+   * Maps more pages onto the end of the heap.
+   * @param min_size The payload size the new space must be able to satisfy.
+   * @return True if the heap grew.
+   */
+  bool Expand(size_t min_size);
 
   uint32_t start_address_;
   uint32_t end_address_;
   uint32_t max_address_;
+  uint32_t large_end_;
   bool supervisor_;
   bool readonly_;
-  OrderedHeaderArray index_;
+  paging::IFrameAllocator &frames_;
+  paging::IPageMapper &mapper_;
+
+  /**
+   * The zero sized, never free block at the very end of the heap. It keeps
+   * next_physical() of the last real block from running off the end.
+   */
+  Block *sentinel_;
+
+  size_t used_bytes_;
+  size_t large_bytes_;
+
+  /**
+   * Hands out the virtual pages for large allocations.
+   */
+  paging::VirtualRangeAllocator large_ranges_;
+
+  /**
+   * Bit n is set when any second level list under first level n is
+   * non-empty.
+   */
+  uint32_t fl_bitmap_;
+  uint32_t sl_bitmap_[kFirstLevelCount];
+  Block *free_lists_[kFirstLevelCount][kSecondLevelCount];
 };
 
+/**
+ * Allocates, resizes and frees a mix of block sizes and checks that the heap
+ * merges everything back together afterwards.
+ * @param heap The heap to exercise.
+ */
+void test_kheap(KHeap &heap);
+
 } // namespace alloc
 
 #endif // SRC_INCLUDE_MM_KHEAP_H_
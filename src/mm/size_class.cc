@@ -0,0 +1,197 @@
+/**
+ * @file size_class.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/size_class.h"
+
+#include <cstring>
+
+#include "mm/virtual_range.h"
+#include "sys/io.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+const char *const kClassNames[SizeClassAllocator::kSizeClassCount] = {
+    "size-8",   "size-16",  "size-32",   "size-48",   "size-64",
+    "size-96",  "size-128", "size-192",  "size-256",  "size-384",
+    "size-512", "size-768", "size-1024", "size-1536", "size-2048"};
+
+} // namespace
+
+const size_t SizeClassAllocator::kClassSizes[kSizeClassCount] = {
+    8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+
+uint8_t SizeClassAllocator::class_lookup_[kMaxSizeClass / kLookupGranularity +
+                                          1];
+
+SizeClassAllocator::SizeClassAllocator(Allocator &fallback)
+    : fallback_(fallback) {
+  size_t i = 0;
+  for (size_t step = 0; step < sizeof(class_lookup_); ++step) {
+    while (kClassSizes[i] < step * kLookupGranularity)
+      ++i;
+    class_lookup_[step] = i;
+  }
+
+  // objects in a slab are spaced by the class size, so they can all be
+  // aligned as far as the size allows
+  for (i = 0; i < kSizeClassCount; ++i) {
+    new (&cache(i)) SlabCache(kClassNames[i], kClassSizes[i],
+                              ClassAlignment(i), nullptr, kSlabPages);
+  }
+}
+
+void *SizeClassAllocator::Allocate(size_t size, bool align) {
+  if (align || size > kMaxSizeClass)
+    return fallback_.Allocate(size, align);
+
+  auto ptr = cache(ClassIndex(size)).Allocate();
+  if (!ptr)
+    ptr = fallback_.Allocate(size);
+  return ptr;
+}
+
+void SizeClassAllocator::Free(void *ptr) {
+  if (ptr == nullptr)
+    return;
+
+  if (reinterpret_cast<uint32_t>(ptr) < paging::kKernelVirtualRangeStart) {
+    fallback_.Free(ptr);
+    return;
+  }
+  SlabCache::CacheOf(ptr, kSlabPages)->Free(ptr);
+}
+
+void *SizeClassAllocator::AllocateAligned(size_t size, size_t alignment) {
+  auto index = ClassFor(size, alignment);
+  if (index == kSizeClassCount)
+    return fallback_.AllocateAligned(size, alignment);
+
+  auto ptr = cache(index).Allocate();
+  if (!ptr)
+    ptr = fallback_.AllocateAligned(size, alignment);
+  return ptr;
+}
+
+void SizeClassAllocator::FreeSized(void *ptr, size_t size, size_t alignment) {
+  if (ptr == nullptr)
+    return;
+
+  if (reinterpret_cast<uint32_t>(ptr) < paging::kKernelVirtualRangeStart) {
+    fallback_.FreeSized(ptr, size, alignment);
+    return;
+  }
+  cache(ClassFor(size, alignment)).Free(ptr);
+}
+
+bool SizeClassAllocator::TryExpandInPlace(void *ptr, size_t new_size) {
+  if (reinterpret_cast<uint32_t>(ptr) < paging::kKernelVirtualRangeStart)
+    return fallback_.TryExpandInPlace(ptr, new_size);
+
+  // FreeSized finds the class from the size, so it mustn't change
+  return new_size > 0 && new_size <= kMaxSizeClass &&
+         ClassIndex(new_size) == ClassOf(ptr);
+}
+
+size_t SizeClassAllocator::ClassOf(const void *ptr) const {
+  if (reinterpret_cast<uint32_t>(ptr) < paging::kKernelVirtualRangeStart)
+    return kSizeClassCount;
+  return SlabCache::CacheOf(ptr, kSlabPages) - &cache(0);
+}
+
+size_t SizeClassAllocator::Shrink() {
+  size_t pages = 0;
+  for (size_t i = 0; i < kSizeClassCount; ++i)
+    pages += cache(i).Shrink();
+  return pages;
+}
+
+void SizeClassAllocator::Dump() const {
+  screen::WriteLine("size classes:");
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    auto &c = cache(i);
+    if (c.slab_count() == 0)
+      continue;
+    screen::Writef("  %s: %d active, %d slabs\n", c.name(),
+                   c.active_objects(), c.slab_count());
+  }
+}
+
+namespace {
+
+/**
+ * Times kCount allocations of one size followed by freeing them all.
+ * @return The number of cycles taken.
+ */
+uint32_t TimeAllocations(Allocator &allocator, size_t size) {
+  const int kCount = 256;
+  void *blocks[kCount];
+
+  auto start = read_tsc();
+  for (int i = 0; i < kCount; ++i)
+    blocks[i] = allocator.Allocate(size);
+  for (int i = 0; i < kCount; ++i)
+    allocator.Free(blocks[i]);
+  return static_cast<uint32_t>(read_tsc() - start);
+}
+
+} // namespace
+
+void test_size_classes(SizeClassAllocator &allocator, Allocator &fallback) {
+  size_t bad = 0;
+  for (size_t size = 1; size <= SizeClassAllocator::kMaxSizeClass + 1;
+       size = size * 3 / 2 + 1) {
+    auto block = static_cast<uint8_t *>(allocator.Allocate(size));
+    memset(block, 0xA5, size);
+    if (size <= SizeClassAllocator::kMaxSizeClass &&
+        SlabCache::CacheOf(block, SizeClassAllocator::kSlabPages)
+                ->object_size() < size)
+      ++bad;
+    allocator.Free(block);
+  }
+
+  // aligned blocks, some from the classes and some from the fallback
+  for (size_t alignment = 16; alignment <= paging::kPageSize; alignment *= 4) {
+    auto block = allocator.AllocateAligned(40, alignment);
+    if (reinterpret_cast<uint32_t>(block) % alignment)
+      ++bad;
+    allocator.FreeSized(block, 40, alignment);
+  }
+
+  // warm up both so neither pays for growing in the timed loop
+  TimeAllocations(allocator, 32);
+  TimeAllocations(fallback, 32);
+  screen::Writef("size class test: %d problems\n", bad);
+  screen::Writef("  256 x 32 bytes: %d cycles, heap %d cycles\n",
+                 TimeAllocations(allocator, 32),
+                 TimeAllocations(fallback, 32));
+  allocator.Dump();
+}
+
+} // namespace alloc
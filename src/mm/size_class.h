@@ -0,0 +1,195 @@
+/**
+ * @file size_class.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * A front end for small allocations that rounds them up to a fixed set of
+ * size classes and serves each class from its own slab cache.
+ */
+
+#ifndef SRC_INCLUDE_MM_SIZE_CLASS_H_
+#define SRC_INCLUDE_MM_SIZE_CLASS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/allocator.h"
+#include "mm/slab.h"
+
+namespace alloc {
+
+/**
+ * Allocator for general purpose kernel allocations. Requests up to
+ * kMaxSizeClass bytes are rounded up to one of a set of geometrically spaced
+ * size classes and taken from that class's SlabCache, so they carry no
+ * per-block header and cost a list pop. Aligned requests go to the first
+ * class whose blocks are aligned well enough. Anything bigger, or more aligned
+ * than a cache line, goes to the fallback allocator.
+ *
+ * Free tells the two apart by address: slabs live in the kernel virtual
+ * range handed out by paging::PageAllocator, the fallback heap below it.
+ */
+class SizeClassAllocator : public Allocator {
+public:
+  /**
+   * The largest request served from a size class.
+   */
+  static const size_t kMaxSizeClass = 2048;
+
+  /**
+   * The number of size classes.
+   */
+  static const size_t kSizeClassCount = 15;
+
+  /**
+   * Every class uses slabs of this many pages, which is what lets Free find
+   * the owning cache from an address alone.
+   */
+  static const size_t kSlabPages = 4;
+
+  /**
+   * Creates a new SizeClassAllocator instance. paging::PageAllocator must be
+   * initialized before the first allocation.
+   * @param fallback The allocator for large and page aligned requests.
+   */
+  explicit SizeClassAllocator(Allocator &fallback);
+
+  using Allocator::Allocate;
+  virtual void *Allocate(size_t size, bool align = false);
+  virtual void Free(void *ptr);
+  virtual void *AllocateAligned(size_t size, size_t alignment);
+
+  /**
+   * Releases a block without looking up which class it came from.
+   */
+  virtual void FreeSized(void *ptr, size_t size,
+                         size_t alignment = kDefaultAlignment);
+
+  /**
+   * A block from a size class can be resized within its class; anything
+   * else is up to the fallback allocator.
+   */
+  virtual bool TryExpandInPlace(void *ptr, size_t new_size);
+
+  /**
+   * Gives the empty slabs of every class back to the system.
+   * @return The number of pages released.
+   */
+  size_t Shrink();
+
+  /**
+   * Writes the usage of every size class to the screen.
+   */
+  void Dump() const;
+
+  /**
+   * Finds the class a request of the given size is served from.
+   * @param size The size of the request, at most kMaxSizeClass.
+   */
+  static inline size_t ClassIndex(size_t size) {
+    return class_lookup_[(size + kLookupGranularity - 1) /
+                         kLookupGranularity];
+  }
+
+  /**
+   * Finds the class an aligned request is served from: the first class big
+   * enough whose blocks are all suitably aligned.
+   * @return The class index, or kSizeClassCount if no class will do.
+   */
+  static inline size_t ClassFor(size_t size, size_t alignment) {
+    if (size > kMaxSizeClass)
+      return kSizeClassCount;
+    auto index = ClassIndex(size);
+    while (index < kSizeClassCount && ClassAlignment(index) < alignment)
+      ++index;
+    return index;
+  }
+
+  /**
+   * Gets the size of the blocks in a class.
+   */
+  static inline size_t ClassSize(size_t index) { return kClassSizes[index]; }
+
+  /**
+   * Gets the alignment every block of a class has: the largest power of two
+   * dividing the class size, up to a cache line.
+   */
+  static inline size_t ClassAlignment(size_t index) {
+    auto size = kClassSizes[index];
+    auto lowest_bit = size & (~size + 1);
+    return lowest_bit < kCacheLineSize ? lowest_bit : kCacheLineSize;
+  }
+
+  /**
+   * Finds the class a block was allocated from.
+   * @param ptr A block handed out by this allocator.
+   * @return The class index, or kSizeClassCount if the block came from the
+   * fallback allocator.
+   */
+  size_t ClassOf(const void *ptr) const;
+
+  /**
+   * Takes a block from one size class.
+   * @param index The class index.
+   * @return The block, or nullptr if the class couldn't grow.
+   */
+  inline void *AllocateFromClass(size_t index) {
+    return cache(index).Allocate();
+  }
+
+private:
+  /**
+   * Sizes are looked up in steps of this many bytes.
+   */
+  static const size_t kLookupGranularity = 8;
+
+  static const size_t kClassSizes[kSizeClassCount];
+  static uint8_t class_lookup_[kMaxSizeClass / kLookupGranularity + 1];
+
+  inline SlabCache &cache(size_t i) {
+    return reinterpret_cast<SlabCache *>(cache_memory_)[i];
+  }
+  inline const SlabCache &cache(size_t i) const {
+    return reinterpret_cast<const SlabCache *>(cache_memory_)[i];
+  }
+
+  Allocator &fallback_;
+
+  /**
+   * Room for the caches, which are constructed in place because SlabCache
+   * has no default constructor.
+   */
+  alignas(SlabCache) unsigned char
+      cache_memory_[kSizeClassCount * sizeof(SlabCache)];
+};
+
+/**
+ * Checks that every size class hands out usable, correctly sized blocks and
+ * compares the cost of small allocations against the fallback allocator.
+ * @param allocator The size class allocator to exercise.
+ * @param fallback The allocator it falls back to.
+ */
+void test_size_classes(SizeClassAllocator &allocator, Allocator &fallback);
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_SIZE_CLASS_H_
@@ -0,0 +1,324 @@
+/**
+ * @file slab.cc
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "mm/slab.h"
+
+#include "mm/page_allocator.h"
+#include "sys/kernel.h"
+#include "video/text_screen.h"
+
+namespace alloc {
+
+namespace {
+
+/**
+ * Slabs grow (by powers of two) until at least this many objects fit...
+ */
+const size_t kMinObjectsPerSlab = 8;
+
+/**
+ * ...or they reach this many pages.
+ */
+const size_t kMaxPagesPerSlab = 8;
+
+inline size_t round_up(size_t x, size_t align) {
+  return (x + align - 1) & ~(align - 1);
+}
+
+/**
+ * Dropping an empty slab costs nothing but having to map it again later.
+ */
+const unsigned kSlabShrinkCost = 10;
+
+class SlabShrinker : public paging::Shrinker {
+public:
+  SlabShrinker() : Shrinker(kSlabShrinkCost) {}
+
+  virtual size_t Count() { return SlabCache::ReclaimablePages(); }
+  virtual size_t Scan(size_t count) { return SlabCache::ShrinkAll(count); }
+};
+
+SlabShrinker slab_shrinker;
+
+} // namespace
+
+SlabCache *SlabCache::caches_ = nullptr;
+
+SlabCache::SlabCache(const char *name, size_t object_size, size_t align,
+                     Constructor constructor, size_t pages_per_slab)
+    : name_(name), object_size_(object_size), align_(align),
+      constructor_(constructor), free_offset_(0), stride_(0),
+      header_size_(0), pages_per_slab_(pages_per_slab ? pages_per_slab : 1),
+      objects_per_slab_(0), colours_(1), next_colour_(0), colour_step_(0),
+      partial_(nullptr), full_(nullptr), empty_(nullptr), active_objects_(0),
+      slab_count_(0), next_cache_(caches_) {
+  ASSERT(object_size > 0);
+  ASSERT(align > 0 && (align & (align - 1)) == 0);
+  if (align_ < sizeof(void *))
+    align_ = sizeof(void *);
+
+  // constructed objects keep their state while free, so the free list
+  // pointer has to go after them instead of over them
+  if (constructor_)
+    free_offset_ = round_up(object_size, sizeof(void *));
+  auto size = constructor_ ? free_offset_ + sizeof(void *) : object_size;
+  stride_ = round_up(size < sizeof(void *) ? sizeof(void *) : size, align_);
+  header_size_ = round_up(sizeof(Slab), align_);
+
+  ASSERT((pages_per_slab_ & (pages_per_slab_ - 1)) == 0);
+  while (!pages_per_slab && pages_per_slab_ < kMaxPagesPerSlab &&
+         (pages_per_slab_ * paging::kPageSize - header_size_) / stride_ <
+             kMinObjectsPerSlab)
+    pages_per_slab_ *= 2;
+  auto usable = pages_per_slab_ * paging::kPageSize - header_size_;
+  objects_per_slab_ = usable / stride_;
+  ASSERT(objects_per_slab_ > 0);
+
+  colour_step_ = align_ > kCacheLineSize ? align_ : kCacheLineSize;
+  colours_ = (usable - objects_per_slab_ * stride_) / colour_step_ + 1;
+
+  caches_ = this;
+}
+
+SlabCache::~SlabCache() {
+  ASSERT(active_objects_ == 0);
+  Shrink();
+
+  if (caches_ == this) {
+    caches_ = next_cache_;
+    return;
+  }
+  for (auto cache = caches_; cache; cache = cache->next_cache_) {
+    if (cache->next_cache_ == this) {
+      cache->next_cache_ = next_cache_;
+      return;
+    }
+  }
+}
+
+void *SlabCache::Allocate() {
+  lock_.Lock();
+  Slab *slab = partial_;
+  if (!slab) {
+    slab = empty_;
+    if (slab) {
+      Remove(empty_, slab);
+    } else {
+      lock_.Unlock();
+      if (!(slab = Grow()))
+        return nullptr;
+      lock_.Lock();
+      ++slab_count_;
+    }
+    Push(partial_, slab);
+  }
+
+  auto object = slab->free_list;
+  slab->free_list = next_free(object);
+  ++slab->in_use;
+  ++active_objects_;
+  if (slab->in_use == objects_per_slab_) {
+    Remove(partial_, slab);
+    Push(full_, slab);
+  }
+  lock_.Unlock();
+  return object;
+}
+
+void SlabCache::Free(void *object) {
+  if (object == nullptr)
+    return;
+
+  auto slab_mask = ~(pages_per_slab_ * paging::kPageSize - 1);
+  auto slab = reinterpret_cast<Slab *>(reinterpret_cast<uint32_t>(object) &
+                                       slab_mask);
+  ASSERT(slab->cache == this);
+
+  SpinlockGuard guard(lock_);
+  ASSERT(slab->in_use > 0);
+  if (slab->in_use == objects_per_slab_) {
+    Remove(full_, slab);
+    Push(partial_, slab);
+  }
+  next_free(object) = slab->free_list;
+  slab->free_list = object;
+  --active_objects_;
+  if (--slab->in_use == 0) {
+    Remove(partial_, slab);
+    Push(empty_, slab);
+  }
+}
+
+size_t SlabCache::Shrink() {
+  lock_.Lock();
+  return ReleaseEmpty();
+}
+
+size_t SlabCache::ReleaseEmpty() {
+  auto slabs = empty_;
+  empty_ = nullptr;
+  size_t count = 0;
+  for (auto slab = slabs; slab; slab = slab->next)
+    ++count;
+  slab_count_ -= count;
+  lock_.Unlock();
+
+  while (slabs) {
+    auto slab = slabs;
+    slabs = slab->next;
+    Destroy(slab);
+  }
+  return count * pages_per_slab_;
+}
+
+void SlabCache::DumpAll() {
+  screen::WriteLine("slab caches:");
+  for (auto cache = caches_; cache; cache = cache->next_cache_) {
+    screen::Writef("  %s: %d bytes, %d active, %d slabs of %d pages\n",
+                   cache->name_, cache->object_size_, cache->active_objects_,
+                   cache->slab_count_, cache->pages_per_slab_);
+  }
+}
+
+size_t SlabCache::ReclaimablePages() {
+  size_t pages = 0;
+  for (auto cache = caches_; cache; cache = cache->next_cache_) {
+    if (!cache->lock_.TryLock())
+      continue;
+    for (auto slab = cache->empty_; slab; slab = slab->next)
+      pages += cache->pages_per_slab_;
+    cache->lock_.Unlock();
+  }
+  return pages;
+}
+
+size_t SlabCache::ShrinkAll(size_t pages) {
+  size_t released = 0;
+  for (auto cache = caches_; cache && released < pages;
+       cache = cache->next_cache_) {
+    // a busy cache may be the one whose Allocate or Free ran out of memory
+    // on this processor, so it is skipped rather than waited for
+    if (cache->lock_.TryLock())
+      released += cache->ReleaseEmpty();
+  }
+  return released;
+}
+
+paging::Shrinker &SlabCache::shrinker() { return slab_shrinker; }
+
+SlabCache *SlabCache::CacheOf(const void *object, size_t pages_per_slab) {
+  auto slab_mask = ~(pages_per_slab * paging::kPageSize - 1);
+  auto slab = reinterpret_cast<const Slab *>(
+      reinterpret_cast<uint32_t>(object) & slab_mask);
+  return slab->cache;
+}
+
+SlabCache::Slab *SlabCache::Grow() {
+  // aligning slabs to their size is what lets Free find them
+  auto memory = paging::PageAllocator::instance().AllocatePages(
+      pages_per_slab_, pages_per_slab_);
+  if (!memory)
+    return nullptr;
+
+  auto slab = static_cast<Slab *>(memory);
+  slab->cache = this;
+  slab->next = slab->prev = nullptr;
+  slab->in_use = 0;
+  slab->free_list = nullptr;
+
+  // slabs can grow on several processors at once
+  auto colour = __atomic_fetch_add(&next_colour_, 1, __ATOMIC_RELAXED);
+  auto first = static_cast<uint8_t *>(memory) + header_size_ +
+               (colour % colours_) * colour_step_;
+
+  // chain the objects up in address order
+  for (size_t i = objects_per_slab_; i > 0; --i) {
+    void *object = first + (i - 1) * stride_;
+    if (constructor_)
+      constructor_(object);
+    next_free(object) = slab->free_list;
+    slab->free_list = object;
+  }
+  return slab;
+}
+
+void SlabCache::Destroy(Slab *slab) {
+  ASSERT(slab->in_use == 0);
+  slab->cache = nullptr;
+  paging::PageAllocator::instance().FreePages(slab, pages_per_slab_);
+}
+
+void SlabCache::Push(Slab *&list, Slab *slab) {
+  slab->prev = nullptr;
+  slab->next = list;
+  if (list)
+    list->prev = slab;
+  list = slab;
+}
+
+void SlabCache::Remove(Slab *&list, Slab *slab) {
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    list = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = slab->prev = nullptr;
+}
+
+namespace {
+
+const uint32_t kTestMagic = 0xC0FFEE11;
+size_t test_constructed = 0;
+
+void ConstructTestObject(void *object) {
+  *static_cast<uint32_t *>(object) = kTestMagic;
+  ++test_constructed;
+}
+
+} // namespace
+
+void test_slab() {
+  SlabCache cache("slab-test", 48, kCacheLineSize, ConstructTestObject);
+
+  const int kCount = 200;
+  void *objects[kCount];
+  size_t bad = 0;
+  for (int i = 0; i < kCount; ++i) {
+    objects[i] = cache.Allocate();
+    if (reinterpret_cast<uint32_t>(objects[i]) % kCacheLineSize ||
+        *static_cast<uint32_t *>(objects[i]) != kTestMagic)
+      ++bad;
+  }
+  screen::Writef("slab test: %d objects in %d slabs, %d constructed\n",
+                 cache.active_objects(), cache.slab_count(),
+                 test_constructed);
+  SlabCache::DumpAll();
+
+  for (int i = 0; i < kCount; ++i)
+    cache.Free(objects[i]);
+  screen::Writef("  %d problems, %d pages released\n", bad, cache.Shrink());
+}
+
+} // namespace alloc
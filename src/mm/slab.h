@@ -0,0 +1,246 @@
+/**
+ * @file slab.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * Object caches for fixed size kernel objects.
+ */
+
+#ifndef SRC_INCLUDE_MM_SLAB_H_
+#define SRC_INCLUDE_MM_SLAB_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mm/shrinker.h"
+#include "sys/spinlock.h"
+
+namespace alloc {
+
+/**
+ * The size of a CPU cache line. Objects that ask for cache alignment are
+ * aligned to this, and slab colouring moves in steps of it.
+ */
+const size_t kCacheLineSize = 64;
+
+/**
+ * A cache of equally sized objects. Objects are carved out of slabs, runs of
+ * whole pages that begin with a small descriptor and are aligned to their own
+ * size, so the slab an object belongs to is found by masking its address.
+ * Free objects are chained through a pointer stored inside them, so there is
+ * no per-object header at all.
+ *
+ * The first object in each new slab is offset by a different multiple of
+ * kCacheLineSize (the slab's colour), using up the space left over at the
+ * end of the slab. That spreads objects at the same index in different slabs
+ * across different cache sets.
+ *
+ * If the cache has a constructor, it runs once when a slab is created and
+ * objects are expected to be freed in their constructed state. Their free
+ * list pointer is then kept after the object rather than inside it.
+ *
+ * Each cache has a lock over its slab lists, which the shrinker only ever
+ * tries to take: the holder may be partway through changing them when
+ * memory runs out.
+ */
+class SlabCache {
+public:
+  /**
+   * Puts a newly created object into its initial state.
+   */
+  typedef void (*Constructor)(void *object);
+
+  /**
+   * Creates a new SlabCache instance. No memory is taken until the first
+   * object is allocated, so caches can be created statically.
+   * @param name Shown in DumpAll, must outlive the cache.
+   * @param object_size The size of each object in bytes.
+   * @param align The alignment of each object, a power of two.
+   * @param constructor Run on every object when its slab is created, or
+   * nullptr.
+   * @param pages_per_slab The size of each slab in pages, a power of two, or
+   * 0 to pick one that fits a reasonable number of objects.
+   */
+  SlabCache(const char *name, size_t object_size,
+            size_t align = sizeof(void *), Constructor constructor = nullptr,
+            size_t pages_per_slab = 0);
+
+  ~SlabCache();
+
+  /**
+   * Takes an object from the cache.
+   * @return The object, or nullptr if no memory could be found for a new
+   * slab.
+   */
+  void *Allocate();
+
+  /**
+   * Returns an object to the cache it came from.
+   * @param object The object, which must have come from this cache.
+   */
+  void Free(void *object);
+
+  /**
+   * Gives the pages of every empty slab back to the system.
+   * @return The number of pages released.
+   */
+  size_t Shrink();
+
+  inline const char *name() const { return name_; }
+  inline size_t object_size() const { return object_size_; }
+
+  /**
+   * Gets the number of objects currently handed out.
+   */
+  inline size_t active_objects() const { return active_objects_; }
+
+  /**
+   * Gets the number of slabs the cache holds, in use or not.
+   */
+  inline size_t slab_count() const { return slab_count_; }
+
+  /**
+   * Writes the statistics of every cache to the screen.
+   */
+  static void DumpAll();
+
+  /**
+   * Gets the number of pages held by empty slabs across every cache.
+   */
+  static size_t ReclaimablePages();
+
+  /**
+   * Empties caches of their empty slabs until enough pages have been
+   * released.
+   * @param pages The number of pages wanted.
+   * @return The number of pages released.
+   */
+  static size_t ShrinkAll(size_t pages);
+
+  /**
+   * Gets the shrinker that calls ShrinkAll when memory runs low. It isn't
+   * registered until someone calls paging::RegisterShrinker with it.
+   */
+  static paging::Shrinker &shrinker();
+
+  /**
+   * Finds the cache an object came from, for callers that created all of
+   * their caches with the same fixed slab size.
+   * @param object An object handed out by one of the caches.
+   * @param pages_per_slab The slab size the caches were created with.
+   */
+  static SlabCache *CacheOf(const void *object, size_t pages_per_slab);
+
+private:
+  /**
+   * Placed at the start of every slab.
+   */
+  struct Slab {
+    SlabCache *cache;
+    Slab *next;
+    Slab *prev;
+    void *free_list;
+    size_t in_use;
+  };
+
+  /**
+   * Allocates and initializes a new, empty slab. Called without the lock,
+   * since mapping the slab may reclaim memory from the caches.
+   */
+  Slab *Grow();
+
+  /**
+   * Frees a slab's pages. It must be empty and on no list.
+   */
+  void Destroy(Slab *slab);
+
+  /**
+   * Takes every empty slab off the list, releases the lock, which the caller
+   * holds, and then frees them.
+   * @return The number of pages released.
+   */
+  size_t ReleaseEmpty();
+
+  inline void *&next_free(void *object) const {
+    return *reinterpret_cast<void **>(static_cast<uint8_t *>(object) +
+                                      free_offset_);
+  }
+
+  static void Push(Slab *&list, Slab *slab);
+  static void Remove(Slab *&list, Slab *slab);
+
+  const char *name_;
+  size_t object_size_;
+  size_t align_;
+  Constructor constructor_;
+
+  /**
+   * Where the free list pointer sits in a free object.
+   */
+  size_t free_offset_;
+
+  /**
+   * The distance between objects in a slab.
+   */
+  size_t stride_;
+
+  /**
+   * Room for the slab descriptor at the start of each slab.
+   */
+  size_t header_size_;
+
+  size_t pages_per_slab_;
+  size_t objects_per_slab_;
+
+  /**
+   * The number of distinct colours, a count of slabs grown whose remainder
+   * is the colour the next one gets, and the offset each colour adds.
+   */
+  size_t colours_;
+  size_t next_colour_;
+  size_t colour_step_;
+
+  Slab *partial_;
+  Slab *full_;
+  Slab *empty_;
+
+  size_t active_objects_;
+  size_t slab_count_;
+
+  /**
+   * Held while the slab lists and counts change.
+   */
+  Spinlock lock_;
+
+  /**
+   * All caches that exist, for DumpAll.
+   */
+  static SlabCache *caches_;
+  SlabCache *next_cache_;
+};
+
+/**
+ * Exercises a cache with a constructor and cache aligned objects.
+ */
+void test_slab();
+
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_SLAB_H_
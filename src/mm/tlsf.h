@@ -0,0 +1,93 @@
+/**
+ * @file tlsf.h
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ * @section DESCRIPTION
+ *
+ * The two-level index that maps block sizes to the kernel heap's free lists.
+ */
+
+#ifndef SRC_INCLUDE_MM_TLSF_H_
+#define SRC_INCLUDE_MM_TLSF_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace alloc {
+namespace tlsf {
+
+/**
+ * log2 of the number of second level lists per first level.
+ */
+const uint32_t kSecondLevelLog2 = 4;
+const uint32_t kSecondLevelCount = 1 << kSecondLevelLog2;
+
+/**
+ * Every block size is a multiple of this.
+ */
+const uint32_t kAlignLog2 = 3;
+const size_t kAlign = 1 << kAlignLog2;
+
+/**
+ * Blocks smaller than this all go in first level 0, split linearly.
+ */
+const uint32_t kFirstLevelShift = kSecondLevelLog2 + kAlignLog2;
+const size_t kSmallBlockSize = 1 << kFirstLevelShift;
+
+/**
+ * Blocks (and so the whole heap) must be smaller than 1 << kFirstLevelMax.
+ */
+const uint32_t kFirstLevelMax = 30;
+const uint32_t kFirstLevelCount = kFirstLevelMax - kFirstLevelShift + 1;
+
+/**
+ * Gets the index of the most significant set bit.
+ */
+inline uint32_t fls(uint32_t x) { return 31 - __builtin_clz(x); }
+
+/**
+ * Finds the list a free block of the given size belongs on.
+ */
+inline void MappingInsert(size_t size, uint32_t &fl, uint32_t &sl) {
+  if (size < kSmallBlockSize) {
+    // small sizes are split linearly into the lists of the first level
+    fl = 0;
+    sl = size / (kSmallBlockSize / kSecondLevelCount);
+  } else {
+    auto bit = fls(size);
+    sl = (size >> (bit - kSecondLevelLog2)) ^ kSecondLevelCount;
+    fl = bit - (kFirstLevelShift - 1);
+  }
+}
+
+/**
+ * Finds the first list whose blocks are all at least the given size.
+ */
+inline void MappingSearch(size_t size, uint32_t &fl, uint32_t &sl) {
+  // round up to the start of the next list, so that any block on the list
+  // we land on is big enough
+  if (size >= kSmallBlockSize)
+    size += (1u << (fls(size) - kSecondLevelLog2)) - 1;
+  MappingInsert(size, fl, sl);
+}
+
+} // namespace tlsf
+} // namespace alloc
+
+#endif // SRC_INCLUDE_MM_TLSF_H_
@@ -0,0 +1,120 @@
+/**
+ * @file symbols.cc
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "sys/symbols.h"
+
+#include "mm/early_allocator.h"
+#include "sys/addressing.h"
+
+namespace symbols {
+
+namespace {
+
+const uint32_t kSectionSymbolTable = 2;
+const uint8_t kSymbolFunction = 2;
+
+/**
+ * An entry of an ELF32 symbol table.
+ */
+struct ElfSymbol {
+  uint32_t st_name;
+  uint32_t st_value;
+  uint32_t st_size;
+  uint8_t st_info;
+  uint8_t st_other;
+  uint16_t st_shndx;
+} __attribute__((packed));
+
+Range g_symbols = {0, 0};
+Range g_strings = {0, 0};
+
+/**
+ * Gets the virtual address of a loaded section. Sections that aren't part of
+ * the kernel image are placed by the bootloader at a physical address, which
+ * is only usable if it falls in the initial mapping.
+ */
+uint32_t SectionAddress(const multiboot2::ElfSection &section) {
+  auto address = section.sh_addr;
+  if (address < static_cast<size_t>(addressing::kKernelBase)) {
+    address = static_cast<size_t>(addressing::paddress(address).ToVirtual());
+    if (address + section.sh_size > alloc::kInitialMappingEnd)
+      return 0;
+  }
+  return address;
+}
+
+} // namespace
+
+bool Initialize(multiboot2::ElfSymbolsTag *tag) {
+  if (tag == nullptr)
+    return false;
+
+  for (uint32_t i = 0; i < tag->num; ++i) {
+    auto &section = tag->sections[i];
+    if (section.sh_type != kSectionSymbolTable || section.sh_link >= tag->num)
+      continue;
+
+    auto &strings = tag->sections[section.sh_link];
+    auto symbols_address = SectionAddress(section);
+    auto strings_address = SectionAddress(strings);
+    if (!symbols_address || !strings_address)
+      return false;
+
+    g_symbols = {symbols_address, section.sh_size};
+    g_strings = {strings_address, strings.sh_size};
+    return true;
+  }
+  return false;
+}
+
+const char *Lookup(uint32_t address, uint32_t *offset) {
+  auto table = reinterpret_cast<const ElfSymbol *>(g_symbols.start);
+  auto count = g_symbols.size / sizeof(ElfSymbol);
+
+  // the closest function that starts at or before the address
+  const ElfSymbol *best = nullptr;
+  for (size_t i = 0; i < count; ++i) {
+    auto &symbol = table[i];
+    if ((symbol.st_info & 0xF) != kSymbolFunction || symbol.st_value > address)
+      continue;
+    if (address < symbol.st_value + symbol.st_size) {
+      best = &symbol;
+      break;
+    }
+    if (!best || symbol.st_value > best->st_value)
+      best = &symbol;
+  }
+
+  if (!best || best->st_name >= g_strings.size)
+    return nullptr;
+  *offset = address - best->st_value;
+  return reinterpret_cast<const char *>(g_strings.start + best->st_name);
+}
+
+Range symbol_table() { return g_symbols; }
+Range string_table() { return g_strings; }
+
+} // namespace symbols
@@ -0,0 +1,71 @@
+/**
+ * @file symbols.h
+ *
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2013  Ryan Bunker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see [http://www.gnu.org/licenses/].
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Turns kernel addresses into function names using the ELF symbol table the
+ * bootloader loaded.
+ */
+
+#ifndef SRC_INCLUDE_SYS_SYMBOLS_H_
+#define SRC_INCLUDE_SYS_SYMBOLS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "boot/multiboot2.h"
+
+namespace symbols {
+
+/**
+ * A block of memory the symbol tables live in.
+ */
+struct Range {
+  uint32_t start;
+  size_t size;
+};
+
+/**
+ * Finds the symbol and string tables among the kernel's ELF sections.
+ * @param tag The ELF sections tag from the multiboot information.
+ * @return True if both tables were found and are mapped.
+ */
+bool Initialize(multiboot2::ElfSymbolsTag *tag);
+
+/**
+ * Finds the function an address belongs to.
+ * @param address The address to look up.
+ * @param offset Set to the distance from the start of the function.
+ * @return The function's name, or nullptr if it isn't known.
+ */
+const char *Lookup(uint32_t address, uint32_t *offset);
+
+/**
+ * Gets where the symbol and string tables are, so their memory can be kept
+ * safe. Both are empty if Initialize failed.
+ */
+Range symbol_table();
+Range string_table();
+
+} // namespace symbols
+
+#endif // SRC_INCLUDE_SYS_SYMBOLS_H_